@@ -136,6 +136,35 @@ syscall(struct trapframe *tf)
 		err = sys_read((int) tf->tf_a0, (void *) tf->tf_a1, (size_t) tf->tf_a2, &retval);
 		break;
 
+		case SYS_pread: {
+		off_t pos = 0;
+		/* the 64-bit offset doesn't fit in a3; it's on the stack */
+		err = copyin((const_userptr_t) tf->tf_sp + 16, &pos, sizeof(off_t));
+		if (err) {
+			break;
+		}
+		err = sys_pread((int) tf->tf_a0, (void *) tf->tf_a1, (size_t) tf->tf_a2, pos, &retval);
+		break;
+		}
+
+		case SYS_pwrite: {
+		off_t pos = 0;
+		err = copyin((const_userptr_t) tf->tf_sp + 16, &pos, sizeof(off_t));
+		if (err) {
+			break;
+		}
+		err = sys_pwrite((int) tf->tf_a0, (const void *) tf->tf_a1, (size_t) tf->tf_a2, pos, &retval);
+		break;
+		}
+
+		case SYS_readv:
+		err = sys_readv((int) tf->tf_a0, (const struct iovec *) tf->tf_a1, (int) tf->tf_a2, &retval);
+		break;
+
+		case SYS_writev:
+		err = sys_writev((int) tf->tf_a0, (const struct iovec *) tf->tf_a1, (int) tf->tf_a2, &retval);
+		break;
+
 		case SYS_lseek: {
 		int whence = 0;
 		copyin((const_userptr_t) tf->tf_sp + 16, &whence, sizeof(int));
@@ -156,16 +185,28 @@ syscall(struct trapframe *tf)
 		err = sys__getcwd((char *) tf->tf_a0, (size_t) tf->tf_a1, &retval);
 		break;
 
+		case SYS_sync:
+		err = sys_sync();
+		break;
+
+		case SYS_ioctl:
+		err = sys_ioctl((int) tf->tf_a0, (int) tf->tf_a1, (userptr_t) tf->tf_a2);
+		break;
+
 		case SYS_fork: 
 		err = sys_fork(tf, &retval); 
 		break; 
 
+		case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 		case SYS_getpid: 
 		err = sys_getpid(&retval); 
 		break;
 
 		case SYS_waitpid:
-		err = sys_waitpid((pid_t) tf->tf_a0, (int *) tf->tf_a1, (int) tf->tf_a2);
+		err = sys_waitpid((pid_t) tf->tf_a0, (int *) tf->tf_a1, (int) tf->tf_a2, &retval);
 		break;
 
 		case SYS__exit:
@@ -176,6 +217,10 @@ syscall(struct trapframe *tf)
 		err = sys_execv((const char*)tf->tf_a0, (char **)tf->tf_a1); 
 		break; 
 
+		case SYS_spawn:
+		err = sys_spawn((const char *)tf->tf_a0, (char **)tf->tf_a1, (const struct spawn_fdmap *)tf->tf_a2, (int)tf->tf_a3, &retval);
+		break;
+
 	    default:
 			kprintf("Unknown syscall %d\n", callno);
 			err = ENOSYS;
@@ -35,6 +35,8 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <clock.h>
+#include <copyinout.h>
 #include <membar.h>
 #include <synch.h>
 #include <platform/bus.h>
@@ -128,6 +130,7 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
+		lh->lh_stats.ds_interrupts++;
 		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
@@ -151,17 +154,30 @@ lhd_eachopen(struct device *d, int openflags)
 
 /*
  * Function for handling ioctls.
+ *
+ * The statistics are only changed by whoever holds lh_clear (the
+ * interrupt handler only runs while an I/O is outstanding, which is
+ * only while someone holds it), so take it to get a consistent copy.
  */
 static
 int
 lhd_ioctl(struct device *d, int op, userptr_t data)
 {
-	/*
-	 * We don't support any ioctls.
-	 */
-	(void)d;
-	(void)op;
-	(void)data;
+	struct lhd_softc *lh = d->d_data;
+	struct diskstats stats;
+
+	switch (op) {
+	    case IOCTL_DISKSTATS:
+		P(lh->lh_clear);
+		stats = lh->lh_stats;
+		V(lh->lh_clear);
+		return copyout(&stats, data, sizeof(stats));
+	    case IOCTL_DISKSTATS_RESET:
+		P(lh->lh_clear);
+		bzero(&lh->lh_stats, sizeof(lh->lh_stats));
+		V(lh->lh_clear);
+		return 0;
+	}
 	return EIOCTL;
 }
 
@@ -179,8 +195,126 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Start an operation on SECTOR. The data to write, if any, must
+ * already be in the on-card buffer.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh, uint32_t sector, uint32_t statval)
+{
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, sector);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Wait until the interrupt handler tells us the operation started by
+ * lhd_start is done, and return its result.
+ */
+static
+int
+lhd_wait(struct lhd_softc *lh)
+{
+	int result;
+
+	P(lh->lh_done);
+	result = lh->lh_result;
+	if (result == 0) {
+		lh->lh_stats.ds_sectors++;
+	}
+	return result;
+}
+
+/*
+ * The hardware transfers one sector per operation, through the one
+ * on-card buffer, so there is nothing to coalesce a run of sectors
+ * into. What we can do is keep the disk busy: the copy between the
+ * caller's memory and the card, which for a user buffer may be slow,
+ * is done through lh_stage while the disk is working on the next (or
+ * previous) sector, so only a short memcpy sits between one operation
+ * completing and the next one starting.
+ *
+ * Both are called with lh_clear held, and leave no operation
+ * outstanding when they return, even on error.
+ */
+static
+int
+lhd_read(struct lhd_softc *lh, uint32_t sector, uint32_t len,
+	 struct uio *uio)
+{
+	uint32_t i;
+	int result;
+
+	lhd_start(lh, sector, LHD_WORKING);
+	for (i=0; ; i++) {
+		result = lhd_wait(lh);
+		if (result) {
+			return result;
+		}
+		membar_load_load();
+
+		if (i+1 == len) {
+			/* Last one; nothing to overlap the copy with. */
+			return uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		}
+
+		/* Get the data out of the way and start the next sector. */
+		memcpy(lh->lh_stage, lh->lh_buf, LHD_SECTSIZE);
+		lhd_start(lh, sector+i+1, LHD_WORKING);
+
+		result = uiomove(lh->lh_stage, LHD_SECTSIZE, uio);
+		if (result) {
+			lhd_wait(lh);
+			return result;
+		}
+	}
+}
+
+static
+int
+lhd_write(struct lhd_softc *lh, uint32_t sector, uint32_t len,
+	  struct uio *uio)
+{
+	uint32_t i;
+	int result, stageresult;
+
+	result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+	if (result) {
+		return result;
+	}
+	for (i=0; ; i++) {
+		membar_store_store();
+		lhd_start(lh, sector+i, LHD_WORKING | LHD_ISWRITE);
+
+		/* Fetch the next sector's data while this one is written. */
+		stageresult = 0;
+		if (i+1 < len) {
+			stageresult = uiomove(lh->lh_stage, LHD_SECTSIZE, uio);
+		}
+
+		result = lhd_wait(lh);
+		if (result) {
+			return result;
+		}
+		if (stageresult) {
+			return stageresult;
+		}
+		if (i+1 == len) {
+			return 0;
+		}
+		memcpy(lh->lh_buf, lh->lh_stage, LHD_SECTSIZE);
+	}
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * The device is held for the whole request rather than sector by
+ * sector, so a multi-sector request isn't interleaved with others
+ * (which would cost a seek each time) and the pipelining above works.
  */
 static
 int
@@ -192,8 +326,8 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	struct timespec before, after;
+	uint64_t nsecs;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -202,66 +336,45 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	/* Latency includes the wait for the device. */
+	gettime(&before);
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
-		}
+	/* Wait until nobody else is using the device. */
+	P(lh->lh_clear);
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
+	if (uio->uio_rw == UIO_WRITE) {
+		result = lhd_write(lh, sector, len, uio);
+	}
+	else {
+		result = lhd_read(lh, sector, len, uio);
+	}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+	gettime(&after);
+	timespec_sub(&after, &before, &after);
+	nsecs = after.tv_sec * 1000000000ULL + after.tv_nsec;
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+	lh->lh_stats.ds_requests++;
+	if (result) {
+		lh->lh_stats.ds_errors++;
+	}
+	lh->lh_stats.ds_totalnsecs += nsecs;
+	if (nsecs > lh->lh_stats.ds_maxnsecs) {
+		lh->lh_stats.ds_maxnsecs = nsecs;
 	}
 
-	return 0;
+	/* Tell another thread it's cleared to go ahead. */
+	V(lh->lh_clear);
+
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
@@ -296,6 +409,8 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 		return ENOMEM;
 	}
 
+	bzero(&lh->lh_stats, sizeof(lh->lh_stats));
+
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
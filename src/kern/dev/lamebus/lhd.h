@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <kern/ioctl.h>
 #include <device.h>
 
 /*
@@ -54,6 +55,8 @@ struct lhd_softc {
 	int lh_result;			/* Result from I/O operation */
 	struct semaphore *lh_clear;	/* Synchronization */
 	struct semaphore *lh_done;
+	struct diskstats lh_stats;	/* Counters; protected by lh_clear */
+	char lh_stage[LHD_SECTSIZE];	/* Staging buffer for lhd_io */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -33,11 +33,29 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <bitmap.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* How far past the goal sfs_balloc looks before taking any block. */
+#define SFS_BALLOC_SEARCH 16
+
+/* Failing that, how long a run of free blocks it looks for... */
+#define SFS_BALLOC_RUN 32
+
+/* ...and how far past the goal it looks for one. */
+#define SFS_BALLOC_WINDOW 1024
+
+/* Most blocks of data that may wait in memory for disk blocks... */
+#define SFS_BRESERVE_MAX 128
+
+/* ...and free blocks left over for the extent blocks they may need. */
+#define SFS_BRESERVE_SLACK 8
+
 /*
  * Zero out a disk block.
  */
@@ -52,39 +70,252 @@ sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 }
 
 /*
- * Allocate a block.
+ * Look for a free block at GOAL or a little past it, and claim it.
+ * Called with the freemap lock held.
+ */
+static
+bool
+sfs_bclaimnear(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	daddr_t block;
+
+	for (block = goal; block < goal + SFS_BALLOC_SEARCH; block++) {
+		if (block >= sfs->sfs_sb.sb_nblocks) {
+			break;
+		}
+		if (!bitmap_isset(sfs->sfs_freemap, block)) {
+			bitmap_mark(sfs->sfs_freemap, block);
+			*diskblock = block;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Look for the first run of SFS_BALLOC_RUN free blocks in the
+ * SFS_BALLOC_WINDOW blocks from GOAL on, and claim the first block of
+ * it, so the blocks after it are there for the file to grow into. If
+ * there's no such run but there is a free block in the window, claim
+ * the first one instead. The window keeps a fragmented volume, where
+ * there may be no run at all, from costing a scan of the whole
+ * freemap per allocation. Called with the freemap lock held.
+ */
+static
+bool
+sfs_bclaimrun(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	uint32_t nblocks = sfs->sfs_sb.sb_nblocks;
+	daddr_t block, start, firstfree;
+	uint32_t run;
+	bool found;
+
+	run = 0;
+	start = 0;
+	firstfree = 0;
+	found = false;
+	for (block = goal; block < goal + SFS_BALLOC_WINDOW; block++) {
+		if (block >= nblocks) {
+			break;
+		}
+		if (bitmap_isset(sfs->sfs_freemap, block)) {
+			run = 0;
+			continue;
+		}
+		if (!found) {
+			firstfree = block;
+			found = true;
+		}
+		if (run == 0) {
+			start = block;
+		}
+		if (++run == SFS_BALLOC_RUN) {
+			bitmap_mark(sfs->sfs_freemap, start);
+			*diskblock = start;
+			return true;
+		}
+	}
+	if (found) {
+		bitmap_mark(sfs->sfs_freemap, firstfree);
+		*diskblock = firstfree;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Claim a free block, preferably at GOAL (or soon after it) so that
+ * files come out contiguous, or else at the start of a good-sized
+ * free run not far past it; 0 means no preference, and takes the
+ * first free block. Called with the freemap lock held.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_bclaim(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
-	if (result) {
-		return result;
+	if (goal == 0 || (!sfs_bclaimnear(sfs, goal, diskblock) &&
+			  !sfs_bclaimrun(sfs, goal, diskblock))) {
+		result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+		if (result) {
+			return result;
+		}
 	}
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree--;
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
+	return 0;
+}
+
+/*
+ * Allocate a block, placed as sfs_bclaim says. Blocks promised to
+ * data waiting in memory (see sfs_breserve) aren't available.
+ * If CLEAR is false the caller is about to overwrite the whole block,
+ * so there's no point zeroing it first.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, bool clear, daddr_t *diskblock)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_nfree <= sfs->sfs_nreserved) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
+	}
+	result = sfs_bclaim(sfs, goal, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
+
+	if (!clear) {
+		return 0;
+	}
 
 	/* Clear block before returning it */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs->sfs_nfree++;
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
+/*
+ * Allocate up to WANT consecutive blocks, the first placed as
+ * sfs_bclaim says, for data that has blocks reserved; they come out
+ * of the reservation. Returns the first block and how many were
+ * allocated, at least one. They aren't zeroed.
+ */
+int
+sfs_ballocrun(struct sfs_fs *sfs, daddr_t goal, unsigned want,
+	      daddr_t *diskblock, unsigned *got)
+{
+	daddr_t block;
+	int result;
+
+	KASSERT(want > 0);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	KASSERT(sfs->sfs_nreserved >= want);
+	result = sfs_bclaim(sfs, goal, diskblock);
+	if (result) {
+		lock_release(sfs->sfs_freemaplock);
+		return result;
+	}
+	*got = 1;
+	for (block = *diskblock + 1; *got < want; block++) {
+		if (block >= sfs->sfs_sb.sb_nblocks ||
+		    bitmap_isset(sfs->sfs_freemap, block)) {
+			break;
+		}
+		bitmap_mark(sfs->sfs_freemap, block);
+		sfs->sfs_nfree--;
+		(*got)++;
+	}
+	sfs->sfs_nreserved -= *got;
+	lock_release(sfs->sfs_freemaplock);
+	return 0;
+}
+
+/*
+ * Free N blocks from DISKBLOCK on that sfs_ballocrun gave out, and
+ * reserve them again for the data that didn't go in them after all.
+ */
+void
+sfs_bfreerun(struct sfs_fs *sfs, daddr_t diskblock, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sfs_bfree(sfs, diskblock + i);
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs->sfs_nreserved += n;
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Promise a block to data that will wait in memory and be given one
+ * by sfs_ballocrun later. Fails with EAGAIN if too much is waiting
+ * already, or ENOSPC if there's no block to promise.
+ */
+int
+sfs_breserve(struct sfs_fs *sfs)
+{
+	int result = 0;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (sfs->sfs_nreserved >= SFS_BRESERVE_MAX) {
+		result = EAGAIN;
+	}
+	else if (sfs->sfs_nfree <= sfs->sfs_nreserved + SFS_BRESERVE_SLACK) {
+		result = ENOSPC;
+	}
+	else {
+		sfs->sfs_nreserved++;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
+
+/*
+ * Give back N reserved blocks.
+ */
+void
+sfs_bunreserve(struct sfs_fs *sfs, unsigned n)
+{
+	lock_acquire(sfs->sfs_freemaplock);
+	KASSERT(sfs->sfs_nreserved >= n);
+	sfs->sfs_nreserved -= n;
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	/*
+	 * Whatever is cached for the block need never be written now.
+	 * Do this while it's still marked in use; once it's free,
+	 * someone else may allocate it and cache new contents.
+	 */
+	buffer_forget(sfs->sfs_device, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree++;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -93,10 +324,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n",
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
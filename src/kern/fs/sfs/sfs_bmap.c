@@ -31,162 +31,534 @@
  * SFS filesystem
  *
  * Block mapping logic.
+ *
+ * A file's blocks are mapped by extents (see kern/sfs.h): in the
+ * inode while they fit, otherwise in extent blocks that the inode's
+ * entries point to. The same routines work on either array of
+ * extents, given the array, how many entries it has, and how many it
+ * can hold.
  */
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+////////////////////////////////////////////////////////////
+// Arrays of extents
+
 /*
- * Look up the disk block number (from 0 up to the number of blocks on
- * the disk) given a file and the logical block number within that
- * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * Return how many of the N extents in EXT start at or before
+ * FILEBLOCK. The one that might contain it is the one before that.
  */
-int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+static
+unsigned
+sfs_ext_find(const struct sfs_extent *ext, unsigned n, uint32_t fileblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	unsigned lo = 0, hi = n, mid;
 
-	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
-	int result;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ext[mid].ext_fileblock <= fileblock) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+/*
+ * Return the disk block holding FILEBLOCK according to EXT, or 0 if
+ * it's in a hole.
+ */
+static
+daddr_t
+sfs_ext_lookup(const struct sfs_extent *ext, unsigned n, uint32_t fileblock)
+{
+	const struct sfs_extent *e;
+	unsigned pos;
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	pos = sfs_ext_find(ext, n, fileblock);
+	if (pos == 0) {
+		return 0;
+	}
+	e = &ext[pos-1];
+	if (fileblock - e->ext_fileblock >= e->ext_len) {
+		return 0;
+	}
+	return e->ext_diskblock + (fileblock - e->ext_fileblock);
+}
 
-	/*
-	 * If the block we want is one of the direct blocks...
-	 */
-	if (fileblock < SFS_NDIRECT) {
-		/*
-		 * Get the block number
-		 */
-		block = sv->sv_i.sfi_direct[fileblock];
-
-		/*
-		 * Do we need to allocate?
-		 */
-		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
-			if (result) {
-				return result;
-			}
+/*
+ * Where FILEBLOCK, which is in a hole, should go on disk: where the
+ * extent before it would have put it. 0 if there's no extent before.
+ */
+static
+daddr_t
+sfs_ext_goal(const struct sfs_extent *ext, unsigned n, uint32_t fileblock)
+{
+	const struct sfs_extent *e;
+	unsigned pos;
 
-			/* Remember what we allocated; mark inode dirty */
-			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+	pos = sfs_ext_find(ext, n, fileblock);
+	if (pos == 0) {
+		return 0;
+	}
+	e = &ext[pos-1];
+	return e->ext_diskblock + (fileblock - e->ext_fileblock);
+}
+
+/*
+ * Record in EXT, which has *NP entries and room for MAX, that
+ * FILEBLOCK (in a hole) is now at DISKBLOCK. Grows the extent before
+ * or after it if it continues one of them, and joins them if it fills
+ * the gap between; otherwise adds an extent. Returns false if a new
+ * one was needed and there was no room.
+ */
+static
+bool
+sfs_ext_add(struct sfs_extent *ext, unsigned *np, unsigned max,
+	    uint32_t fileblock, daddr_t diskblock)
+{
+	struct sfs_extent *prev, *next;
+	unsigned n = *np;
+	unsigned pos;
+
+	pos = sfs_ext_find(ext, n, fileblock);
+	prev = (pos > 0) ? &ext[pos-1] : NULL;
+	next = (pos < n) ? &ext[pos] : NULL;
+
+	if (next != NULL && (next->ext_fileblock != fileblock + 1 ||
+			     next->ext_diskblock != diskblock + 1)) {
+		next = NULL;
+	}
+
+	if (prev != NULL &&
+	    prev->ext_fileblock + prev->ext_len == fileblock &&
+	    prev->ext_diskblock + prev->ext_len == diskblock) {
+		prev->ext_len++;
+		if (next != NULL) {
+			prev->ext_len += next->ext_len;
+			memmove(next, next + 1, (n - pos - 1) * sizeof(*next));
+			bzero(&ext[n-1], sizeof(ext[n-1]));
+			*np = n - 1;
 		}
+		return true;
+	}
+	if (next != NULL) {
+		next->ext_fileblock--;
+		next->ext_diskblock--;
+		next->ext_len++;
+		return true;
+	}
+
+	if (n == max) {
+		return false;
+	}
+	memmove(&ext[pos+1], &ext[pos], (n - pos) * sizeof(ext[pos]));
+	ext[pos].ext_fileblock = fileblock;
+	ext[pos].ext_diskblock = diskblock;
+	ext[pos].ext_len = 1;
+	*np = n + 1;
+	return true;
+}
 
-		/*
-		 * Hand back the block
-		 */
-		if (block != 0 && !sfs_bused(sfs, block)) {
-			panic("sfs: Data block %u (block %u of file %u) "
-			      "marked free\n", block, fileblock, sv->sv_ino);
+/*
+ * Free the blocks mapped by EXT (N entries) from file block BLOCKLEN
+ * on, dropping the extents that become empty. Those are all at the
+ * end, so this returns the number left. Sets *CHANGED if any extent
+ * was shortened or dropped, even if the count stays the same.
+ */
+static
+unsigned
+sfs_ext_trunc(struct sfs_fs *sfs, struct sfs_extent *ext, unsigned n,
+	      uint32_t blocklen, bool *changed)
+{
+	struct sfs_extent *e;
+	uint32_t from, j;
+	unsigned i, keep;
+
+	*changed = false;
+	keep = 0;
+	for (i=0; i<n; i++) {
+		e = &ext[i];
+		if (e->ext_fileblock >= blocklen) {
+			from = 0;
+		}
+		else if (blocklen - e->ext_fileblock < e->ext_len) {
+			from = blocklen - e->ext_fileblock;
+		}
+		else {
+			keep++;
+			continue;
+		}
+		for (j=from; j<e->ext_len; j++) {
+			sfs_bfree(sfs, e->ext_diskblock + j);
+		}
+		*changed = true;
+		if (from > 0) {
+			e->ext_len = from;
+			keep++;
+		}
+		else {
+			bzero(e, sizeof(*e));
 		}
-		*diskblock = block;
-		return 0;
 	}
+	return keep;
+}
 
-	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
+////////////////////////////////////////////////////////////
+// Extent blocks
 
-	fileblock -= SFS_NDIRECT;
+/*
+ * Get extent block BLOCK of SV from the buffer cache.
+ */
+static
+int
+sfs_extblock_read(struct sfs_vnode *sv, daddr_t block, struct buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extblock *eb;
+	int result;
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	result = buffer_read(sfs->sfs_device, block, ret);
+	if (result) {
+		return result;
+	}
+	eb = buffer_map(*ret);
+	if (eb->eb_magic != SFS_EXTMAGIC || eb->eb_nextents == 0 ||
+	    eb->eb_nextents > SFS_EXTPERBLOCK) {
+		panic("sfs: Extent block %u of file %u is corrupt\n",
+		      block, sv->sv_ino);
+	}
+	return 0;
+}
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+/*
+ * Allocate a new extent block for SV and fill it with the N extents
+ * in EXT.
+ */
+static
+int
+sfs_extblock_create(struct sfs_vnode *sv, const struct sfs_extent *ext,
+		    unsigned n, daddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_extblock *eb;
+	struct buf *b;
+	int result;
+
+	result = sfs_balloc(sfs, sv->sv_ino, false, ret);
+	if (result) {
+		return result;
+	}
+	result = buffer_get(sfs->sfs_device, *ret, &b);
+	if (result) {
+		sfs_bfree(sfs, *ret);
+		return result;
+	}
+	eb = buffer_map(b);
+	bzero(eb, sizeof(*eb));
+	eb->eb_magic = SFS_EXTMAGIC;
+	eb->eb_nextents = n;
+	memcpy(eb->eb_extents, ext, n * sizeof(*ext));
+	buffer_mark_dirty(b);
+	buffer_release(b);
+	return 0;
+}
+
+/*
+ * Which of the extent blocks of SV (which has some) maps FILEBLOCK.
+ */
+static
+unsigned
+sfs_extblock_which(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	unsigned pos;
+
+	pos = sfs_ext_find(sv->sv_i.sfi_extents, sv->sv_i.sfi_nextents,
+			   fileblock);
+	return (pos > 0) ? pos - 1 : 0;
+}
+
+/*
+ * The inode's extents are full: move them all into an extent block,
+ * making the tree one level deep.
+ */
+static
+int
+sfs_ext_pushdown(struct sfs_vnode *sv)
+{
+	struct sfs_dinode *sfi = &sv->sv_i;
+	daddr_t block;
+	int result;
+
+	KASSERT(sfi->sfi_depth == 0);
+	KASSERT(sfi->sfi_nextents == SFS_NIEXTENTS);
+	COMPILE_ASSERT(SFS_NIEXTENTS <= SFS_EXTPERBLOCK);
+
+	result = sfs_extblock_create(sv, sfi->sfi_extents, SFS_NIEXTENTS,
+				     &block);
+	if (result) {
+		return result;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	bzero(&sfi->sfi_extents[1],
+	      (SFS_NIEXTENTS - 1) * sizeof(sfi->sfi_extents[1]));
+	sfi->sfi_extents[0].ext_diskblock = block;
+	sfi->sfi_extents[0].ext_len = 0;
+	sfi->sfi_nextents = 1;
+	sfi->sfi_depth = 1;
+	sv->sv_dirty = true;
+	return 0;
+}
 
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
+/*
+ * Extent block WHICH of SV is full: move the upper half of it into a
+ * new one.
+ */
+static
+int
+sfs_ext_split(struct sfs_vnode *sv, unsigned which)
+{
+	struct sfs_dinode *sfi = &sv->sv_i;
+	struct sfs_extblock *eb;
+	struct sfs_extent *e;
+	struct buf *b;
+	const unsigned half = SFS_EXTPERBLOCK / 2;
+	daddr_t block;
+	int result;
+
+	if (sfi->sfi_nextents == SFS_NIEXTENTS) {
+		/* No room for another; the file is too fragmented */
+		return EFBIG;
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
+
+	result = sfs_extblock_read(sv, sfi->sfi_extents[which].ext_diskblock,
+				   &b);
+	if (result) {
+		return result;
+	}
+	eb = buffer_map(b);
+	KASSERT(eb->eb_nextents == SFS_EXTPERBLOCK);
+
+	result = sfs_extblock_create(sv, &eb->eb_extents[half],
+				     SFS_EXTPERBLOCK - half, &block);
+	if (result) {
+		buffer_release(b);
+		return result;
+	}
+
+	/* Make room in the inode for the new block, after the old one */
+	e = &sfi->sfi_extents[which + 1];
+	memmove(e + 1, e, (sfi->sfi_nextents - which - 1) * sizeof(*e));
+	e->ext_fileblock = eb->eb_extents[half].ext_fileblock;
+	e->ext_diskblock = block;
+	e->ext_len = 0;
+	sfi->sfi_nextents++;
+	sv->sv_dirty = true;
+
+	bzero(&eb->eb_extents[half],
+	      (SFS_EXTPERBLOCK - half) * sizeof(eb->eb_extents[half]));
+	eb->eb_nextents = half;
+	buffer_mark_dirty(b);
+	buffer_release(b);
+	return 0;
+}
+
+/*
+ * Record that FILEBLOCK of SV, which has extent blocks, is now at
+ * DISKBLOCK.
+ */
+static
+int
+sfs_extblock_add(struct sfs_vnode *sv, uint32_t fileblock, daddr_t diskblock)
+{
+	struct sfs_dinode *sfi = &sv->sv_i;
+	struct sfs_extblock *eb;
+	struct buf *b;
+	unsigned which, n;
+	int result;
+
+	while (1) {
+		which = sfs_extblock_which(sv, fileblock);
+		result = sfs_extblock_read(sv,
+				sfi->sfi_extents[which].ext_diskblock, &b);
 		if (result) {
 			return result;
 		}
+		eb = buffer_map(b);
+		n = eb->eb_nextents;
+		if (sfs_ext_add(eb->eb_extents, &n, SFS_EXTPERBLOCK,
+				fileblock, diskblock)) {
+			break;
+		}
+		buffer_release(b);
+
+		result = sfs_ext_split(sv, which);
+		if (result) {
+			return result;
+		}
+	}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+	eb->eb_nextents = n;
+	buffer_mark_dirty(b);
 
-		/* Mark the inode dirty */
+	/* The first block may now start lower */
+	if (sfi->sfi_extents[which].ext_fileblock !=
+	    eb->eb_extents[0].ext_fileblock) {
+		sfi->sfi_extents[which].ext_fileblock =
+			eb->eb_extents[0].ext_fileblock;
 		sv->sv_dirty = true;
+	}
+	buffer_release(b);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Mapping
+
+/*
+ * Find the disk block for FILEBLOCK of SV; 0 if it's in a hole, in
+ * which case *GOAL (if not NULL) is set to where to put it: right
+ * after the block before it in the file, so a file written in order
+ * gets one long extent, or near the inode for the first block.
+ */
+static
+int
+sfs_bmap_find(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *block,
+	      daddr_t *goal)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dinode *sfi = &sv->sv_i;
+	const struct sfs_extent *ext;
+	struct sfs_extblock *eb;
+	struct buf *b;
+	unsigned n;
+	int result;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+	b = NULL;
+	ext = sfi->sfi_extents;
+	n = sfi->sfi_nextents;
+	if (sfi->sfi_depth > SFS_EXTMAXDEPTH || n > SFS_NIEXTENTS ||
+	    (sfi->sfi_depth > 0 && n == 0)) {
+		panic("sfs: File %u has a corrupt extent map\n", sv->sv_ino);
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	if (sfi->sfi_depth > 0) {
+		result = sfs_extblock_read(sv,
+			ext[sfs_extblock_which(sv, fileblock)].ext_diskblock,
+			&b);
 		if (result) {
 			return result;
 		}
+		eb = buffer_map(b);
+		ext = eb->eb_extents;
+		n = eb->eb_nextents;
+	}
+
+	*block = sfs_ext_lookup(ext, n, fileblock);
+	if (*block == 0 && goal != NULL) {
+		*goal = sfs_ext_goal(ext, n, fileblock);
+		if (*goal == 0 || *goal >= sfs->sfs_sb.sb_nblocks) {
+			*goal = sv->sv_ino + 1;
+		}
+	}
+
+	if (b != NULL) {
+		buffer_release(b);
 	}
+	return 0;
+}
+
+/*
+ * Where a block for FILEBLOCK of SV, which is in a hole, should go.
+ */
+int
+sfs_bmap_goal(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *goal)
+{
+	daddr_t block;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	result = sfs_bmap_find(sv, fileblock, &block, goal);
+	if (result) {
+		return result;
+	}
+	KASSERT(block == 0);
+	return 0;
+}
+
+/*
+ * Record that FILEBLOCK of SV, which is in a hole, is now at
+ * DISKBLOCK.
+ */
+int
+sfs_bmap_record(struct sfs_vnode *sv, uint32_t fileblock, daddr_t diskblock)
+{
+	struct sfs_dinode *sfi = &sv->sv_i;
+	unsigned n;
+	int result;
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+	if (sfi->sfi_depth == 0) {
+		n = sfi->sfi_nextents;
+		if (sfs_ext_add(sfi->sfi_extents, &n, SFS_NIEXTENTS,
+				fileblock, diskblock)) {
+			sfi->sfi_nextents = n;
+			sv->sv_dirty = true;
+			return 0;
+		}
+		result = sfs_ext_pushdown(sv);
 		if (result) {
 			return result;
 		}
+	}
+	return sfs_extblock_add(sv, fileblock, diskblock);
+}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+/*
+ * Look up the disk block number (from 0 up to the number of blocks on
+ * the disk) given a file and the logical block number within that
+ * file. If no such block exists, ALLOCMODE (see sfsprivate.h) says
+ * whether to allocate one and whether it needs zeroing.
+ */
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int allocmode,
+	 daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t block, goal;
+	int result;
+	bool doalloc = (allocmode != SFS_BMAP_LOOKUP);
+	bool clear = (allocmode == SFS_BMAP_ALLOC);
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	goal = 0;
+	result = sfs_bmap_find(sv, fileblock, &block, &goal);
+	if (result) {
+		return result;
+	}
+
+	if (block == 0 && doalloc) {
+		result = sfs_balloc(sfs, goal, clear, &block);
 		if (result) {
 			return result;
 		}
+		result = sfs_bmap_record(sv, fileblock, block);
+		if (result) {
+			sfs_bfree(sfs, block);
+			return result;
+		}
 	}
 
-	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: Data block %u (block %u of file %u) marked free\n",
 		      block, fileblock, sv->sv_ino);
@@ -196,106 +568,111 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim, with the vnode locked.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dinode *sfi = &sv->sv_i;
+	struct sfs_extblock *eb;
+	struct sfs_extent *e;
+	struct buf *b;
+	daddr_t block;
+	unsigned i, n;
+	bool changed;
+	int result;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
-	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	vfs_biglock_acquire();
+	/* Data past the end that hasn't got disk blocks yet just goes */
+	sfs_dtrunc(sv, blocklen);
 
-	/*
-	 * Go through the direct blocks. Discard any that are
-	 * past the limit we're truncating to.
-	 */
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
-		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
-			sv->sv_i.sfi_direct[i] = 0;
+	if (sfi->sfi_depth == 0) {
+		n = sfs_ext_trunc(sfs, sfi->sfi_extents, sfi->sfi_nextents,
+				  blocklen, &changed);
+		if (changed) {
+			sfi->sfi_nextents = n;
 			sv->sv_dirty = true;
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+	/*
+	 * Go through the extent blocks from the last one down,
+	 * trimming each and freeing the ones that empty. Once one
+	 * keeps something, the ones before it are all below the new
+	 * size.
+	 */
+	for (i = sfi->sfi_depth > 0 ? sfi->sfi_nextents : 0; i > 0; i--) {
+		e = &sfi->sfi_extents[i-1];
+		result = sfs_extblock_read(sv, e->ext_diskblock, &b);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
+		eb = buffer_map(b);
+		n = sfs_ext_trunc(sfs, eb->eb_extents, eb->eb_nextents,
+				  blocklen, &changed);
+		if (n > 0) {
+			if (changed) {
+				/* the freed blocks must not stay mapped */
+				eb->eb_nextents = n;
+				buffer_mark_dirty(b);
 			}
+			buffer_release(b);
+			break;
 		}
+		buffer_release(b);
+		sfs_bfree(sfs, e->ext_diskblock);
+		bzero(e, sizeof(*e));
+		sfi->sfi_nextents = i - 1;
+		sv->sv_dirty = true;
+	}
 
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+	if (sfi->sfi_depth > 0 && sfi->sfi_nextents == 0) {
+		sfi->sfi_depth = 0;
+		sv->sv_dirty = true;
+	}
+
+	/* If what's left fits in the inode again, put it back there */
+	if (sfi->sfi_depth > 0 && sfi->sfi_nextents == 1) {
+		block = sfi->sfi_extents[0].ext_diskblock;
+		result = sfs_extblock_read(sv, block, &b);
+		if (result) {
+			return result;
+		}
+		eb = buffer_map(b);
+		n = eb->eb_nextents;
+		if (n <= SFS_NIEXTENTS) {
+			memcpy(sfi->sfi_extents, eb->eb_extents,
+			       n * sizeof(eb->eb_extents[0]));
+			sfi->sfi_nextents = n;
+			sfi->sfi_depth = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
+		buffer_release(b);
+		if (sfi->sfi_depth == 0) {
+			sfs_bfree(sfs, block);
+		}
+	}
+
+	/* An emptied directory's name index goes with it */
+	if (len == 0) {
+		for (i=0; i<SFS_NDIRINDEX; i++) {
+			if (sfi->sfi_dirindex[i] != 0) {
+				sfs_bfree(sfs, sfi->sfi_dirindex[i]);
+				sfi->sfi_dirindex[i] = 0;
 			}
 		}
 	}
 
 	/* Set the file size */
-	sv->sv_i.sfi_size = len;
+	sfi->sfi_size = len;
 
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
@@ -31,14 +31,25 @@
  * SFS filesystem
  *
  * Directory I/O
+ *
+ * Directories with more than a few blocks of entries get a name index
+ * (see <kern/sfs.h>), a byte per slot saying whether it's free and
+ * if not a hash of its name. With it, finding a name reads the index
+ * blocks and the one or two slots whose hash matches, instead of
+ * every slot in the directory. Small directories don't bother.
  */
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Directories with this many slots or more get an index. */
+#define SFS_DIRINDEX_MIN  64
+
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
@@ -94,6 +105,205 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * Check if the directory has an index covering its first NSLOTS
+ * slots.
+ */
+static
+bool
+sfs_dirindex_covers(struct sfs_vnode *sv, int nslots)
+{
+	int i;
+
+	if (sv->sv_i.sfi_dirindex[0] == 0) {
+		return false;
+	}
+	for (i=0; i * SFS_BLOCKSIZE < nslots; i++) {
+		KASSERT(i < SFS_NDIRINDEX);
+		if (sv->sv_i.sfi_dirindex[i] == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Set the index byte for slot SLOT, in the index whose blocks are
+ * BLOCKS.
+ */
+static
+int
+sfs_dirindex_setin(struct sfs_fs *sfs, const daddr_t *blocks, int slot,
+		   uint8_t tag)
+{
+	struct buf *b;
+	uint8_t *tags;
+	int result;
+
+	result = buffer_read(sfs->sfs_device, blocks[slot / SFS_BLOCKSIZE], &b);
+	if (result) {
+		return result;
+	}
+	tags = buffer_map(b);
+	if (tags[slot % SFS_BLOCKSIZE] != tag) {
+		tags[slot % SFS_BLOCKSIZE] = tag;
+		buffer_mark_dirty(b);
+	}
+	buffer_release(b);
+	return 0;
+}
+
+/*
+ * Set the index byte for slot SLOT. The index must cover it.
+ */
+static
+int
+sfs_dirindex_set(struct sfs_vnode *sv, int slot, uint8_t tag)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	return sfs_dirindex_setin(sfs, sv->sv_i.sfi_dirindex, slot, tag);
+}
+
+/*
+ * Give the directory an index covering its first NSLOTS slots:
+ * allocate whatever index blocks are missing and, if it had no index
+ * at all or only part of one, fill it in from the slots. Slots past
+ * the end of the directory are marked free.
+ *
+ * Lookups trust any index that covers the directory, so the new
+ * blocks only go into the inode once they're completely filled in;
+ * if anything fails they're freed again and the inode is untouched.
+ */
+static
+int
+sfs_dirindex_build(struct sfs_vnode *sv, int nslots)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry tsd;
+	daddr_t blocks[SFS_NDIRINDEX];
+	bool fill = false;
+	int nentries, nblocks, i, result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	nentries = sfs_dir_nentries(sv);
+	if (!sfs_dirindex_covers(sv, nentries)) {
+		fill = true;
+	}
+
+	/* A zeroed block says every slot is free */
+	nblocks = 0;
+	for (i=0; i * SFS_BLOCKSIZE < nslots; i++) {
+		KASSERT(i < SFS_NDIRINDEX);
+		blocks[i] = sv->sv_i.sfi_dirindex[i];
+		if (blocks[i] == 0) {
+			result = sfs_balloc(sfs, sv->sv_ino, true, &blocks[i]);
+			if (result) {
+				goto fail;
+			}
+		}
+		nblocks++;
+	}
+
+	if (fill) {
+		for (i=0; i<nentries; i++) {
+			result = sfs_readdir(sv, i, &tsd);
+			if (result) {
+				goto fail;
+			}
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = sfs_dirindex_setin(sfs, blocks, i,
+					tsd.sfd_ino == SFS_NOINO ? 0 :
+					sfs_dirtag(tsd.sfd_name));
+			if (result) {
+				goto fail;
+			}
+		}
+	}
+
+	for (i=0; i<nblocks; i++) {
+		if (sv->sv_i.sfi_dirindex[i] != blocks[i]) {
+			sv->sv_i.sfi_dirindex[i] = blocks[i];
+			sv->sv_dirty = true;
+		}
+	}
+	return 0;
+
+ fail:
+	for (i=0; i<nblocks; i++) {
+		if (sv->sv_i.sfi_dirindex[i] != blocks[i]) {
+			sfs_bfree(sfs, blocks[i]);
+		}
+	}
+	return result;
+}
+
+/*
+ * sfs_dir_findname for an indexed directory: read only the slots
+ * whose index byte matches NAME's.
+ */
+static
+int
+sfs_dir_findindexed(struct sfs_vnode *sv, const char *name,
+		    uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry tsd;
+	struct buf *b;
+	const uint8_t *tags;
+	uint8_t tag = sfs_dirtag(name);
+	int found, nentries, base, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	found = 0;
+	for (base=0; base<nentries; base += SFS_BLOCKSIZE) {
+		result = buffer_read(sfs->sfs_device,
+				     sv->sv_i.sfi_dirindex[base/SFS_BLOCKSIZE],
+				     &b);
+		if (result) {
+			return result;
+		}
+		tags = buffer_map(b);
+
+		for (i=base; i<nentries && i<base+SFS_BLOCKSIZE; i++) {
+			if (tags[i-base] == 0) {
+				if (emptyslot != NULL) {
+					*emptyslot = i;
+				}
+				continue;
+			}
+			if (tags[i-base] != tag || found) {
+				continue;
+			}
+			result = sfs_readdir(sv, i, &tsd);
+			if (result) {
+				buffer_release(b);
+				return result;
+			}
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			if (tsd.sfd_ino != SFS_NOINO &&
+			    !strcmp(tsd.sfd_name, name)) {
+				found = 1;
+				if (slot != NULL) {
+					*slot = i;
+				}
+				if (ino != NULL) {
+					*ino = tsd.sfd_ino;
+				}
+			}
+		}
+		buffer_release(b);
+
+		if (found && emptyslot == NULL) {
+			break;
+		}
+	}
+
+	return found ? 0 : ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -108,6 +318,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 
 	nentries = sfs_dir_nentries(sv);
 
+	if (sfs_dirindex_covers(sv, nentries)) {
+		return sfs_dir_findindexed(sv, name, ino, slot, emptyslot);
+	}
+
 	/* For each slot... */
 	found = 0;
 	for (i=0; i<nentries; i++) {
@@ -153,7 +367,8 @@ int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 {
 	int emptyslot = -1;
-	int result;
+	int nentries, result;
+	bool indexed = false;
 	struct sfs_direntry sd;
 
 	/* Look up the name. We want to make sure it *doesn't* exist. */
@@ -170,8 +385,28 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* If we didn't get an empty slot, add the entry at the end. */
+	nentries = sfs_dir_nentries(sv);
 	if (emptyslot < 0) {
-		emptyslot = sfs_dir_nentries(sv);
+		if (nentries >= SFS_DIRMAXSLOTS) {
+			/* The index can't cover any more */
+			return ENOSPC;
+		}
+		emptyslot = nentries;
+		nentries++;
+	}
+
+	/*
+	 * Make sure the index covers the slot, creating it if the
+	 * directory has gotten big enough.
+	 */
+	if (sv->sv_i.sfi_dirindex[0] != 0 || nentries >= SFS_DIRINDEX_MIN) {
+		if (!sfs_dirindex_covers(sv, nentries)) {
+			result = sfs_dirindex_build(sv, nentries);
+			if (result) {
+				return result;
+			}
+		}
+		indexed = true;
 	}
 
 	/* Set up the entry. */
@@ -184,8 +419,30 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		*slot = emptyslot;
 	}
 
+	/*
+	 * Mark the slot in the index before writing the entry. If the
+	 * entry then can't be written, an index byte on a free slot
+	 * only costs a wasted read at lookup and keeps the slot from
+	 * being reused; the other way around, a live entry marked free
+	 * would be lost and its slot overwritten.
+	 */
+	if (indexed) {
+		result = sfs_dirindex_set(sv, emptyslot, sfs_dirtag(name));
+		if (result) {
+			return result;
+		}
+	}
+
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		if (indexed) {
+			/* Give the slot back if we can; it's free anyway */
+			(void)sfs_dirindex_set(sv, emptyslot, 0);
+		}
+		return result;
+	}
+	return 0;
 }
 
 /*
@@ -195,13 +452,23 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+
+	/* Keep the index, if any, up to date */
+	if (sfs_dirindex_covers(sv, slot + 1)) {
+		return sfs_dirindex_set(sv, slot, 0);
+	}
+	return 0;
 }
 
 /*
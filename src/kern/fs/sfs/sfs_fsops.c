@@ -36,11 +36,13 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -114,11 +116,11 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs;
-	unsigned i, num;
+	struct vnode **vns;
+	struct sfs_vnode *sv;
+	unsigned i, n, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -151,18 +153,54 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	/*
+	 * Put the inodes of all the loaded vnodes into the buffer
+	 * cache, along with any of their data that was waiting in
+	 * memory for disk blocks to be allocated; the blocks themselves
+	 * go to disk all at once below.
+	 * Vnode locks come before sfs_vnlock, so take references to
+	 * the vnodes under sfs_vnlock and lock them one at a time
+	 * afterwards. Vnodes being reclaimed are skipped; sfs_reclaim
+	 * syncs them itself.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	num = sfs->sfs_nvnodes;
+	vns = kmalloc((num ? num : 1) * sizeof(*vns));
+	if (vns == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	n = 0;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			if (sv->sv_dying) {
+				continue;
+			}
+			KASSERT(n < num);
+			vns[n] = &sv->sv_absvn;
+			VOP_INCREF(vns[n]);
+			n++;
+		}
+	}
+	lock_release(sfs->sfs_vnlock);
+
+	for (i=0; i<n; i++) {
+		sv = vns[i]->vn_data;
+
+		lock_acquire(sv->sv_lock);
+		sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		VOP_DECREF(vns[i]);
 	}
+	kfree(vns);
+
+	lock_acquire(sfs->sfs_freemaplock);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
@@ -173,14 +211,16 @@ sfs_sync(struct fs *fs)
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
-	return 0;
+	lock_release(sfs->sfs_freemaplock);
+
+	/* Now write out everything that's dirty in the buffer cache. */
+	return buffer_sync(sfs->sfs_device);
 }
 
 /*
@@ -193,13 +233,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The volume name doesn't change while mounted */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -212,8 +248,15 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
-	KASSERT(sfs->sfs_device == NULL);
+	KASSERT(sfs->sfs_nvnodes == 0);
+	kfree(sfs->sfs_vnhash);
+	cv_destroy(sfs->sfs_vncv);
+	lock_destroy(sfs->sfs_vnlock);
+	lock_destroy(sfs->sfs_freemaplock);
+	if (sfs->sfs_device != NULL) {
+		/* Failed mount; we only read, so the buffers are clean */
+		buffer_drop(sfs->sfs_device);
+	}
 	kfree(sfs);
 }
 
@@ -227,19 +270,34 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
-
-	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	/*
+	 * Do we have any files open? If so, can't unmount. If not,
+	 * nobody can open any, since getting at the root goes through
+	 * the VFS layer, which holds vfs_biglock while unmounting.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/*
+	 * Nothing of ours may stay in the buffer cache. Reclaiming the
+	 * last vnodes may have dirtied blocks since the sync.
+	 */
+	result = buffer_sync(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+	buffer_drop(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -247,7 +305,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -271,6 +328,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -278,6 +336,7 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	COMPILE_ASSERT(sizeof(struct sfs_extblock)==SFS_BLOCKSIZE);
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
@@ -301,17 +360,45 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	sfs->sfs_vnhashsize = SFS_VNHASH_MINSIZE;
+	sfs->sfs_vnhash = kmalloc(sfs->sfs_vnhashsize *
+				  sizeof(*sfs->sfs_vnhash));
+	if (sfs->sfs_vnhash == NULL) {
 		goto cleanup_object;
 	}
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_nvnodes = 0;
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_nfree = 0;
+	sfs->sfs_nreserved = 0;
+
+	/* locks */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_vnodes;
+	}
+	sfs->sfs_vncv = cv_create("sfs_vncv");
+	if (sfs->sfs_vncv == NULL) {
+		goto cleanup_vnlock;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vncv;
+	}
 
 	return sfs;
 
+cleanup_vncv:
+	cv_destroy(sfs->sfs_vncv);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
+cleanup_vnodes:
+	kfree(sfs->sfs_vnhash);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -337,8 +424,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
-
-	vfs_biglock_acquire();
+	uint32_t i;
 
 	/* We don't pass any options through mount */
 	(void)options;
@@ -352,7 +438,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -360,7 +445,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -372,7 +456,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			       sizeof(sfs->sfs_sb));
 	if (result) {
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -384,7 +467,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			sfs->sfs_sb.sb_magic,
 			SFS_MAGIC);
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -396,24 +478,26 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
-	/* Load free block bitmap */
+	/* Load free block bitmap, and count the free blocks */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
+	for (i=0; i<SFS_FS_NBLOCKS(sfs); i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,13 +35,116 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Table of loaded vnodes. Chained hash on the inode number; the
+ * table doubles when it averages more than two vnodes per chain, so
+ * finding, adding, and removing a vnode take constant time however
+ * many files are open. Called with sfs_vnlock held.
+ */
+static
+unsigned
+sfs_vnhash_chain(struct sfs_fs *sfs, uint32_t ino)
+{
+	/* sfs_vnhashsize is a power of two */
+	return ino & (sfs->sfs_vnhashsize - 1);
+}
+
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	sv = sfs->sfs_vnhash[sfs_vnhash_chain(sfs, ino)];
+	while (sv != NULL && sv->sv_ino != ino) {
+		sv = sv->sv_hashnext;
+	}
+	return sv;
+}
+
+static
+void
+sfs_vnhash_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **oldhash, *sv;
+	unsigned oldsize, i, ix;
+
+	oldhash = sfs->sfs_vnhash;
+	oldsize = sfs->sfs_vnhashsize;
+
+	sfs->sfs_vnhash = kmalloc(2 * oldsize * sizeof(*sfs->sfs_vnhash));
+	if (sfs->sfs_vnhash == NULL) {
+		/* Not fatal; the chains just get longer */
+		sfs->sfs_vnhash = oldhash;
+		return;
+	}
+	sfs->sfs_vnhashsize = 2 * oldsize;
+	for (i=0; i<sfs->sfs_vnhashsize; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+
+	for (i=0; i<oldsize; i++) {
+		while ((sv = oldhash[i]) != NULL) {
+			oldhash[i] = sv->sv_hashnext;
+			ix = sfs_vnhash_chain(sfs, sv->sv_ino);
+			sv->sv_hashnext = sfs->sfs_vnhash[ix];
+			sfs->sfs_vnhash[ix] = sv;
+		}
+	}
+	kfree(oldhash);
+}
+
+static
+void
+sfs_vnhash_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned ix;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	if (sfs->sfs_nvnodes >= 2 * sfs->sfs_vnhashsize) {
+		sfs_vnhash_grow(sfs);
+	}
+	ix = sfs_vnhash_chain(sfs, sv->sv_ino);
+	sv->sv_hashnext = sfs->sfs_vnhash[ix];
+	sfs->sfs_vnhash[ix] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	pp = &sfs->sfs_vnhash[sfs_vnhash_chain(sfs, sv->sv_ino)];
+	while (*pp != NULL && *pp != sv) {
+		pp = &(*pp)->sv_hashnext;
+	}
+	if (*pp == NULL) {
+		panic("sfs: reclaim vnode %u not in vnode pool\n",
+		      sv->sv_ino);
+	}
+	*pp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+	KASSERT(sfs->sfs_nvnodes > 0);
+	sfs->sfs_nvnodes--;
+}
+
+/*
+ * Write an on-disk inode structure back out to disk, after giving
+ * any file data still waiting in memory its disk blocks, which adds
+ * them to the inode. The vnode must be locked.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +152,13 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	result = sfs_dflush(sv);
+	if (result) {
+		return result;
+	}
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -64,21 +174,28 @@ sfs_sync_inode(struct sfs_vnode *sv)
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
  * This function should try to avoid returning errors other than EBUSY.
+ *
+ * Only the refcount check and taking the vnode out of the table need
+ * sfs_vnlock. In between, the vnode is marked dying and the truncate
+ * and sync run under sv_lock alone, so loading other files isn't held
+ * up by this one's I/O; sfs_doloadvnode waits for a dying vnode to be
+ * gone rather than handing it out or reading a stale inode.
  */
 int
 sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. sfs_loadvnode only hands
+	 * out references while holding sfs_vnlock, and not to dying
+	 * vnodes, so once it's marked the count can't go up again.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,25 +205,26 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
+	sv->sv_dying = true;
+	lock_release(sfs->sfs_vnlock);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
-			return result;
+			goto fail;
 		}
 	}
 
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
-		return result;
+		goto fail;
 	}
 
 	/* If there are no on-disk references, discard the inode */
@@ -115,71 +233,67 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnhash_remove(sfs, sv);
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
 
-	vnode_cleanup(&sv->sv_absvn);
+	/* Nobody can find it now */
+	lock_release(sv->sv_lock);
+	lock_destroy(sv->sv_lock);
 
-	vfs_biglock_release();
+	vnode_cleanup(&sv->sv_absvn);
 
 	/* Release the storage for the vnode structure itself. */
+	KASSERT(sv->sv_dblocks == NULL);
 	kfree(sv);
 
 	/* Done */
 	return 0;
+
+ fail:
+	/* Leave it loaded, as before, and let waiters have it */
+	lock_acquire(sfs->sfs_vnlock);
+	sv->sv_dying = false;
+	cv_broadcast(sfs->sfs_vncv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
+	lock_release(sv->sv_lock);
+	return result;
 }
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Called with sfs_vnlock held, which is
+ * dropped while waiting for a vnode being reclaimed to go away.
  */
+static
 int
-sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+sfs_doloadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
+	sv = sfs_vnhash_find(sfs, ino);
+	while (sv != NULL && sv->sv_dying) {
+		cv_wait(sfs->sfs_vncv, sfs->sfs_vnlock);
+		sv = sfs_vnhash_find(sfs, ino);
+	}
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
-
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
@@ -188,6 +302,11 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (sv==NULL) {
 		return ENOMEM;
 	}
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		return ENOMEM;
+	}
 
 	/* Must be in an allocated block */
 	if (!sfs_bused(sfs, ino)) {
@@ -198,6 +317,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
@@ -235,26 +355,37 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_dying = false;
+	sv->sv_dblocks = NULL;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnhash_add(sfs, sv);
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
 }
 
+int
+sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
+		 struct sfs_vnode **ret)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_vnlock);
+	result = sfs_doloadvnode(sfs, ino, forcetype, ret);
+	lock_release(sfs->sfs_vnlock);
+
+	return result;
+}
+
 /*
  * Create a new filesystem object and hand back its vnode.
  */
@@ -269,7 +400,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, true, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,8 +427,6 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
@@ -308,7 +437,5 @@ sfs_getroot(struct fs *fs)
 		      sv->sv_i.sfi_type);
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_absvn;
 }
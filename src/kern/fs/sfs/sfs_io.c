@@ -35,17 +35,28 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Read-ahead window, in blocks: where it starts, and how far it grows. */
+#define SFS_RAMIN 4
+#define SFS_RAMAX 32
+
 ////////////////////////////////////////////////////////////
 //
 // Basic block-level I/O routines
 
 /*
+ * All block I/O goes through the buffer cache. These copy a whole
+ * block in or out of it, for callers that keep their own copy (the
+ * superblock, the freemap, in-memory inodes). Everything else uses
+ * the buffers directly.
+ *
  * Note: sfs_readblock is used to read the superblock
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
@@ -53,79 +64,223 @@
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Read a block.
  */
-static
 int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
+	struct buf *b;
 	int result;
-	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(len == SFS_BLOCKSIZE);
 
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	result = buffer_read(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buffer_map(b), len);
+	buffer_release(b);
+	return 0;
+}
 
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: DEVOP_IO returned EINVAL\n");
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: block %llu I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
+/*
+ * Write a block. It goes to disk when the cache writes it back.
+ */
+int
+sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	result = buffer_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(buffer_map(b), data, len);
+	buffer_mark_dirty(b);
+	buffer_release(b);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Delayed allocation
+
+/*
+ * A write into a hole doesn't get a disk block right away. The data
+ * waits in memory on the vnode's sv_dblocks list, with a block
+ * reserved for it (sfs_breserve) so it can't run out of space later,
+ * and disk blocks are only allocated when the file is flushed: by
+ * sfs_sync_inode, that is on fsync, every few seconds from the
+ * syncer's sync, and when the vnode is reclaimed; or when too much
+ * data is waiting. By then a file's new blocks are mostly known all
+ * together, so each run of them gets consecutive disk blocks, however
+ * writes to different files were interleaved; and since the data is
+ * there to fill them, the blocks never need zeroing on disk.
+ *
+ * If a block can't be reserved, the write allocates one right away.
+ */
+
+/*
+ * One block of file data waiting for a disk block.
+ */
+struct sfs_dblock {
+	uint32_t db_fileblock;		/* which block of the file */
+	struct sfs_dblock *db_next;	/* sv_dblocks is by db_fileblock */
+	char db_data[SFS_BLOCKSIZE];
+};
+
+/*
+ * FILEBLOCK of SV has no disk block. Find the data waiting for one,
+ * or, if WRITING, make a new block of zeros to write into. *RET is
+ * NULL if there's no such data, or if this write can't wait (too
+ * much is waiting already, or the volume is nearly full) and the
+ * caller should allocate a disk block now.
+ */
+static
+int
+sfs_dget(struct sfs_vnode *sv, uint32_t fileblock, bool writing,
+	 struct sfs_dblock **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dblock *db, **pp;
+	int result;
+
+	for (db = sv->sv_dblocks; db != NULL; db = db->db_next) {
+		if (db->db_fileblock >= fileblock) {
+			break;
 		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
+	}
+	if (db != NULL && db->db_fileblock == fileblock) {
+		*ret = db;
+		return 0;
+	}
+	*ret = NULL;
+	if (!writing) {
+		return 0;
+	}
+
+	result = sfs_breserve(sfs);
+	if (result == EAGAIN && sv->sv_dblocks != NULL) {
+		/* Make room by flushing what this file has waiting */
+		result = sfs_dflush(sv);
+		if (result) {
+			return result;
 		}
-		else {
-			kprintf("sfs: block %llu I/O error, giving up after "
-				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+		result = sfs_breserve(sfs);
+	}
+	if (result) {
+		/* sfs_balloc will say if the volume's really full */
+		return 0;
+	}
+
+	db = kmalloc(sizeof(*db));
+	if (db == NULL) {
+		sfs_bunreserve(sfs, 1);
+		return 0;
+	}
+	db->db_fileblock = fileblock;
+	bzero(db->db_data, SFS_BLOCKSIZE);
+
+	for (pp = &sv->sv_dblocks; *pp != NULL; pp = &(*pp)->db_next) {
+		if ((*pp)->db_fileblock > fileblock) {
+			break;
 		}
 	}
-	return result;
+	db->db_next = *pp;
+	*pp = db;
+	*ret = db;
+	return 0;
 }
 
 /*
- * Read a block.
+ * Give all of SV's waiting data disk blocks, and put it in the buffer
+ * cache to be written back from there. Each run of consecutive file
+ * blocks gets consecutive disk blocks, if there are enough free ones
+ * where the file continues on disk.
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_dflush(struct sfs_vnode *sv)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dblock *db;
+	struct buf *b;
+	daddr_t goal, diskblock;
+	unsigned want, got, i;
+	int result;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	while (sv->sv_dblocks != NULL) {
+		/* How long is the run at the front? */
+		want = 1;
+		db = sv->sv_dblocks;
+		while (db->db_next != NULL &&
+		       db->db_next->db_fileblock == db->db_fileblock + 1) {
+			db = db->db_next;
+			want++;
+		}
+
+		db = sv->sv_dblocks;
+		result = sfs_bmap_goal(sv, db->db_fileblock, &goal);
+		if (result) {
+			return result;
+		}
+		result = sfs_ballocrun(sfs, goal, want, &diskblock, &got);
+		if (result) {
+			return result;
+		}
+
+		for (i=0; i<got; i++) {
+			db = sv->sv_dblocks;
+			result = buffer_get(sfs->sfs_device, diskblock + i, &b);
+			if (result == 0) {
+				memcpy(buffer_map(b), db->db_data,
+				       SFS_BLOCKSIZE);
+				buffer_mark_dirty(b);
+				buffer_release(b);
+				result = sfs_bmap_record(sv, db->db_fileblock,
+							 diskblock + i);
+			}
+			if (result) {
+				/* This and the rest keep waiting */
+				sfs_bfreerun(sfs, diskblock + i, got - i);
+				return result;
+			}
+			sv->sv_dblocks = db->db_next;
+			kfree(db);
+		}
+	}
+	return 0;
 }
 
 /*
- * Write a block.
+ * Throw away SV's waiting data from file block BLOCKLEN on.
  */
-int
-sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+void
+sfs_dtrunc(struct sfs_vnode *sv, uint32_t blocklen)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dblock *db, **pp;
+	unsigned n = 0;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	pp = &sv->sv_dblocks;
+	while (*pp != NULL && (*pp)->db_fileblock < blocklen) {
+		pp = &(*pp)->db_next;
+	}
+	while (*pp != NULL) {
+		db = *pp;
+		*pp = db->db_next;
+		kfree(db);
+		n++;
+	}
+	if (n > 0) {
+		sfs_bunreserve(sfs, n);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -147,74 +302,70 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dblock *db;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 
-	/* Allocate missing blocks if and only if we're writing */
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, SFS_BMAP_LOOKUP, &diskblock);
 	if (result) {
 		return result;
 	}
 
 	if (diskblock == 0) {
-		/*
-		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
-		 */
-		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		/* The data may be waiting in memory, or go there now */
+		result = sfs_dget(sv, fileblock, uio->uio_rw == UIO_WRITE,
+				  &db);
+		if (result) {
+			return result;
+		}
+		if (db != NULL) {
+			return uiomove(db->db_data + skipstart, len, uio);
+		}
 	}
-	else {
+
+	if (diskblock == 0 && uio->uio_rw == UIO_WRITE) {
 		/*
-		 * Read the block.
+		 * Allocate it now instead. The rest of a new block
+		 * must read as zeros.
 		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
+		result = sfs_bmap(sv, fileblock, SFS_BMAP_ALLOC, &diskblock);
 		if (result) {
 			return result;
 		}
 	}
 
+	if (diskblock == 0) {
+		/*
+		 * There was no block mapped at this point in the file.
+		 * Read zeros.
+		 */
+		KASSERT(uio->uio_rw == UIO_READ);
+		return uiomovezeros(len, uio);
+	}
+
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the cache, and perform the requested
+	 * operation into/out of it.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
-
-	/*
-	 * If it was a write, write back the modified block.
-	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+	result = uiomove((char *)buffer_map(b) + skipstart, len, uio);
+	if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		buffer_mark_dirty(b);
 	}
-
-	return 0;
+	buffer_release(b);
+	return result;
 }
 
 /*
@@ -225,24 +376,47 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dblock *db;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+	bool fresh = false;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, SFS_BMAP_LOOKUP, &diskblock);
 	if (result) {
 		return result;
 	}
 
+	if (diskblock == 0) {
+		/* The data may be waiting in memory, or go there now */
+		result = sfs_dget(sv, fileblock, uio->uio_rw == UIO_WRITE,
+				  &db);
+		if (result) {
+			return result;
+		}
+		if (db != NULL) {
+			KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
+			return uiomove(db->db_data, SFS_BLOCKSIZE, uio);
+		}
+	}
+
+	if (diskblock == 0 && uio->uio_rw == UIO_WRITE) {
+		/*
+		 * Allocate it now instead. We're about to write all of
+		 * it, so don't bother having it zeroed.
+		 */
+		result = sfs_bmap(sv, fileblock, SFS_BMAP_FILL, &diskblock);
+		if (result) {
+			return result;
+		}
+		fresh = true;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * No block - fill with zeros.
@@ -255,31 +429,94 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * A whole-block write replaces the old contents, so there's no
+	 * need to read them in first.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	if (uio->uio_rw == UIO_READ) {
+		result = buffer_read(sfs->sfs_device, diskblock, &b);
+	}
+	else {
+		result = buffer_get(sfs->sfs_device, diskblock, &b);
+	}
+	if (result) {
+		return result;
+	}
 
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	result = uiomove(buffer_map(b), SFS_BLOCKSIZE, uio);
+	if (result && fresh) {
+		/*
+		 * The copy failed, and the new block was never zeroed;
+		 * don't let whatever was on the disk there show.
+		 */
+		bzero(buffer_map(b), SFS_BLOCKSIZE);
+		buffer_mark_dirty(b);
+	}
+	else if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		buffer_mark_dirty(b);
+	}
+	buffer_release(b);
+	return result;
+}
 
-	result = sfs_rwblock(sfs, uio);
+/*
+ * Read-ahead. A read that starts where the last one through the same
+ * open file left off is sequential; each one doubles the window, up
+ * to SFS_RAMAX blocks, and any other read shuts it off again.
+ */
+static
+void
+sfs_rawindow(struct readahead *ra, off_t pos)
+{
+	if (pos != ra->ra_next) {
+		ra->ra_window = 0;
+		ra->ra_ahead = 0;
+	}
+	else if (ra->ra_window == 0) {
+		ra->ra_window = SFS_RAMIN;
+	}
+	else if (ra->ra_window < SFS_RAMAX) {
+		ra->ra_window *= 2;
+	}
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Reading FILEBLOCK: make sure the blocks of the window after it have
+ * been sent to the buffer cache to prefetch.
+ */
+static
+void
+sfs_prefetch(struct sfs_vnode *sv, struct readahead *ra, uint32_t fileblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t first, end, fileblocks;
+	daddr_t diskblock;
 
-	return result;
+	if (ra->ra_window == 0) {
+		return;
+	}
+
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	first = fileblock + 1;
+	if (ra->ra_ahead > first) {
+		first = ra->ra_ahead;
+	}
+	end = fileblock + 1 + ra->ra_window;
+	if (end > fileblocks) {
+		end = fileblocks;
+	}
+
+	for (; first < end; first++) {
+		if (sfs_bmap(sv, first, SFS_BMAP_LOOKUP, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			buffer_prefetch(sfs->sfs_device, diskblock);
+		}
+	}
+	if (first > ra->ra_ahead) {
+		ra->ra_ahead = first;
+	}
 }
 
 /*
@@ -292,6 +529,9 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	struct readahead *ra = NULL;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	origresid = uio->uio_resid;
 
@@ -314,6 +554,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			KASSERT(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		ra = uio->uio_ra;
+		if (ra != NULL) {
+			sfs_rawindow(ra, uio->uio_offset);
+		}
 	}
 
 	/*
@@ -333,6 +578,9 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 
 		/* Call sfs_partialio() to do it. */
+		if (ra != NULL) {
+			sfs_prefetch(sv, ra, uio->uio_offset / SFS_BLOCKSIZE);
+		}
 		result = sfs_partialio(sv, uio, skip, len);
 		if (result) {
 			goto out;
@@ -350,6 +598,9 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
 	for (i=0; i<nblocks; i++) {
+		if (ra != NULL) {
+			sfs_prefetch(sv, ra, uio->uio_offset / SFS_BLOCKSIZE);
+		}
 		result = sfs_blockio(sv, uio);
 		if (result) {
 			goto out;
@@ -362,6 +613,9 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
 
 	if (uio->uio_resid > 0) {
+		if (ra != NULL) {
+			sfs_prefetch(sv, ra, uio->uio_offset / SFS_BLOCKSIZE);
+		}
 		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
 		if (result) {
 			goto out;
@@ -378,6 +632,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* The next read is sequential if it picks up from here */
+	if (ra != NULL) {
+		ra->ra_next = uio->uio_offset;
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -404,38 +663,29 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
 	daddr_t diskblock;
-	bool doalloc;
+	int allocmode;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
 
 	/* Get the disk block number */
-	doalloc = (rw == UIO_WRITE);
-	result = sfs_bmap(sv, vnblock, doalloc, &diskblock);
+	allocmode = (rw == UIO_WRITE) ? SFS_BMAP_ALLOC : SFS_BMAP_LOOKUP;
+	result = sfs_bmap(sv, vnblock, allocmode, &diskblock);
 	if (result) {
 		return result;
 	}
 
 	if (diskblock == 0) {
-		/* Should only get block 0 back if doalloc is false */
+		/* Should only get block 0 back if we didn't allocate */
 		KASSERT(rw == UIO_READ);
 
 		/* Sparse file, read as zeros. */
@@ -443,26 +693,22 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buffer_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, (char *)buffer_map(b) + blockoffset, len);
+		buffer_release(b);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy((char *)buffer_map(b) + blockoffset, data, len);
+		buffer_mark_dirty(b);
+		buffer_release(b);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
@@ -37,19 +37,27 @@
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
-/* Macro for initializing a uio structure */
-#define SFSUIO(iov, uio, ptr, block, rw) \
-    uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
-
-
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, bool clear,
+		daddr_t *diskblock);
+int sfs_ballocrun(struct sfs_fs *sfs, daddr_t goal, unsigned want,
+		daddr_t *diskblock, unsigned *got);
+void sfs_bfreerun(struct sfs_fs *sfs, daddr_t diskblock, unsigned n);
+int sfs_breserve(struct sfs_fs *sfs);
+void sfs_bunreserve(struct sfs_fs *sfs, unsigned n);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
 /* Functions in sfs_bmap.c */
-int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+/* What sfs_bmap does about a block that isn't allocated yet */
+#define SFS_BMAP_LOOKUP  0	/* nothing; report it as block 0 */
+#define SFS_BMAP_ALLOC   1	/* allocate it, zeroed */
+#define SFS_BMAP_FILL    2	/* allocate it; caller overwrites all of it */
+int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int allocmode,
 		daddr_t *diskblock);
+int sfs_bmap_goal(struct sfs_vnode *sv, uint32_t fileblock, daddr_t *goal);
+int sfs_bmap_record(struct sfs_vnode *sv, uint32_t fileblock,
+		daddr_t diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -63,6 +71,8 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		int *slot);
 
 /* Functions in sfs_inode.c */
+/* Initial number of chains in sfs_vnhash; it doubles as vnodes are loaded */
+#define SFS_VNHASH_MINSIZE  32
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
@@ -74,6 +84,8 @@ struct vnode *sfs_getroot(struct fs *fs);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
+int sfs_dflush(struct sfs_vnode *sv);
+void sfs_dtrunc(struct sfs_vnode *sv, uint32_t blocklen);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
@@ -0,0 +1,60 @@
+#ifndef _BIO_H_
+#define _BIO_H_
+
+/*
+ * Block I/O requests.
+ *
+ * A struct bio describes a transfer of whole blocks between memory
+ * and a block device. bio_submit puts it on the device's queue and
+ * returns at once; bio_io does the same and waits for it.
+ *
+ * Each device has a queue and a worker thread. The queue is kept in
+ * block order and served C-LOOK style: the worker takes the next
+ * request at or after where the last transfer ended, wrapping around
+ * to the lowest block when there's nothing further along. Requests
+ * in the same direction for adjacent blocks are merged into a single
+ * device transfer.
+ *
+ * When a submitted request finishes, bio_error is set and bio_done,
+ * if not NULL, is called from the worker thread with no locks held.
+ * It may take locks and submit more requests, but must not wait for
+ * another request to finish, as that would stall the device's queue.
+ * The bio and its buffer belong to the queue until then.
+ */
+
+#include <uio.h>
+
+struct device;
+
+struct bio {
+	/* Filled in by the caller */
+	struct device *bio_dev;
+	daddr_t bio_block;		/* first block */
+	void *bio_data;
+	size_t bio_len;			/* a multiple of the block size */
+	enum uio_rw bio_rw;
+	void (*bio_done)(struct bio *);	/* completion callback, or NULL */
+	void *bio_arg;			/* for bio_done */
+
+	/* Set when finished */
+	int bio_error;
+
+	/* Private to bio.c */
+	bool bio_finished;
+	struct bio *bio_next;
+};
+
+/* Call once during system startup. */
+void bio_bootstrap(void);
+
+/* Queue BIO; bio_done is called when it finishes. */
+void bio_submit(struct bio *bio);
+
+/* Queue BIO and wait for it to finish; returns bio_error. */
+int bio_io(struct bio *bio);
+
+/* Print queue and merge statistics; reset the counters. */
+void bio_printstats(void);
+void bio_resetstats(void);
+
+#endif /* _BIO_H_ */
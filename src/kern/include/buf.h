@@ -0,0 +1,79 @@
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Buffer cache.
+ *
+ * Disk blocks are cached in memory, found by (device, block number).
+ * To use a block, get the buffer for it with buffer_read (which reads
+ * it from disk if it isn't cached) or buffer_get (which doesn't, for
+ * blocks that are about to be completely overwritten). Either way the
+ * caller holds the buffer exclusively until buffer_release; anyone
+ * else asking for the same block waits. While held, buffer_map gives
+ * the block's data; after changing it, call buffer_mark_dirty.
+ *
+ * Dirty blocks are written back when the buffer is evicted to make
+ * room for another block (least recently used first), when
+ * buffer_sync is called, which the filesystem does from its sync, or
+ * by a background syncer thread, every few seconds or sooner if many
+ * blocks are dirty.
+ *
+ * Don't hold the same block twice in one thread; the second request
+ * waits for the first to be released.
+ *
+ * buffer_prefetch asks for a block to be read into the cache in the
+ * background, for callers that know they will want it soon.
+ */
+
+#include <kern/types.h>
+
+struct device;
+struct buf;
+
+/* Size of each cached block. Only devices with this block size work. */
+#define BUFFER_SIZE    512
+
+/* How many blocks to cache at most. */
+#define BUFFER_MAXBUFS 256
+
+/* Call once during system startup. */
+void buffer_bootstrap(void);
+
+/* Get a held buffer for BLOCK of DEV, reading it in if necessary. */
+int buffer_read(struct device *dev, daddr_t block, struct buf **ret);
+
+/* Same, but the contents are undefined if the block wasn't cached. */
+int buffer_get(struct device *dev, daddr_t block, struct buf **ret);
+
+/* Start reading BLOCK of DEV into the cache, if it isn't there. */
+void buffer_prefetch(struct device *dev, daddr_t block);
+
+/* The data of a held buffer. */
+void *buffer_map(struct buf *b);
+
+/* The block number of a held buffer. */
+daddr_t buffer_block(struct buf *b);
+
+/* Note that a held buffer's data was changed and must be written. */
+void buffer_mark_dirty(struct buf *b);
+
+/* Let go of a held buffer. */
+void buffer_release(struct buf *b);
+
+/*
+ * Forget about BLOCK of DEV, which has been freed: drop its contents
+ * without writing them back.
+ */
+void buffer_forget(struct device *dev, daddr_t block);
+
+/* Write back all dirty buffers of DEV (or of every device if NULL). */
+int buffer_sync(struct device *dev);
+
+/* Discard every buffer of DEV, which must all be clean. For unmount. */
+void buffer_drop(struct device *dev);
+
+/* Print hit rate and other statistics; reset the counters. */
+void buffer_printstats(void);
+void buffer_resetstats(void);
+
+#endif /* _BUF_H_ */
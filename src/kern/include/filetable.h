@@ -2,52 +2,74 @@
 #define _FILETABLE_H_
 
 #include <vnode.h>
+#include <uio.h>
 #include <limits.h>
 #include <synch.h>
 
+/*
+ * Descriptor tables start with FT_INITSLOTS slots and double in size
+ * as needed, up to OPEN_MAX. Empty slots are NULL, and usedmap has a
+ * bit set for each slot in use, so the lowest free descriptor is found
+ * a 32-bit word at a time.
+ */
+#define FT_INITSLOTS 8
+#define FT_WORDS(nslots) (((nslots) + 31) / 32)
+
+/*
+ * An open file. It is created by open and shared, not copied, by
+ * every descriptor that dup2 or fork makes from it, so they all see
+ * the same offset. refcount counts those descriptors; when the last
+ * one is closed the vnode is closed and the fte freed. fte_lock
+ * protects offset, ra and refcount.
+ */
 struct fte {
-    int flag; // Indicates taken or not
     struct vnode *file; // Points to the file
     off_t offset; // Offset in the file
     int permissions; // Permissions allowed on the file
+    int flags; // Flags it was opened with (O_APPEND etc)
+    int refcount; // Number of descriptors referring to this
+    struct readahead ra; // Read-ahead state for reads at offset
     struct lock *fte_lock; 
-    
 };
 
 struct fileTablePtr{
-    struct fte *ftp[OPEN_MAX]; // Short for File Table Pointer
-    int firstFreeSpot; 
+    struct fte **ftp; // Short for File Table Pointer, NULL slots are free
+    uint32_t *usedmap; // Bit per slot, set when in use
+    int nslots; // Number of slots in ftp
+    int firstFreeSpot; // No slot below this is free
+    struct lock *ft_lock; // Protects all of the above
 };
 
 
 struct fileTablePtr* ft_init(void);
 
 /*Add entry to filetable*/
-int addEntry(struct fileTablePtr *ft, int permissions, off_t offset, struct vnode* vn, int *errFlag, int *fd); 
+int addEntry(struct fileTablePtr *ft, int permissions, int flags, struct vnode* vn, int *errFlag, int *fd); 
 
 /*Initialize stdin, stdout, stderr.*/
 int stdio_init(struct fileTablePtr *ft); 
 
-/*Update the firstFreeSpot to earliest available open spot.*/
-void findFirstFreeSpot(struct fileTablePtr *ft);
-
 /*Add stdin, stdout, stderr entries to file table*/
-void addIoEntry(struct fileTablePtr *ft, int permissions, struct vnode* vn, int fd);
+int addIoEntry(struct fileTablePtr *ft, int permissions, struct vnode* vn, int fd);
 
-/*Get entry at a particular fd.*/
+/*Get entry at a particular fd, NULL if it isn't open.*/
 struct fte *getEntry(struct fileTablePtr *ft, int fd); 
 
-/*Reset a particular fd*/
-void clean_fd(struct fileTablePtr *ft, int fd); 
+/*Close a particular fd, and the file if it was the last reference.
+Returns EBADF if fd isn't open.*/
+int clean_fd(struct fileTablePtr *ft, int fd); 
 
 /*Check validity of fd*/
 int isValid(struct fileTablePtr *ft, int fd);
 
-/*Duplicate a given fd*/
+/*Duplicate a given fd, closing newfd first if it's open*/
 int addDupEntry(struct fileTablePtr *ft, int oldfd, int newfd, size_t *retval); 
 
+/*Make dst's newfd refer to src's oldfd, closing whatever was there*/
+int dupAcross(struct fileTablePtr *src, int oldfd, struct fileTablePtr *dst, int newfd);
+
 /*Create file table entries for child proc after forking*/
-struct fileTablePtr* fork_ft(struct fileTablePtr *parent, struct fileTablePtr *child_ft);
+int fork_ft(struct fileTablePtr *parent, struct fileTablePtr *child_ft);
 
 void cleanup(struct fileTablePtr *ft); 
 
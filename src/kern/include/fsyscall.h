@@ -4,15 +4,23 @@
 #include <vnode.h>
 #include <limits.h>
 
+struct iovec;
+
 int init(void); 
 int sys_open(const char *filename, int flags, mode_t mode, size_t* retval);
 int sys_close(int fd);
 int sys_read(int fd, void *buf, size_t buflen, size_t *retVal);
 int sys_write(int fd, const void *buf, size_t nbytes, size_t *retVal); 
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, size_t *retVal);
+int sys_pwrite(int fd, const void *buf, size_t nbytes, off_t pos, size_t *retVal);
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, size_t *retVal);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, size_t *retVal);
 int sys_lseek(int fd, off_t pos, int whence, size_t *retVal, size_t *retFlag);
 int sys_dup2(int oldfd, int newfd, size_t *retval);
 int sys_chdir(const char* pathname);
 int sys__getcwd(char *buf, size_t buflen, size_t *retVal);
+int sys_sync(void);
+int sys_ioctl(int fd, int code, userptr_t data);
 int check_fd(int fd);
 
 
@@ -34,6 +34,21 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Disk statistics, supported by lhd. IOCTL_DISKSTATS copies a struct
+ * diskstats out to the argument; IOCTL_DISKSTATS_RESET zeroes the
+ * counters and ignores the argument.
+ */
+#define IOCTL_DISKSTATS         1
+#define IOCTL_DISKSTATS_RESET   2
+
+struct diskstats {
+	__u32 ds_requests;	/* read/write requests completed */
+	__u32 ds_sectors;	/* sectors transferred */
+	__u32 ds_interrupts;	/* completion interrupts taken */
+	__u32 ds_errors;	/* requests that failed */
+	__u64 ds_totalnsecs;	/* sum of request latencies */
+	__u64 ds_maxnsecs;	/* longest request latency */
+};
 
 #endif /* _KERN_IOCTL_H_*/
@@ -36,20 +36,23 @@
  * and is used by tools that work on SFS volumes, such as mksfs.
  */
 
-#define SFS_MAGIC         0xabadf001    /* magic number identifying us */
+#define SFS_MAGIC         0xabadf002    /* magic number identifying us */
 #define SFS_BLOCKSIZE     512           /* size of our blocks */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
-#define SFS_NDIRECT       15            /* # of direct blocks in inode */
-#define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NIEXTENTS     40            /* # of extents in inode */
+#define SFS_EXTPERBLOCK   42            /* # of extents per extent block */
+#define SFS_EXTMAXDEPTH   1             /* max levels of extent blocks */
+#define SFS_EXTMAGIC      0x5f457874    /* extent block magic number */
+#define SFS_NDIRINDEX     3             /* # of name index blocks in dir */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
 #define SFS_NOINO         0             /* inode # for free dir entry */
 #define SFS_ROOTDIR_INO   1             /* loc'n of the root dir inode */
 
+/* Largest directory (in slots): as many as the name index can cover */
+#define SFS_DIRMAXSLOTS   (SFS_NDIRINDEX * SFS_BLOCKSIZE)
+
 /* Number of bits in a block */
 #define SFS_BITSPERBLOCK (SFS_BLOCKSIZE * CHAR_BIT)
 
@@ -77,6 +80,38 @@ struct sfs_superblock {
 	uint32_t reserved[118];			/* unused, set to 0 */
 };
 
+/*
+ * Extents.
+ *
+ * A file's blocks are described by extents, each a run of EXT_LEN
+ * consecutive disk blocks starting at EXT_DISKBLOCK that hold the
+ * file's blocks from EXT_FILEBLOCK on. Extents are kept sorted by
+ * EXT_FILEBLOCK, never overlap, and are never empty; file blocks no
+ * extent covers are holes, and read as zeros.
+ *
+ * Up to SFS_NIEXTENTS extents live in the inode itself (sfi_depth 0).
+ * A file with more has an extent tree of depth 1: the inode's entries
+ * then each name an extent block (in ext_diskblock) holding up to
+ * SFS_EXTPERBLOCK extents, for the file blocks from that entry's
+ * ext_fileblock up to the next entry's; ext_len is 0. Extent blocks
+ * are never empty. In the first entry, ext_fileblock is that of the
+ * first extent in its block.
+ */
+struct sfs_extent {
+	uint32_t ext_fileblock;			/* First file block */
+	uint32_t ext_diskblock;			/* Where it is on disk */
+	uint32_t ext_len;			/* Number of blocks */
+};
+
+/*
+ * On-disk extent block
+ */
+struct sfs_extblock {
+	uint32_t eb_magic;			/* SFS_EXTMAGIC */
+	uint32_t eb_nextents;			/* Entries used */
+	struct sfs_extent eb_extents[SFS_EXTPERBLOCK];
+};
+
 /*
  * On-disk inode
  */
@@ -84,9 +119,11 @@ struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
 	uint16_t sfi_type;			/* One of SFS_TYPE_* above */
 	uint16_t sfi_linkcount;			/* # hard links to this file */
-	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
-	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint16_t sfi_nextents;			/* Entries used in sfi_extents */
+	uint16_t sfi_depth;			/* Levels of extent blocks */
+	uint32_t sfi_dirindex[SFS_NDIRINDEX];	/* Name index blocks (dirs) */
+	struct sfs_extent sfi_extents[SFS_NIEXTENTS]; /* See above */
+	uint32_t sfi_waste[128-3-SFS_NDIRINDEX-3*SFS_NIEXTENTS]; /* set to 0 */
 };
 
 /*
@@ -97,5 +134,32 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Directory name index.
+ *
+ * A directory may have a name index: one byte per directory slot,
+ * slot N's byte at offset N%SFS_BLOCKSIZE of index block
+ * sfi_dirindex[N/SFS_BLOCKSIZE]. The byte is 0 for a free slot and
+ * otherwise sfs_dirtag() of the name in the slot, so a lookup only
+ * has to read the slots whose byte matches, and a free slot can be
+ * found without reading any. The slots themselves are laid out just
+ * as in a directory without an index. SFS_NDIRINDEX blocks cover
+ * the largest possible directory.
+ *
+ * A directory has an index if sfi_dirindex[0] is nonzero; a new
+ * slot past the end of the last index block gets a new block.
+ */
+static inline
+uint8_t
+sfs_dirtag(const char *name)
+{
+	uint32_t h = 5381;
+
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % 255 + 1;
+}
+
 
 #endif /* _KERN_SFS_H_ */
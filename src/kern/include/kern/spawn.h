@@ -0,0 +1,16 @@
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * Descriptor setup for spawn(). Each entry makes the new process's
+ * descriptor sf_fd refer to the caller's descriptor sf_parentfd, or
+ * closes sf_fd in the new process if sf_parentfd is -1. Everything
+ * else is inherited as with fork. Entries are read against the
+ * caller's table, so their order doesn't matter.
+ */
+struct spawn_fdmap {
+	int sf_fd;		/* Descriptor in the new process */
+	int sf_parentfd;	/* Caller's descriptor to put there, or -1 */
+};
+
+#endif /* _KERN_SPAWN_H_ */
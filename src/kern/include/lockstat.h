@@ -0,0 +1,44 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiling.
+ *
+ * When the kernel is built with "options lockstat", lock_acquire and
+ * spinlock_acquire record for each lock (keyed by its address, and
+ * its name if it has one) the number of acquisitions, how many of
+ * them found the lock already held, the total time spent waiting, and
+ * the longest time it was held. The "lockstat" menu command prints
+ * the locks with the most total wait time.
+ *
+ * Without the option none of this is compiled in and the lock paths
+ * are unchanged.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Call once the realtime clock is available to start collecting. */
+void lockstat_bootstrap(void);
+
+/* Current time in nanoseconds, or 0 if not collecting yet. */
+uint64_t lockstat_now(void);
+
+/*
+ * Record an acquisition of lock LK (named NAME, or NULL for spinlocks)
+ * that started waiting at time START and got the lock at time NOW.
+ */
+void lockstat_acquired(const void *lk, const char *name, bool contended,
+		       uint64_t start, uint64_t now);
+
+/* Record the release of LK, which was acquired at time ACQUIRED. */
+void lockstat_released(const void *lk, const char *name, uint64_t acquired);
+
+/* Print the COUNT locks with the most wait time; forget everything. */
+int lockstat_print(unsigned count);
+void lockstat_reset(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
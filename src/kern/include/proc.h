@@ -43,6 +43,7 @@
 
 struct addrspace;
 struct vnode;
+struct wchan;
 
 struct pid_table *pidTable; 
 
@@ -63,17 +64,48 @@ struct proc {
 	/* add more material here as needed */
 	struct fileTablePtr* ft; // File table pointer for the process
 
-	struct array *children; // Children of a proc
+	/*
+	 * Family links, protected by the pid table's prw. A proc is a
+	 * child of P exactly when its p_parent is P, so with the pid
+	 * table as the index, membership is one lookup. The sibling
+	 * links let the parent walk and unlink its children in O(1) each.
+	 */
+	struct proc *p_parent; // Parent, or NULL if orphaned
+	struct proc *p_children; // First child
+	struct proc *p_nextsib; // Next child of our parent
+	struct proc *p_prevsib; // Previous child of our parent
 	pid_t pid; // pid of proc
-	int status; // status of proc
-	int exitCode; // exitcode of proc
+	int status; // status of proc, protected by p_lock
+	int exitCode; // exitcode of proc, protected by p_lock
+	struct wchan *p_exitwchan; // waitpid sleeps here until this proc exits
+	bool p_vforked; // Running on the parent's address space until exec/exit, protected by p_lock
 };
 
+/*
+ * Sizes for the pid table. procs is split into chunks of PID_CHUNK
+ * entries that are only allocated once a pid in that range is handed
+ * out. pidmap has one bit per pid (set = in use), and fullmap has one
+ * bit per pidmap word (set = that word is all ones), so finding a free
+ * pid looks at no more than a handful of words.
+ */
+#define PID_CHUNK     256
+#define PID_NCHUNKS   ((PID_MAX + PID_CHUNK) / PID_CHUNK)
+#define PID_WORDS     ((PID_MAX + 32) / 32)
+#define PID_SUMWORDS  ((PID_WORDS + 31) / 32)
+
+/*
+ * prw protects the procs table, the pid bitmaps and the family
+ * links in each proc. Lookups (getpid, isChild) take it for reading, so they don't
+ * serialize with each other; fork and reaping take it for writing.
+ * Exits are announced on the exiting proc's own p_exitwchan, so they
+ * only wake whoever is waiting for that proc.
+ */
 struct pid_table{
-	int firstFreePid; // Indicates the pid that can be assigned
-	struct proc *procs[PID_MAX + 1]; // Since cannot be used 
-	struct lock* plock; // Lock for the table
-	struct cv* pcv; // Conditional variable used in waitpid and exit
+	pid_t nextPid; // Where the search for a free pid starts
+	struct proc **procs[PID_NCHUNKS]; // Procs by pid, in chunks
+	uint32_t pidmap[PID_WORDS]; // Pids in use
+	uint32_t fullmap[PID_SUMWORDS]; // Words of pidmap that are full
+	struct rwlock* prw; // Reader-writer lock for the table
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -104,21 +136,39 @@ struct addrspace *proc_setas(struct addrspace *);
 /*Add an entry to the pid table*/
 int addPidEntry(struct proc *child);
 
-/*Update first free pointer*/
-void findFirstFreePid(void); 
+/*Undo addPidEntry for a child that never ran*/
+void removePidEntry(struct proc *child);
+
+/*Look up a proc by pid; NULL if the pid isn't in use*/
+struct proc *pid_lookup(pid_t pid);
 
 /*Adds a childProc to pid table, copies the parent's filetable 
 and increases ref count to parent's cwd (taken from proc_create)*/
 int fork_proc(struct proc* childProc);
 
+/*Like fork_proc, but leaves the child without an address space,
+for spawn to load a program into*/
+int spawn_proc(struct proc* childProc);
+
+/*Like fork_proc, but the child borrows the parent's address space
+instead of getting a copy*/
+int vfork_proc(struct proc* childProc);
+
+/*Give a vfork child's parent its address space back and wake it.
+Returns false if the proc wasn't a vfork child*/
+bool vfork_release(struct proc *proc);
+
+/*Sleep until a vfork child has called vfork_release*/
+void vfork_wait(struct proc *child);
+
 /*Set the trapframe for a child given the parent's tf*/
 struct trapframe *set_tf(struct trapframe *parent);
 
 /*Initialize the global pid table*/
 void pid_table_init(void); 
 
-/*Helper that kills the parent, and assigns it children to kernel
-proc*/
+/*Helper that exits a proc. Its children are orphaned; orphans are
+reaped as soon as they exit since nobody can wait for them*/
 void proc_exit(struct proc* proc_to_exit, size_t exitcode);
 
 /*Helper to create a proc, using proc_create*/
@@ -136,9 +186,9 @@ void clean_child_file(struct proc *parent, pid_t child_pid);
 /*Returns child of parent process*/
 struct proc* getChild(struct proc *parent, pid_t child_pid);
 
-/*Waits for proc status to change to Zombie,
-status is checked atomically*/
-int proc_waitpid(pid_t pid, size_t *exitcode, int canReap); 
+/*Waits for proc status to change to Zombie, then reaps it. With
+WNOHANG, returns at once with *retpid 0 if it hasn't exited yet*/
+int proc_waitpid(pid_t pid, int options, size_t *exitcode, pid_t *retpid); 
 
 /*Gets the pid of a proc atomically*/
 void proc_getpid(size_t *retval);
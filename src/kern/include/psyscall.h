@@ -4,15 +4,16 @@
 #include <mips/trapframe.h>
 
 int sys_fork(struct trapframe *tf, size_t *retVal);
+int sys_vfork(struct trapframe *tf, size_t *retVal);
 int sys_getpid(size_t *retval);
 void sys__exit(size_t retval);
 
 void exec_usermode(void *data1, unsigned long data2);
 
-int sys_waitpid(pid_t pid, int *retVal, int options);
-int getargs(char **args, char **kern_args, int total_args);
-int getCount(char **args, char *arg_addr, int *total_args);
+int sys_waitpid(pid_t pid, int *retVal, int options, size_t *retpid);
 int sys_execv(const char *program, char **args);
-int getLen(char *arg_string, int *len);
+
+struct spawn_fdmap;
+int sys_spawn(const char *program, char **args, const struct spawn_fdmap *fdmap, int nfdmap, size_t *retVal);
 
 #endif /* _PSYSCALL_H_ */
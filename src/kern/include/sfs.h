@@ -48,6 +48,24 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking. SFS doesn't use vfs_biglock; instead
+ *
+ *   - sv_lock protects an inode and the file's (or directory's)
+ *     contents, except for sfi_type and sv_ino, which never change
+ *     once the vnode is loaded;
+ *   - sfs_vnlock protects the table of loaded vnodes and every
+ *     vnode's sv_hashnext and sv_dying;
+ *   - sfs_freemaplock protects the freemap, sfs_nfree and
+ *     sfs_nreserved, and the superblock.
+ *
+ * Locks are taken in that order, and a directory's sv_lock before
+ * that of a file in it. The buffer cache has its own locking below
+ * all of these.
+ */
+
+struct sfs_dblock;
+
 /*
  * In-memory inode
  */
@@ -56,6 +74,10 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* protects sv_i, sv_dirty, data */
+	struct sfs_vnode *sv_hashnext;  /* next in sfs_vnhash chain */
+	bool sv_dying;                  /* being reclaimed; don't hand out */
+	struct sfs_dblock *sv_dblocks;  /* data not yet given disk blocks */
 };
 
 /*
@@ -66,9 +88,16 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnhash;  /* vnodes loaded, by inode number */
+	unsigned sfs_vnhashsize;        /* number of sfs_vnhash chains */
+	unsigned sfs_nvnodes;           /* number of vnodes loaded */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	uint32_t sfs_nfree;             /* blocks free in the freemap */
+	uint32_t sfs_nreserved;         /* ...of which promised to sv_dblocks */
+	struct lock *sfs_vnlock;        /* protects sfs_vnhash, sfs_nvnodes */
+	struct cv *sfs_vncv;            /* signalled when reclaims finish */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
 };
 
 /*
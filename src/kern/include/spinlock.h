@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -48,6 +49,13 @@
 /*
  * Basic spinlock.
  *
+ * This is a ticket lock: each CPU wanting the lock atomically takes
+ * the next ticket number from splk_next, then waits (reading only)
+ * until splk_serving reaches its ticket. Releasing the lock advances
+ * splk_serving. Waiters thus get the lock in FIFO order, and while
+ * waiting they don't write to the lock at all, so they don't fight
+ * over the cache line with the holder.
+ *
  * Note that spinlocks are held by CPUs, not by threads.
  *
  * This structure is made public so spinlocks do not have to be
@@ -55,14 +63,24 @@
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Ticket holding the lock. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	uint64_t splk_stamp;		    /* Time acquired, for lockstat */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include "opt-lockstat.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -78,8 +79,17 @@ struct lock {
         // (don't forget to mark things volatile as needed)
 	struct wchan *lk_wchan;
         struct thread *lk_holder;
+        struct cpu *lk_holdercpu;  // CPU lk_holder took the lock on, or NULL
         struct spinlock spin_lock;
         volatile bool taken; 
+
+        /* Acquire-path statistics, protected by spin_lock */
+        unsigned lk_acquires;   // Total number of acquisitions
+        unsigned lk_contended;  // Acquisitions that found the lock taken
+        unsigned lk_sleeps;     // Contended acquisitions that had to block
+#if OPT_LOCKSTAT
+        uint64_t lk_stamp;      // Time acquired, for lockstat
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -95,7 +105,15 @@ void lock_destroy(struct lock *);
  *                   false otherwise.
  *
  * These operations must be atomic. You get to write them.
+ *
+ * The lock is adaptive: if it is taken and the holder is still
+ * running on the other CPU it took the lock on, lock_acquire spins for up to LOCK_SPIN_MAX
+ * iterations waiting for it to be released before going to sleep.
+ * Critical sections that are only a few instructions long therefore
+ * never pay for a context switch and a wakeup.
  */
+#define LOCK_SPIN_MAX 1000
+
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
@@ -145,4 +163,47 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers cannot starve writers.
+ * When the last writer leaves, all waiting readers are let in at once.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_lock;
+        struct wchan *rw_readwchan;     // Readers waiting for writers to finish
+        struct wchan *rw_writewchan;    // Writers waiting for the lock
+        volatile unsigned rw_readers;   // Number of readers holding the lock
+        volatile unsigned rw_waitwriters; // Number of writers waiting
+        struct thread *rw_writer;       // Writer holding the lock, if any
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Multiple threads
+ *                          can hold the lock for reading at the same time.
+ *    rwlock_release_read  - Free the lock after reading.
+ *    rwlock_acquire_write - Get the lock for writing. Only one thread can
+ *                          hold the write lock at one time, and no
+ *                          readers may hold it at the same time.
+ *    rwlock_release_write - Free the write lock.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds the
+ *                          lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
\ No newline at end of file
@@ -56,6 +56,10 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int lockspeedtest(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int spinlocktest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -70,6 +70,18 @@ enum uio_seg {
         UIO_SYSSPACE,			/* Kernel. */
 };
 
+/*
+ * Read-ahead state of an open file. The file system looks at it (if
+ * the uio has one) to recognize sequential reads and decide how far
+ * ahead to prefetch, and updates it. Start it out all zeros. Whoever
+ * owns it must keep two reads from using it at once.
+ */
+struct readahead {
+	off_t             ra_next;	/* Where a sequential read starts */
+	unsigned          ra_window;	/* Blocks to keep prefetched */
+	uint32_t          ra_ahead;	/* First block not yet prefetched */
+};
+
 struct uio {
 	struct iovec     *uio_iov;	/* Data blocks */
 	unsigned          uio_iovcnt;	/* Number of iovecs */
@@ -78,6 +90,7 @@ struct uio {
 	enum uio_seg      uio_segflg;	/* What kind of pointer we have */
 	enum uio_rw       uio_rw;	/* Whether op is a read or write */
 	struct addrspace *uio_space;	/* Address space for user pointer */
+	struct readahead *uio_ra;	/* Read-ahead state, or NULL */
 };
 
 
@@ -95,14 +108,15 @@ struct uio {
  *   (4) set up uio_seg and uio_rw correctly;
  *   (5) if uio_seg is UIO_SYSSPACE, set uio_space to NULL; otherwise,
  *       initialize uio_space to the address space in which the buffer
- *       should be found.
+ *       should be found;
+ *   (6) set uio_ra to the open file's read-ahead state, or NULL.
  *
  * After calling,
  *   (1) the contents of uio_iov and uio_iovcnt may be altered and
  *       should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
- *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
+ *   (4) uio_segflg, uio_rw, uio_space, and uio_ra will be unchanged.
  *
  * uiomove() may be called repeatedly on the same uio to transfer
  * additional data until the available buffer space the uio refers to
@@ -81,6 +81,25 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name cache. vfs_lookup and vfs_lookparent remember what each name
+ * looked up in each directory refers to, including names that don't
+ * exist.
+ *
+ *    vfs_dcache_invalidate - Forget NAME in DIR. Must be called after
+ *                     anything that creates, removes, or renames NAME.
+ *    vfs_dcache_purge - Forget everything on filesystem FS (or on all
+ *                     filesystems if NULL), letting go of the vnodes.
+ *                     Done before unmounting.
+ *    vfs_dcache_printstats - Print hit rate and other statistics.
+ *    vfs_dcache_resetstats - Clear them.
+ */
+
+void vfs_dcache_invalidate(struct vnode *dir, const char *name);
+void vfs_dcache_purge(struct fs *fs);
+void vfs_dcache_printstats(void);
+void vfs_dcache_resetstats(void);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because lookup may destroy pathnames, these all may too.
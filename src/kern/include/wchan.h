@@ -68,13 +68,25 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
- * The associated spinlock should be locked.
+ * The associated spinlock should be locked. wchan_wakeone returns
+ * the thread it woke, or NULL if the channel was empty.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+struct thread *wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move one thread, or all threads, sleeping on wait channel FROM to
+ * the tail of wait channel TO without waking them. Both associated
+ * spinlocks must be locked. The threads stay asleep until someone
+ * wakes them on TO.
+ */
+void wchan_moveone(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk);
+void wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
@@ -46,8 +46,11 @@
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
+#include <bio.h>
+#include <buf.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
@@ -114,6 +117,8 @@ boot(void)
 	thread_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	bio_bootstrap();
+	buffer_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -137,6 +142,9 @@ boot(void)
 
 	kheap_nextgeneration();
 	pid_table_init(); 
+#if OPT_LOCKSTAT
+	lockstat_bootstrap();
+#endif
 
 	/*
 	 * Make sure various things aren't screwed up.
@@ -41,9 +41,13 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
+#include <bio.h>
+#include <buf.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
 
 #include <psyscall.h>
 
@@ -151,7 +155,8 @@ common_prog(int nargs, char **args)
 	// int status = 0; 
 	// size_t retVal; 
 	// kprintf("WAITING FOR: %d", proc->pid); 
-	sys_waitpid(proc->pid, NULL, 0);
+	size_t retpid;
+	sys_waitpid(proc->pid, NULL, 0, &retpid);
 	// while(proc->status != 4){
 
 	// }
@@ -394,6 +399,104 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for printing buffer cache statistics.
+ *   bufstat		show hit rate, I/O and eviction counts
+ *   bufstat reset	clear the statistics
+ */
+static
+int
+cmd_bufstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		buffer_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: bufstat [reset]\n");
+		return EINVAL;
+	}
+
+	buffer_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing block I/O queue statistics.
+ *   biostat		show request, transfer and merge counts
+ *   biostat reset	clear the statistics
+ */
+static
+int
+cmd_biostat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		bio_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: biostat [reset]\n");
+		return EINVAL;
+	}
+
+	bio_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing name cache statistics.
+ *   dcstat		show hit rate, eviction and invalidation counts
+ *   dcstat reset	clear the statistics
+ */
+static
+int
+cmd_dcstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vfs_dcache_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: dcstat [reset]\n");
+		return EINVAL;
+	}
+
+	vfs_dcache_printstats();
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing lock contention statistics.
+ *   lockstat [n]	show the n most contended locks (default 10)
+ *   lockstat reset	clear the statistics
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int count = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			lockstat_reset();
+			return 0;
+		}
+		count = atoi(args[1]);
+		if (count <= 0) {
+			kprintf("Usage: lockstat [count | reset]\n");
+			return EINVAL;
+		}
+	}
+
+	return lockstat_print(count);
+}
+#endif
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -496,6 +599,10 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Lock throughput test  (1)     ",
+	"[rwt1] RW lock test         (1)     ",
+	"[rwt2] RW lock preference   (1)     ",
+	"[splk] Spinlock stress test (1)     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -529,6 +636,12 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[bufstat] Buffer cache stats        ",
+	"[biostat] Block I/O queue stats     ",
+	"[dcstat] Name cache stats           ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -583,6 +696,12 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "bufstat",    cmd_bufstat },
+	{ "biostat",    cmd_biostat },
+	{ "dcstat",     cmd_dcstat },
+#if OPT_LOCKSTAT
+	{ "lockstat",   cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -604,6 +723,10 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	lockspeedtest },
+	{ "rwt1",	rwtest },
+	{ "rwt2",	rwtest2 },
+	{ "splk",	spinlocktest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
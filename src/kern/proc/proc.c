@@ -50,6 +50,8 @@
 #include <vnode.h>
 #include <filetable.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
+#include <wchan.h>
 #include <mips/trapframe.h>
 #include <current.h>
 
@@ -88,8 +90,18 @@ proc_create(const char *name)
 		return NULL;
 	}
 
-	proc->children = array_create(); 
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_nextsib = NULL;
+	proc->p_prevsib = NULL;
 	proc->status = RUNNING;
+	proc->p_vforked = false;
+	proc->p_exitwchan = wchan_create(proc->p_name); 
+	if (proc->p_exitwchan == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 	// if(name == "[kernel]"){
 
 
@@ -102,6 +114,12 @@ proc_create(const char *name)
 
 	/*Link proc's ft to the ft returned by ft_init*/
 	proc->ft = ft_init(); // MIGHT BE WRONG!!!!!!!!!!!!!!!!!!!
+	if (proc->ft == NULL) {
+		wchan_destroy(proc->p_exitwchan);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
@@ -201,8 +219,10 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
-	lock_destroy(pidTable->plock); 
-	cv_destroy(pidTable->pcv); 
+	if (proc->ft != NULL) {
+		cleanup(proc->ft);
+	}
+	wchan_destroy(proc->p_exitwchan);
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -384,47 +404,184 @@ proc_setas(struct addrspace *newas)
 	return oldas;
 }
 
+// Index of the lowest clear bit in a word that isn't all ones
+static unsigned lowestClearBit(uint32_t word){
+	unsigned bit = 0; 
+	word = ~word; 
+	if((word & 0xffff) == 0){ bit += 16; word >>= 16; }
+	if((word & 0xff) == 0){ bit += 8; word >>= 8; }
+	if((word & 0xf) == 0){ bit += 4; word >>= 4; }
+	if((word & 0x3) == 0){ bit += 2; word >>= 2; }
+	if((word & 0x1) == 0){ bit += 1; }
+	return bit; 
+}
+
+// Returns the first pidmap word at or after from that has a free pid, or -1
+static int findFreeWord(unsigned from){
+	unsigned sw, s; 
+	uint32_t full; 
+
+	if(from >= PID_WORDS){
+		return -1; 
+	}
+	sw = from / 32; 
+	full = pidTable->fullmap[sw] | ((1U << (from % 32)) - 1); // Skip words before from
+	if(full != 0xffffffff){
+		return sw * 32 + lowestClearBit(full); 
+	}
+	for(s = sw + 1; s < PID_SUMWORDS; s++){
+		if(pidTable->fullmap[s] != 0xffffffff){
+			return s * 32 + lowestClearBit(pidTable->fullmap[s]); 
+		}
+	}
+	return -1; 
+}
+
+static void markPid(pid_t pid){
+	unsigned w = pid / 32; 
+	pidTable->pidmap[w] |= 1U << (pid % 32); 
+	if(pidTable->pidmap[w] == 0xffffffff){
+		pidTable->fullmap[w / 32] |= 1U << (w % 32); 
+	}
+}
+
+static void unmarkPid(pid_t pid){
+	unsigned w = pid / 32; 
+	pidTable->pidmap[w] &= ~(1U << (pid % 32)); 
+	pidTable->fullmap[w / 32] &= ~(1U << (w % 32)); 
+}
+
+/*
+ * Hand out a free pid. Searches forward from nextPid (next fit), so
+ * pids cycle through the whole range before one is reused instead of
+ * the lowest free pid being handed out again right after it's reaped.
+ * prw must be held for writing.
+ */
+static int allocPid(pid_t *ret){
+	unsigned w, bit; 
+	int word; 
+	uint32_t used; 
+	pid_t pid; 
+
+	w = pidTable->nextPid / 32; 
+	used = pidTable->pidmap[w] | ((1U << (pidTable->nextPid % 32)) - 1); 
+	if(used != 0xffffffff){
+		word = w; 
+	}
+	else{
+		word = findFreeWord(w + 1); 
+		if(word < 0){
+			word = findFreeWord(0); // Wrap around
+			if(word < 0){
+				return ENPROC; 
+			}
+		}
+		used = pidTable->pidmap[word]; 
+	}
+	bit = lowestClearBit(used); 
+	pid = word * 32 + bit; 
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX); 
+
+	if(pidTable->procs[pid / PID_CHUNK] == NULL){
+		pidTable->procs[pid / PID_CHUNK] = kmalloc(PID_CHUNK * sizeof(struct proc *)); 
+		if(pidTable->procs[pid / PID_CHUNK] == NULL){
+			return ENOMEM; 
+		}
+		bzero(pidTable->procs[pid / PID_CHUNK], PID_CHUNK * sizeof(struct proc *)); 
+	}
+
+	markPid(pid); 
+	pidTable->nextPid = (pid == PID_MAX) ? PID_MIN : pid + 1; 
+	*ret = pid; 
+	return 0; 
+}
+
+// Release a pid and its table slot. prw must be held for writing.
+static void freePid(pid_t pid){
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX); 
+	pidTable->procs[pid / PID_CHUNK][pid % PID_CHUNK] = NULL; 
+	unmarkPid(pid); 
+}
+
+/*
+ * Callers must hold prw, or be the parent of pid (only the parent
+ * can free a pid, by reaping it).
+ */
+struct proc *pid_lookup(pid_t pid){
+	struct proc **chunk; 
+
+	if(pid < 0 || pid > PID_MAX){
+		return NULL; 
+	}
+	chunk = pidTable->procs[pid / PID_CHUNK]; 
+	if(chunk == NULL){
+		return NULL; 
+	}
+	return chunk[pid % PID_CHUNK]; 
+}
+
+// Link child into parent's list of children. prw must be held for writing.
+static void linkChild(struct proc *parent, struct proc *child){
+	child->p_parent = parent; 
+	child->p_prevsib = NULL; 
+	child->p_nextsib = parent->p_children; 
+	if(parent->p_children != NULL){
+		parent->p_children->p_prevsib = child; 
+	}
+	parent->p_children = child; 
+}
+
+// Unlink child from its parent's list of children. prw must be held for writing.
+static void unlinkChild(struct proc *child){
+	struct proc *parent = child->p_parent; 
+
+	KASSERT(parent != NULL); 
+	if(child->p_prevsib != NULL){
+		child->p_prevsib->p_nextsib = child->p_nextsib; 
+	}
+	else{
+		parent->p_children = child->p_nextsib; 
+	}
+	if(child->p_nextsib != NULL){
+		child->p_nextsib->p_prevsib = child->p_prevsib; 
+	}
+	child->p_parent = NULL; 
+	child->p_nextsib = NULL; 
+	child->p_prevsib = NULL; 
+}
+
 /*Assuming that parent is already in the pidTable*/
 int addPidEntry(struct proc *child){
-	// if(pidTable->plock->lk_holder->t_name) kprintf("Lock held by (add): %s.\n", pidTable->plock->lk_holder->t_name);
-	lock_acquire(pidTable->plock); 
-	// if(pidTable->plock->lk_holder->t_name) kprintf("Lock held by (add): %s.\n", pidTable->plock->lk_holder->t_name);
-	if(pidTable->firstFreePid == -1){
-		// kprintf("Lock held by (add): %s.\n", pidTable->plock->lk_holder->t_name);
-		lock_release(pidTable->plock); 
-		return ENPROC; 
-	}
-	// LOCK THIS
-	pidTable->procs[pidTable->firstFreePid] = child; 
-	child->pid = pidTable->firstFreePid; 
+	pid_t pid; 
+	int err; 
+
+	rwlock_acquire_write(pidTable->prw); 
+	err = allocPid(&pid); 
+	if(err){
+		rwlock_release_write(pidTable->prw); 
+		return err; 
+	}
+	linkChild(curproc, child); 
+	pidTable->procs[pid / PID_CHUNK][pid % PID_CHUNK] = child; 
+	child->pid = pid; 
 	child->status = RUNNING; 
 	child->exitCode = (int) NULL; 
-	// parent->children.add(child); 
-	unsigned *index_ret = 0; 
-	array_add(curproc->children, child, index_ret);
-	
-	findFirstFreePid(); 
-	lock_release(pidTable->plock);
-	// kprintf("Lock held by (add): %d.\n", pidTable->plock->taken); 
+	rwlock_release_write(pidTable->prw);
 	return 0; 
 }
 
-void findFirstFreePid(){
-	/*Starting from 1 because pid 0 is reserved for master process*/
-	for(int i = 2; i < PID_MAX; i++){
-		if(!pidTable->procs[i] || pidTable->procs[i]->status == AVAILABLE){
-			pidTable->firstFreePid = i; 
-			return ; 
-		}
-	}
-	pidTable->firstFreePid = -1; 
+/*Undo addPidEntry for a child that never ran*/
+void removePidEntry(struct proc *child){
+	rwlock_acquire_write(pidTable->prw); 
+	unlinkChild(child); 
+	freePid(child->pid); 
+	rwlock_release_write(pidTable->prw); 
 }
 
-int fork_proc(struct proc* childProc){
+/*The part of fork shared with vfork: pid, cwd and file table*/
+static int forkCommon(struct proc* childProc){
 	int err;
-	err = addPidEntry(childProc); // need to handle if error returned
-	err = as_copy(curproc->p_addrspace, &childProc->p_addrspace);  // need to handle if error returned
-	// childProc->ft = curproc->ft; // Chlid's ft points to the same ft as the parent's file table
+	err = addPidEntry(childProc);
 	if(err){
 		return err; 
 	}
@@ -436,34 +593,106 @@ int fork_proc(struct proc* childProc){
 	}
 	spinlock_release(&curproc->p_lock);
 
-	lock_acquire(pidTable->plock); 
-	fork_ft(curproc->ft, childProc->ft); 
-	lock_release(pidTable->plock); 
+	err = fork_ft(curproc->ft, childProc->ft); 
+	if(err){
+		removePidEntry(childProc); 
+		return err; 
+	}
+	return 0; 
+}
+
+int fork_proc(struct proc* childProc){
+	int err;
+	err = as_copy(curproc->p_addrspace, &childProc->p_addrspace);
+	if(err){
+		return err; 
+	}
+	return forkCommon(childProc); 
+}
+
+/*spawn: the child gets pid, cwd and files, and the caller loads its image*/
+int spawn_proc(struct proc* childProc){
+	return forkCommon(childProc); 
+}
+
+/*
+ * vfork: the child runs on the parent's address space, and the parent
+ * stays asleep in vfork_wait until the child execs into a new address
+ * space or exits. Nothing is copied, so fork+exec costs no more than
+ * the exec.
+ */
+int vfork_proc(struct proc* childProc){
+	int err;
+	err = forkCommon(childProc); 
 	if(err){
 		return err; 
 	}
+	/*Only set once nothing can fail, so proc_destroy won't free the parent's as*/
+	childProc->p_addrspace = curproc->p_addrspace; 
+	childProc->p_vforked = true; 
 	return 0; 
 }
 
+bool vfork_release(struct proc *proc){
+	spinlock_acquire(&proc->p_lock); 
+	if(!proc->p_vforked){
+		spinlock_release(&proc->p_lock); 
+		return false; 
+	}
+	proc->p_vforked = false; 
+	wchan_wakeall(proc->p_exitwchan, &proc->p_lock); // waitpid sleepers just recheck
+	spinlock_release(&proc->p_lock); 
+	return true; 
+}
+
+void vfork_wait(struct proc *child){
+	spinlock_acquire(&child->p_lock); 
+	while(child->p_vforked){
+		wchan_sleep(child->p_exitwchan, &child->p_lock); 
+	}
+	spinlock_release(&child->p_lock); 
+}
+
 struct trapframe *set_tf(struct trapframe *parent){
 	struct trapframe *child = kmalloc(sizeof(struct trapframe));
+	if(child == NULL){
+		return NULL; 
+	}
 	memcpy(child, parent, sizeof(struct trapframe));
+	child->tf_v0 = 0; // Child's fork returns 0...
+	child->tf_a3 = 0; // ...successfully
 	child->tf_epc += 4; // To move past the fork call
 	return child; 
 }
 
 void pid_table_init(){
 	pidTable = kmalloc(sizeof(struct pid_table)); 
-	pidTable->firstFreePid = 2; 
-	pidTable->plock = lock_create("pid_lock"); 
-	pidTable->pcv = cv_create("pid_cv"); 
-	for(int i = 2; i <= PID_MAX; i++){
-		pidTable->procs[i] = NULL;
+	if(pidTable == NULL){
+		panic("pid_table_init: out of memory\n"); 
+	}
+	bzero(pidTable, sizeof(struct pid_table)); 
+	pidTable->nextPid = PID_MIN; 
+	pidTable->prw = rwlock_create("pid_rwlock"); 
+	pidTable->procs[0] = kmalloc(PID_CHUNK * sizeof(struct proc *)); 
+	if(pidTable->prw == NULL || pidTable->procs[0] == NULL){
+		panic("pid_table_init: out of memory\n"); 
+	}
+	bzero(pidTable->procs[0], PID_CHUNK * sizeof(struct proc *)); 
+
+	/*Pids below PID_MIN are never handed out, nor are the bits past PID_MAX*/
+	for(pid_t i = 0; i < PID_MIN; i++){
+		markPid(i); 
+	}
+	for(unsigned i = PID_MAX + 1; i < PID_WORDS * 32; i++){
+		markPid(i); 
+	}
+	/*The last summary word may have bits for pidmap words that don't exist*/
+	for(unsigned w = PID_WORDS; w < PID_SUMWORDS * 32; w++){
+		pidTable->fullmap[w / 32] |= 1U << (w % 32); 
 	}
 
-	pidTable->procs[1] = kproc; 
+	pidTable->procs[0][1] = kproc; 
 	kproc->pid = 1; 
-	// pidTable->firstFreePid = 2; 
 }
 
 struct proc* proc_creator(const char *name){
@@ -471,39 +700,52 @@ struct proc* proc_creator(const char *name){
 }
 
 void proc_exit(struct proc* proc_to_exit, size_t exitcode){
-	int length = array_num(proc_to_exit->children); 
-	struct array *children = proc_to_exit->children; 
-	struct proc* master = pidTable->procs[1]; 
-	for(int i = 0; i < length; i++){
-			if ( (((struct proc *) array_get(children, i))->status == RUNNING) || ((((struct proc *) array_get(children, i))->status == ZOMBIE))) {
-				unsigned index_ret; 
-    			int ret = array_add(master->children, ((struct proc *) array_get(children, i)), &index_ret);
-				if(ret){
-					return ; // Stop the process if there was an error while adding to the array
-				}
-			}
+	struct proc *child; 
+
+	/*A vfork child hands the address space back before the parent runs on it*/
+	if(proc_to_exit->p_vforked){
+		spinlock_acquire(&proc_to_exit->p_lock); 
+		proc_to_exit->p_addrspace = NULL; 
+		spinlock_release(&proc_to_exit->p_lock); 
+		vfork_release(proc_to_exit); 
 	}
-	lock_acquire(pidTable->plock); 
+
+	/*Close our files; open files shared with other procs stay open for them*/
+	cleanup(proc_to_exit->ft); 
+	proc_to_exit->ft = NULL; 
+
+	/*
+	 * Everything happens under prw so a child can't decide whether
+	 * it's an orphan while we're in the middle of orphaning it.
+	 */
+	rwlock_acquire_write(pidTable->prw); 
+	while((child = proc_to_exit->p_children) != NULL){
+		unlinkChild(child); 
+		if(child->status == ZOMBIE){ // Nobody will wait for it now, reap it
+			child->status = AVAILABLE; 
+			freePid(child->pid); 
+		}
+	}
+
+	if(proc_to_exit->p_parent == NULL){ // Orphan, nobody will wait for us either
+		proc_to_exit->status = AVAILABLE; 
+		freePid(proc_to_exit->pid); 
+		rwlock_release_write(pidTable->prw); 
+		thread_exit();
+	}
+
+	spinlock_acquire(&proc_to_exit->p_lock); 
 	proc_to_exit->status = ZOMBIE; 
 	proc_to_exit->exitCode = exitcode;
-	cv_broadcast(pidTable->pcv, pidTable->plock); 
-	lock_release(pidTable->plock);
+	wchan_wakeall(proc_to_exit->p_exitwchan, &proc_to_exit->p_lock); 
+	spinlock_release(&proc_to_exit->p_lock);
+	rwlock_release_write(pidTable->prw); 
 	thread_exit();
 }
 
 // Determine if process is child of parent given child_pid
 int isChild(struct proc* parent, pid_t child_pid) {
-	lock_acquire(pidTable->plock); 
-	int length = array_num(parent->children);
-	for(int i = 0; i < length; i++) {
-		if(((struct proc *) array_get(parent->children, i))->pid == child_pid) {
-			lock_release(pidTable->plock); 
-			return 1;
-		}
-	}
-	lock_release(pidTable->plock); 
-	return 0;
-	
+	return getChild(parent, child_pid) != NULL; 
 }
 
 // Returns the status of the child process based on the parent process and child_pid
@@ -515,13 +757,14 @@ int getStatus(struct proc* parent, pid_t child_pid) {
 
 // Returns child of parent process given child_pid
 struct proc* getChild(struct proc *parent, pid_t child_pid) {
-	int length = array_num(parent->children);
-	for(int i = 0; i < length; i++) {
-		if(((struct proc *) array_get(parent->children, i))->pid == child_pid) {  // Ensure process is child of parent
-			return ((struct proc *) array_get(parent->children, i));
-		}
+	struct proc *child;
+	rwlock_acquire_read(pidTable->prw); 
+	child = pid_lookup(child_pid); 
+	if(child != NULL && child->p_parent != parent) {  // Ensure process is child of parent
+		child = NULL;
 	}
-	return NULL; 
+	rwlock_release_read(pidTable->prw); 
+	return child; 
 }
 
 // Free file properties of child process 
@@ -531,32 +774,35 @@ void clean_child_file(struct proc *parent, pid_t child_pid) {
 	cleanup(child->ft);
 }
 
-// Waits for process to finish execution and then reaps it depending on the canReap flag
-int proc_waitpid(pid_t pid, size_t *exitcode, int canReap){    
-
-	lock_acquire(pidTable->plock); 
-	int status = 0; 
-	status = pidTable->procs[pid]->status; 
+// Waits for process to finish execution and then reaps it
+int proc_waitpid(pid_t pid, int options, size_t *exitcode, pid_t *retpid){    
+	struct proc *child = pid_lookup(pid); 
+	KASSERT(child != NULL); 
+
+	spinlock_acquire(&child->p_lock); 
+	while(child->status != ZOMBIE) { // Sleep until the child itself announces its exit
+		if(options & WNOHANG){
+			spinlock_release(&child->p_lock); 
+			*retpid = 0; 
+			return 0; 
+		}
+		wchan_sleep(child->p_exitwchan, &child->p_lock); 
+	}
+	*exitcode = child->exitCode; 
+	spinlock_release(&child->p_lock); 
 
-    while(status != ZOMBIE) { // Wait until process has finished execution dependent on condition variable
-		cv_wait(pidTable->pcv, pidTable->plock); 
-		status = pidTable->procs[pid]->status; 
-    }
-	lock_release(pidTable->plock); 
+	rwlock_acquire_write(pidTable->prw); 
+	child->status = AVAILABLE; 
+	unlinkChild(child); 
+	freePid(pid); 
+	rwlock_release_write(pidTable->prw); 
 
-	if(canReap){
-		lock_acquire(pidTable->plock); 
-		pidTable->procs[pid]->status = AVAILABLE; 
-		*exitcode = pidTable->procs[pid]->exitCode; 
-		findFirstFreePid(); 
-		lock_release(pidTable->plock); 
-	}
-	
+	*retpid = pid; 
 	return 0; 
 }
 
 void proc_getpid(size_t *retval){
-	lock_acquire(pidTable->plock); 
+	rwlock_acquire_read(pidTable->prw); 
 	*retval = curproc->pid; 
-	lock_release(pidTable->plock); 
+	rwlock_release_read(pidTable->prw); 
 }
\ No newline at end of file
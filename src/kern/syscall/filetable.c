@@ -21,61 +21,204 @@
 // static struct fileTablePtr *ft; // The file table
 
 struct fileTablePtr* ft_init(void){
-    // struct fileTablePtr *ft; 
     struct fileTablePtr *ft = kmalloc(sizeof(struct fileTablePtr));
+    if(ft == NULL){
+        return NULL; 
+    }
 
-    ft->firstFreeSpot = 0; 
-    // ft = kmalloc(sizeof(struct fileTablePtr)); 
-    for (int i = 0; i < OPEN_MAX; i++){
-        ft->ftp[i] = kmalloc(sizeof(struct fte));  
-        ft->ftp[i]->flag = 0; // Initally all spots are open
-        ft->ftp[i]->file = 0; // Initially all vnode pointers are null
-        ft->ftp[i]->offset = 0; // Initially all offsets are 0
-        ft->ftp[i]->permissions = 0; // No permissions initially
-        ft->ftp[i]->fte_lock = lock_create("fte lock"); 
+    ft->ftp = kmalloc(FT_INITSLOTS * sizeof(struct fte *)); 
+    ft->usedmap = kmalloc(FT_WORDS(FT_INITSLOTS) * sizeof(uint32_t)); 
+    ft->ft_lock = lock_create("ft lock"); 
+    if(ft->ftp == NULL || ft->usedmap == NULL || ft->ft_lock == NULL){
+        if(ft->ftp != NULL) kfree(ft->ftp); 
+        if(ft->usedmap != NULL) kfree(ft->usedmap); 
+        if(ft->ft_lock != NULL) lock_destroy(ft->ft_lock); 
+        kfree(ft); 
+        return NULL; 
     }
+    for (int i = 0; i < FT_INITSLOTS; i++){
+        ft->ftp[i] = NULL; // Initally all spots are open
+    }
+    bzero(ft->usedmap, FT_WORDS(FT_INITSLOTS) * sizeof(uint32_t)); 
+    ft->nslots = FT_INITSLOTS; 
+    ft->firstFreeSpot = 0; 
 
     return ft; 
 }
 
-int addEntry(struct fileTablePtr *ft, int permissions, off_t offset, struct vnode* vn, int *errFlag, int *fd){ // UPDATE firstFreeSpot in this
-    if(ft->firstFreeSpot == -1){
+/*Double the number of slots until there are more than minfd, capped at OPEN_MAX. ft_lock must be held.*/
+static int growTable(struct fileTablePtr *ft, int minfd){
+    struct fte **newftp; 
+    uint32_t *newmap; 
+    int newslots = ft->nslots; 
+
+    if(minfd >= OPEN_MAX){
+        return EMFILE; 
+    }
+    while(newslots <= minfd){
+        newslots *= 2; 
+    }
+    if(newslots > OPEN_MAX){
+        newslots = OPEN_MAX; 
+    }
+
+    newftp = kmalloc(newslots * sizeof(struct fte *)); 
+    if(newftp == NULL){
+        return ENOMEM; 
+    }
+    newmap = kmalloc(FT_WORDS(newslots) * sizeof(uint32_t)); 
+    if(newmap == NULL){
+        kfree(newftp); 
+        return ENOMEM; 
+    }
+    for(int i = 0; i < newslots; i++){
+        newftp[i] = (i < ft->nslots) ? ft->ftp[i] : NULL; 
+    }
+    for(int w = 0; w < FT_WORDS(newslots); w++){
+        newmap[w] = (w < FT_WORDS(ft->nslots)) ? ft->usedmap[w] : 0; 
+    }
+    kfree(ft->ftp); 
+    kfree(ft->usedmap); 
+    ft->ftp = newftp; 
+    ft->usedmap = newmap; 
+    ft->nslots = newslots; 
+    return 0; 
+}
+
+/*
+ * Find the lowest free slot, growing the table if there isn't one.
+ * Only looks at whole words of the bitmap starting from the word
+ * holding firstFreeSpot, since nothing below that is free.
+ * ft_lock must be held.
+ */
+static int findFreeSlot(struct fileTablePtr *ft, int *fd){
+    int nwords = FT_WORDS(ft->nslots); 
+    int w = ft->firstFreeSpot / 32; 
+    uint32_t used = 0xffffffff; 
+    int bit, result; 
+
+    if(w < nwords){
+        used = ft->usedmap[w] | ((1U << (ft->firstFreeSpot % 32)) - 1); 
+    }
+    while(used == 0xffffffff && ++w < nwords){
+        used = ft->usedmap[w]; 
+    }
+    if(w < nwords){
+        for(bit = 0; used & (1U << bit); bit++); // At most 31 steps, on a word known to have a 0
+        if(w * 32 + bit < ft->nslots){
+            *fd = w * 32 + bit; 
+            return 0; 
+        }
+    }
+
+    /*Every slot is taken, so the first new one is the lowest free*/
+    *fd = ft->nslots; 
+    result = growTable(ft, ft->nslots); 
+    if(result){
+        return result; 
+    }
+    return 0; 
+}
+
+/*Create an open file with one reference*/
+static struct fte *fte_create(int permissions, int flags, struct vnode *vn){
+    struct fte *entry = kmalloc(sizeof(struct fte)); 
+    if(entry == NULL){
+        return NULL; 
+    }
+    entry->fte_lock = lock_create("fte lock"); 
+    if(entry->fte_lock == NULL){
+        kfree(entry); 
+        return NULL; 
+    }
+    entry->file = vn; 
+    entry->offset = 0; 
+    bzero(&entry->ra, sizeof(entry->ra)); 
+    entry->permissions = permissions; 
+    entry->flags = flags; 
+    entry->refcount = 1; 
+    return entry; 
+}
+
+static void fte_incref(struct fte *entry){
+    lock_acquire(entry->fte_lock); 
+    entry->refcount++; 
+    lock_release(entry->fte_lock); 
+}
+
+/*Drop a reference, closing the file if it was the last one*/
+static void fte_decref(struct fte *entry){
+    int last; 
+
+    lock_acquire(entry->fte_lock); 
+    KASSERT(entry->refcount > 0); 
+    entry->refcount--; 
+    last = (entry->refcount == 0); 
+    lock_release(entry->fte_lock); 
+
+    if(last){
+        vfs_close(entry->file); 
+        lock_destroy(entry->fte_lock); 
+        kfree(entry); 
+    }
+}
+
+/*Put an entry (whose reference the caller passes on) in slot fd, which must be free and within the table. ft_lock must be held.*/
+static void placeEntry(struct fileTablePtr *ft, int fd, struct fte *entry){
+    KASSERT(ft->ftp[fd] == NULL); 
+    ft->ftp[fd] = entry; 
+    ft->usedmap[fd / 32] |= 1U << (fd % 32); 
+    if(fd == ft->firstFreeSpot){
+        ft->firstFreeSpot = fd + 1; // Lower bound; findFreeSlot skips past used ones
+    }
+}
+
+/*Take the entry out of slot fd, returning it. ft_lock must be held.*/
+static struct fte *removeEntry(struct fileTablePtr *ft, int fd){
+    struct fte *entry = ft->ftp[fd]; 
+
+    ft->ftp[fd] = NULL; // Spot is free
+    ft->usedmap[fd / 32] &= ~(1U << (fd % 32)); 
+    if(fd < ft->firstFreeSpot){
+        ft->firstFreeSpot = fd; 
+    }
+    return entry; 
+}
+
+int addEntry(struct fileTablePtr *ft, int permissions, int flags, struct vnode* vn, int *errFlag, int *fd){
+    struct fte *entry; 
+    int result; 
+
+    entry = fte_create(permissions, flags, vn); 
+    if(entry == NULL){
         *errFlag = 1; 
         return ENOMEM; 
     }
-    lock_acquire(ft->ftp[ft->firstFreeSpot]->fte_lock);
-    ft->ftp[ft->firstFreeSpot]->flag = 1; // Change flag to 1 to indicate position occupied
-    ft->ftp[ft->firstFreeSpot]->file = vn; // Assign the file in argument to that spot's file field
-    ft->ftp[ft->firstFreeSpot]->offset = offset; // Change the offset of that spot
-    ft->ftp[ft->firstFreeSpot]->permissions = permissions; // Change the permissions
-    *fd = ft->firstFreeSpot; // fd points to the spot obtained
-    lock_release(ft->ftp[ft->firstFreeSpot]->fte_lock);
-    findFirstFreeSpot(ft); // Update firstFreeSpot
+
+    lock_acquire(ft->ft_lock); 
+    result = findFreeSlot(ft, fd); // fd points to the spot obtained
+    if(result){
+        lock_release(ft->ft_lock); 
+        lock_destroy(entry->fte_lock); 
+        kfree(entry); 
+        *errFlag = 1; 
+        return result; 
+    }
+    placeEntry(ft, *fd, entry); 
+    lock_release(ft->ft_lock); 
     return 0; 
 } 
 
 /*This method is almost identical to addEntry, only difference is the fd is given (0, 1, 2) and does not need to be returned/updated.*/
-void addIoEntry(struct fileTablePtr *ft, int permissions, struct vnode* vn, int fd){
-    lock_acquire(ft->ftp[fd]->fte_lock);
-    ft->ftp[fd]->flag = 1; 
-    ft->ftp[fd]->file = vn; 
-    ft->ftp[fd]->offset = 0; 
-    ft->ftp[fd]->permissions = permissions;
-    lock_release(ft->ftp[fd]->fte_lock);  
-    findFirstFreeSpot(ft);
-}
-
-void findFirstFreeSpot(struct fileTablePtr *ft){
-    for(int i = 3; i < OPEN_MAX; i++){
-        lock_acquire(ft->ftp[i]->fte_lock);
-        if(ft->ftp[i]->flag == 0){ // Find the earliest entry which is unoccupied. 
-            ft->firstFreeSpot = i;
-            lock_release(ft->ftp[i]->fte_lock); 
-            return; 
-        }
-        lock_release(ft->ftp[i]->fte_lock);
+int addIoEntry(struct fileTablePtr *ft, int permissions, struct vnode* vn, int fd){
+    struct fte *entry = fte_create(permissions, 0, vn); 
+    if(entry == NULL){
+        return ENOMEM; 
     }
-    ft->firstFreeSpot = -1; // If no free spots, set it to -1 to indicate that
+    lock_acquire(ft->ft_lock); 
+    placeEntry(ft, fd, entry); 
+    lock_release(ft->ft_lock); 
+    return 0; 
 }
 
 int stdio_init(struct fileTablePtr *ft){
@@ -91,103 +234,181 @@ int stdio_init(struct fileTablePtr *ft){
     if(result){
         return result; 
     }
-    addIoEntry(ft, 1, stdin_vnode, 0); 
+    result = addIoEntry(ft, 1, stdin_vnode, 0); 
+    if(result){
+        return result; 
+    }
 
     result = vfs_open(kstrdup(std), O_WRONLY, 0, &stdout_vnode); // Point to stdout vnode
     if(result){
         return result; 
     } 
-    addIoEntry(ft, 2, stdout_vnode, 1);
+    result = addIoEntry(ft, 2, stdout_vnode, 1);
+    if(result){
+        return result; 
+    }
 
     result = vfs_open(kstrdup(std), O_WRONLY, 0, &stderr_vnode); // Point to err vnode
     if(result){
         return result; 
     }
-    addIoEntry(ft, 2, stderr_vnode, 2); 
+    result = addIoEntry(ft, 2, stderr_vnode, 2); 
+    if(result){
+        return result; 
+    }
 
     return 0; 
 }
 
 struct fte *getEntry(struct fileTablePtr *ft, int fd){ 
-    return ft->ftp[fd]; // Get the entry at the specified fd
+    struct fte *entry = NULL; 
+
+    lock_acquire(ft->ft_lock); 
+    if(fd >= 0 && fd < ft->nslots){
+        entry = ft->ftp[fd]; // Get the entry at the specified fd
+    }
+    lock_release(ft->ft_lock); 
+    return entry; 
 }
 
-void clean_fd(struct fileTablePtr *ft, int fd){
-    lock_acquire(ft->ftp[fd]->fte_lock);
-    ft->ftp[fd]->flag = 0; // Set flag to 0 to indicate spot is free
-    ft->ftp[fd]->file = 0; // Change the file pointer to NULL
-    ft->ftp[fd]->offset = 0; // Reset offset
-    ft->ftp[fd]->permissions = 0; // Reset permissions
-    lock_release(ft->ftp[fd]->fte_lock);
-    findFirstFreeSpot(ft); // Update firstFreeSpot since fd might be before firstFreeSpot
+int clean_fd(struct fileTablePtr *ft, int fd){
+    struct fte *entry = NULL; 
+
+    lock_acquire(ft->ft_lock); 
+    if(fd >= 0 && fd < ft->nslots && ft->ftp[fd] != NULL){
+        entry = removeEntry(ft, fd); 
+    }
+    lock_release(ft->ft_lock); 
+
+    if(entry == NULL){
+        return EBADF; 
+    }
+    fte_decref(entry); // Outside ft_lock, since closing the file can take a while
+    return 0; 
 }
 
 /*This method is used to check whether the given fd is valid and has read or write permissions*/
 int isValid(struct fileTablePtr *ft, int fd){
-    lock_acquire(ft->ftp[fd]->fte_lock);
-    if((ft->ftp[fd]->flag == 1) && ((ft->ftp[fd]->permissions == 1) || ft->ftp[fd]->permissions == 3)) {
-        lock_release(ft->ftp[fd]->fte_lock);
+    struct fte *entry = getEntry(ft, fd); 
+    if(entry == NULL){
+        return 0; 
+    }
+    lock_acquire(entry->fte_lock);
+    if((entry->permissions == 1) || entry->permissions == 3) {
+        lock_release(entry->fte_lock);
         return 1;    
     }
 
-    lock_release(ft->ftp[fd]->fte_lock);
+    lock_release(entry->fte_lock);
     return 0;
 }
 
-/*This method is used to duplicate an existing entry*/
+/*This method is used to duplicate an existing entry, closing whatever was at newfd.
+Both descriptors share the one open file, offset included.*/
 int addDupEntry(struct fileTablePtr *ft, int oldfd, int newfd, size_t *retval){
-    lock_acquire(ft->ftp[oldfd]->fte_lock);
+    struct fte *old, *replaced = NULL; 
+    int result; 
+
+    lock_acquire(ft->ft_lock); 
+    old = (oldfd >= 0 && oldfd < ft->nslots) ? ft->ftp[oldfd] : NULL; 
+    if(old == NULL){ // oldfd is invalid if its unoccupied
+        lock_release(ft->ft_lock); 
+        return EBADF;
+    }
     if(oldfd == newfd){ // If old fd is same as new, retval points to newfd and return 0 to indicate success
+        lock_release(ft->ft_lock); 
         *retval = newfd; 
-        lock_release(ft->ftp[oldfd]->fte_lock);
         return 0; 
     }
 
-    if(ft->ftp[oldfd]->flag == 0){ // oldfd is invalid if its unoccupied
-        lock_release(ft->ftp[oldfd]->fte_lock);
-        return EBADF;
+    if(newfd >= ft->nslots){
+        result = growTable(ft, newfd); 
+        if(result){
+            lock_release(ft->ft_lock); 
+            return result; 
+        }
     }
-    if(ft->firstFreeSpot == -1){ // Global limit on open files reached
-        lock_release(ft->ftp[oldfd]->fte_lock);
-        return ENFILE;
+    if(ft->ftp[newfd] != NULL){
+        replaced = removeEntry(ft, newfd); 
     }
-    lock_release(ft->ftp[oldfd]->fte_lock);
-
-    /*Lines 134-136 are just used to point the fields of newfd to oldfd*/
-    lock_acquire(ft->ftp[newfd]->fte_lock);
-    ft->ftp[newfd]->permissions = ft->ftp[oldfd]->permissions;
-    ft->ftp[newfd]->file = ft->ftp[oldfd]->file;
-    ft->ftp[newfd]->offset = ft->ftp[oldfd]->offset;
-    ft->ftp[newfd]->flag = 1; // newfd is now occupied
+    fte_incref(old); 
+    placeEntry(ft, newfd, old); 
+    lock_release(ft->ft_lock); 
 
+    if(replaced != NULL){
+        fte_decref(replaced); 
+    }
     *retval = newfd; // Update retval to point to newfd
-    lock_release(ft->ftp[newfd]->fte_lock);
+    return 0; // Return 0 to indicate success
+}
 
-    findFirstFreeSpot(ft); // Update firstFreeSpot
+/*Make dst's newfd refer to the same open file as src's oldfd, closing
+whatever dst had there. This is dup2 across two tables, for spawn.*/
+int dupAcross(struct fileTablePtr *src, int oldfd, struct fileTablePtr *dst, int newfd){
+    struct fte *old, *replaced = NULL; 
+    int result; 
 
-    return 0; // Return 0 to indicate success
+    lock_acquire(src->ft_lock); 
+    old = (oldfd >= 0 && oldfd < src->nslots) ? src->ftp[oldfd] : NULL; 
+    if(old == NULL){
+        lock_release(src->ft_lock); 
+        return EBADF; 
+    }
+    fte_incref(old); 
+    lock_release(src->ft_lock); 
+
+    lock_acquire(dst->ft_lock); 
+    if(newfd >= dst->nslots){
+        result = growTable(dst, newfd); 
+        if(result){
+            lock_release(dst->ft_lock); 
+            fte_decref(old); 
+            return result; 
+        }
+    }
+    if(dst->ftp[newfd] != NULL){
+        replaced = removeEntry(dst, newfd); 
+    }
+    placeEntry(dst, newfd, old); 
+    lock_release(dst->ft_lock); 
+
+    if(replaced != NULL){
+        fte_decref(replaced); 
+    }
+    return 0; 
 }
 
-/*Create file table entries for child proc after forking*/
-struct fileTablePtr* fork_ft(struct fileTablePtr *parent, struct fileTablePtr *child_ft){
-    for(int i = 0; i < OPEN_MAX; i++){
-        lock_acquire(parent->ftp[i]->fte_lock);
-        lock_acquire(child_ft->ftp[i]->fte_lock);
-        if(parent->ftp[i]->flag == 1){
-            child_ft->ftp[i] = parent->ftp[i]; 
-        }  
-        lock_release(parent->ftp[i]->fte_lock);
-        lock_release(child_ft->ftp[i]->fte_lock);        
+/*Give the child the same open files as the parent; they share offsets*/
+int fork_ft(struct fileTablePtr *parent, struct fileTablePtr *child_ft){
+    int result = 0; 
+
+    lock_acquire(parent->ft_lock); 
+    lock_acquire(child_ft->ft_lock); 
+    if(child_ft->nslots < parent->nslots){
+        result = growTable(child_ft, parent->nslots - 1); 
+    }
+    if(result == 0){
+        for(int i = 0; i < parent->nslots; i++){
+            if(parent->ftp[i] != NULL){
+                fte_incref(parent->ftp[i]); 
+                placeEntry(child_ft, i, parent->ftp[i]); 
+            }
+        }
+        child_ft->firstFreeSpot = parent->firstFreeSpot; 
     }
-    findFirstFreeSpot(child_ft); 
-    return child_ft; 
+    lock_release(child_ft->ft_lock); 
+    lock_release(parent->ft_lock); 
+    return result; 
 }
 
 void cleanup(struct fileTablePtr *ft){
-    for(int i = 0; i < OPEN_MAX; i++){
-        lock_destroy(ft->ftp[i]->fte_lock);
-        kfree(ft->ftp[i]);
-        ft->ftp[i] = NULL; 
+    for(int i = 0; i < ft->nslots; i++){
+        if(ft->ftp[i] != NULL){
+            fte_decref(ft->ftp[i]); 
+        }
     }
+    lock_destroy(ft->ft_lock); 
+    kfree(ft->usedmap); 
+    kfree(ft->ftp); 
     kfree(ft); 
-}
\ No newline at end of file
+}
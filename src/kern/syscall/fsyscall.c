@@ -57,16 +57,18 @@ int sys_open(const char *filename, int flags, mode_t mode, size_t* retval){
     /*ret stores the actualy file address*/
     struct vnode *ret; 
     int opened = vfs_open(dest, flags, mode, &ret); 
+    kfree(dest); 
 
     if(opened != 0){
         return opened; // If opened is not 0, that means there was an error while in vfs_open so return the error code
     }
     
     /*Add the entry to the filetable*/
-    int result = addEntry(curproc->ft ,permissions, 0, ret, &errFlag, &fd);
+    int result = addEntry(curproc->ft ,permissions, flags, ret, &errFlag, &fd);
 
     /*If the errFlag was raised by addEntry, there is an error. Return the error*/
     if(errFlag){
+        vfs_close(ret); 
         return result; 
     }
 
@@ -79,104 +81,184 @@ int sys_open(const char *filename, int flags, mode_t mode, size_t* retval){
 
 
 int sys_close(int fd) {
-    struct fte* entry = getEntry(curproc->ft, fd);
-    lock_acquire(entry->fte_lock);
-    if(check_fd(fd) == 0 || entry->flag == 0) {  // Verify fd is valid and not already closed
-        lock_release(entry->fte_lock);
+    if(check_fd(fd) == 0) {  // Verify fd is valid
         return EBADF;
     } 
-    lock_release(entry->fte_lock);
-    clean_fd(curproc->ft, fd);   // Clean fields of fd
-    
-    return 0;
+    return clean_fd(curproc->ft, fd);   // EBADF if it's already closed
 }
 
-int sys_write(int fd, const void *buf, size_t nbytes, size_t *retVal) {
-    if(check_fd(fd) == 0 || getEntry(curproc->ft, fd)->file == NULL) {   // Verify fd is valid and file exists
+/*
+ * Common code for read, write, pread, pwrite, readv and writev. ui
+ * describes the user buffers; its offset is filled in here. With
+ * usepos, the I/O happens at pos and the open file's offset is
+ * neither used nor changed, so the fte lock isn't needed and
+ * positional I/O on a shared file doesn't serialize. Only I/O at the
+ * file's offset gets the open file's read-ahead state, since that's
+ * what the fte lock protects and what sequential readers use.
+ */
+static int file_io(int fd, struct uio *ui, bool usepos, off_t pos, size_t *retVal) {
+    struct fte *entry;
+    size_t len = ui->uio_resid;
+    int result;
+
+    if(check_fd(fd) == 0 || (entry = getEntry(curproc->ft, fd)) == NULL) {   // Verify fd is valid and file exists
         return EBADF;
     }
 
-    struct fte *entry = getEntry(curproc->ft, fd);
-    lock_acquire(entry->fte_lock);
-
-    if(entry->permissions == 1) {  // Verify that fd was opened with write permissions
-        lock_release(entry->fte_lock);
+    /*Verify that fd was opened with read or write permissions as needed*/
+    if(ui->uio_rw == UIO_READ && entry->permissions == 2) {
+        return EBADF;
+    }
+    if(ui->uio_rw == UIO_WRITE && entry->permissions == 1) {
         return EBADF;
     }
 
-    if(buf == NULL) {   // Buf is invalid
-        lock_release(entry->fte_lock);
-        return EFAULT;
+    if(usepos) {
+        if(!VOP_ISSEEKABLE(entry->file)) {
+            return ESPIPE;
+        }
+        if(pos < 0) {
+            return EINVAL;
+        }
+        ui->uio_offset = pos;
+        result = (ui->uio_rw == UIO_READ) ? VOP_READ(entry->file, ui) : VOP_WRITE(entry->file, ui);
+        if(result) {
+            return result;
+        }
+        *retVal = len - ui->uio_resid;
+        return 0;
     }
 
-    int result;                // Store result of write operations
-    struct iovec iov;        // I/O vector to to describe memory buffer
-    struct uio ui;          // Manage write operations
+    lock_acquire(entry->fte_lock);
 
-    iov.iov_ubase = (userptr_t)buf;   // Base address of buffer
-    iov.iov_len = nbytes;           // Set length of buffer
+    if(ui->uio_rw == UIO_WRITE && (entry->flags & O_APPEND)) {   // Appends always go at the current end of file
+        struct stat st;
+        result = VOP_STAT(entry->file, &st);
+        if(result) {
+            lock_release(entry->fte_lock);
+            return result;
+        }
+        entry->offset = st.st_size;
+    }
 
-    ui.uio_iov = &iov;              
-    ui.uio_iovcnt = 1;              // Num of I/O vectors
-    ui.uio_offset = entry->offset;  // Offset in file
-    ui.uio_resid = nbytes;          // Remaining bytes to write
-    ui.uio_segflg = UIO_USERSPACE;  // Buffer is in user space
-    ui.uio_rw = UIO_WRITE;         // Write operation
-    ui.uio_space = proc_getas();   // Address space of current process
-
-    result = VOP_WRITE(entry->file, &ui);    // Write operation using VOP
+    ui->uio_offset = entry->offset;  // Offset in file
+    ui->uio_ra = &entry->ra;         // Let the fs detect sequential reads
+    result = (ui->uio_rw == UIO_READ) ? VOP_READ(entry->file, ui) : VOP_WRITE(entry->file, ui);
     if(result) {
         lock_release(entry->fte_lock);
         return result;
     }
 
-    off_t bytes_written = (off_t)(nbytes - ui.uio_resid);   // Number of bytes written
-    entry->offset += bytes_written;
-
-    *retVal = (size_t) bytes_written;   // Return number of bytes written
+    entry->offset += (off_t)(len - ui->uio_resid);   // In case not all of it was done, account for the residual
+    *retVal = len - ui->uio_resid;   // Return number of bytes transferred
     lock_release(entry->fte_lock);
     return 0;
 }
 
+/*Set up a uio for one user buffer*/
+static void user_uio(struct iovec *iov, struct uio *ui, void *buf, size_t len, enum uio_rw rw) {
+    iov->iov_ubase = (userptr_t)buf;   // Base address of buffer
+    iov->iov_len = len;              // Set length of buffer
+
+    ui->uio_iov = iov;              
+    ui->uio_iovcnt = 1;              // Num of I/O vectors
+    ui->uio_offset = 0;              // Set by file_io
+    ui->uio_resid = len;             // Remaining bytes to transfer
+    ui->uio_segflg = UIO_USERSPACE;  // Buffer is in user space
+    ui->uio_rw = rw;
+    ui->uio_space = proc_getas();    // Address space of current process
+    ui->uio_ra = NULL;               // Set by file_io
+}
 
-int sys_read(int fd, void *buf, size_t buflen, size_t *retVal){ // RETURN TYPE SHOULD BE ssize_t
-    
+int sys_write(int fd, const void *buf, size_t nbytes, size_t *retVal) {
+    struct iovec iov;        // I/O vector to to describe memory buffer
+    struct uio ui;          // Manage write operations
 
-    if(check_fd(fd) == 0 || !isValid(curproc->ft, fd)){
-        return EBADF;
+    if(buf == NULL) {   // Buf is invalid
+        return check_fd(fd) && getEntry(curproc->ft, fd) != NULL ? EFAULT : EBADF;
     }
+    user_uio(&iov, &ui, (void *)buf, nbytes, UIO_WRITE);
+    return file_io(fd, &ui, false, 0, retVal);
+}
+
+
+int sys_read(int fd, void *buf, size_t buflen, size_t *retVal){ // RETURN TYPE SHOULD BE ssize_t
+    struct iovec iov; 
+    struct uio ui; 
 
     if(!buf){
-        return EFAULT; 
+        return check_fd(fd) && getEntry(curproc->ft, fd) != NULL ? EFAULT : EBADF; 
     }
+    user_uio(&iov, &ui, buf, buflen, UIO_READ);
+    return file_io(fd, &ui, false, 0, retVal);
+}
 
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, size_t *retVal){
+    struct iovec iov; 
+    struct uio ui; 
+
+    user_uio(&iov, &ui, buf, buflen, UIO_READ);
+    return file_io(fd, &ui, true, pos, retVal);
+}
+
+int sys_pwrite(int fd, const void *buf, size_t nbytes, off_t pos, size_t *retVal){
     struct iovec iov; 
     struct uio ui; 
-    struct fte *entry = getEntry(curproc->ft, fd);
 
-    lock_acquire(entry->fte_lock); 
+    user_uio(&iov, &ui, (void *)buf, nbytes, UIO_WRITE);
+    return file_io(fd, &ui, true, pos, retVal);
+}
 
-    iov.iov_ubase = (userptr_t) buf; // User buffer
-    iov.iov_len = buflen;        // Length of the buffer
-    ui.uio_iov = &iov;           // Iovec structure
-    ui.uio_iovcnt = 1;           // One iovec
-    ui.uio_resid = buflen;       // Remaining amount to read
-    ui.uio_offset = entry->offset; // Current file offset
-    ui.uio_segflg = UIO_USERSPACE; // User space memory
-    ui.uio_rw = UIO_READ;         // Reading operation
-    ui.uio_space = proc_getas();  // Address space of the current process
+/*
+ * readv and writev: copy in the user's iovec array in one go and hand
+ * the whole thing to the file system as a single multi-iovec uio.
+ */
+static int sys_vio(int fd, const struct iovec *uiov, int iovcnt, enum uio_rw rw, size_t *retVal){
+    struct iovec *iov; 
+    struct uio ui; 
+    size_t total = 0; 
+    int result; 
 
-    int result = VOP_READ(entry->file, &ui);
+    if(iovcnt <= 0 || iovcnt > IOV_MAX){
+        return EINVAL; 
+    }
+    iov = kmalloc(iovcnt * sizeof(struct iovec)); 
+    if(iov == NULL){
+        return ENOMEM; 
+    }
+    result = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(struct iovec)); 
     if(result){
-        lock_release(entry->fte_lock);
+        kfree(iov); 
         return result; 
     }
+    for(int i = 0; i < iovcnt; i++){
+        if(iov[i].iov_len > ((size_t)-1 >> 1) - total){ // Total must fit in an ssize_t return value
+            kfree(iov); 
+            return EINVAL; 
+        }
+        total += iov[i].iov_len; 
+    }
 
-    entry->offset = entry->offset + (off_t)((buflen - ui.uio_resid)); // In case all of buflen wasn't read, need to account for the residual 
+    ui.uio_iov = iov; 
+    ui.uio_iovcnt = iovcnt; 
+    ui.uio_offset = 0; 
+    ui.uio_resid = total; 
+    ui.uio_segflg = UIO_USERSPACE; 
+    ui.uio_rw = rw; 
+    ui.uio_space = proc_getas(); 
+    ui.uio_ra = NULL; 
+
+    result = file_io(fd, &ui, false, 0, retVal); 
+    kfree(iov); 
+    return result; 
+}
 
-    *retVal = (buflen - ui.uio_resid);
-    lock_release(entry->fte_lock); 
-    return 0; 
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, size_t *retVal){
+    return sys_vio(fd, iov, iovcnt, UIO_READ, retVal); 
+}
+
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, size_t *retVal){
+    return sys_vio(fd, iov, iovcnt, UIO_WRITE, retVal); 
 }
 
 int sys_lseek(int fd, off_t pos, int whence, size_t *retValUpper, size_t *retValLower) {
@@ -184,7 +266,7 @@ int sys_lseek(int fd, off_t pos, int whence, size_t *retValUpper, size_t *retVal
         return EINVAL;
     }
 
-    if(check_fd(fd) == 0 || getEntry(curproc->ft, fd)->file == NULL) {   //Check if valid fd
+    if(check_fd(fd) == 0 || getEntry(curproc->ft, fd) == NULL) {   //Check if valid fd
         return EBADF;
     }
 
@@ -248,25 +330,7 @@ int sys_dup2(int oldfd, int newfd, size_t *retval){
         return EBADF; 
     }
     
-    /*If oldfd is equal to newfd, point retval to newfd and return 0 to indicate success*/
-    if(oldfd == newfd){
-        *retval = newfd; 
-        return 0; 
-    }
-    
-    /*Get current entry at newfd*/
-    struct fte *currEntry = getEntry(curproc->ft, newfd); 
-    
-    lock_acquire(currEntry->fte_lock);
-
-    /*If current entry occupied, close it*/
-    if(currEntry->flag == 1){
-        lock_release(currEntry->fte_lock);
-        sys_close(newfd); 
-    }
-    
-    lock_release(currEntry->fte_lock);
-    /*Duplicate the entry. If addDupEntry returns non zero value, that indicates an error, so return it*/
+    /*Duplicate the entry, closing newfd if it's open. If addDupEntry returns non zero value, that indicates an error, so return it*/
     int result = addDupEntry(curproc->ft, oldfd, newfd, retval); 
     if(result){
         return result; 
@@ -327,6 +391,7 @@ int sys__getcwd(char *buf, size_t buflen, size_t *retVal) {
     ui.uio_segflg = UIO_USERSPACE;   // Buffer is in user space
     ui.uio_rw = UIO_READ;            // Operation is read
     ui.uio_space = proc_getas();     // Get address space of current process
+    ui.uio_ra = NULL;                // Not a file read
 
     int result = vfs_getcwd(&ui);    // Get current working directory
 
@@ -345,4 +410,20 @@ int check_fd(int fd) {
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Pass an ioctl through to whatever the descriptor refers to. The
+ * meaning of data depends on the operation, so the object checks it.
+ */
+int sys_ioctl(int fd, int code, userptr_t data) {
+    if(check_fd(fd) == 0 || getEntry(curproc->ft, fd) == NULL) {
+        return EBADF;
+    }
+    return VOP_IOCTL(getEntry(curproc->ft, fd)->file, code, data);
+}
+
+/*Write out everything cached for every mounted filesystem*/
+int sys_sync(void) {
+    return vfs_sync();
+}
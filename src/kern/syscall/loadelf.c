@@ -102,6 +102,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
+	u.uio_ra = NULL;
 
 	result = VOP_READ(v, &u);
 	if (result) {
@@ -14,6 +14,8 @@
 #include <addrspace.h>
 #include <proc.h>
 #include <syscall.h>
+#include <kern/wait.h>
+#include <kern/spawn.h>
 
 
 #define AVAILABLE 1
@@ -31,25 +33,77 @@ sys_fork(struct trapframe *tf, size_t *retVal) {
 
 	const char *childName = "childProc"; 
     childProc = proc_creator(childName); // proc_create will init and malloc child's file table
+    if(childProc == NULL){
+        return ENOMEM; 
+    }
 	ret = fork_proc(childProc);
 
     if(ret){ // fork_proc failed
+        proc_destroy(childProc);
         return ret; 
     }
 
 	child_tf = set_tf(tf); 
+	if(child_tf == NULL){
+		removePidEntry(childProc);
+		proc_destroy(childProc);
+		return ENOMEM;
+	}
 
 	*retVal = childProc->pid;
 	ret = thread_fork("childProc", childProc, exec_usermode, child_tf, 1);
 	if (ret) {// Destroy proc if error in thread_fork
+		removePidEntry(childProc);
 		proc_destroy(childProc);
-		kfree(tf);
+		kfree(child_tf);
 		return ret;
 	}
 
 	return 0;
 }
 
+/*Driver code for vfork(): the child runs on our address space until it
+execs or exits, and we don't return until it has*/
+int
+sys_vfork(struct trapframe *tf, size_t *retVal) {
+    struct proc *childProc;
+    struct trapframe *child_tf;
+    int ret;
+
+    childProc = proc_creator("childProc");
+    if(childProc == NULL){
+        return ENOMEM;
+    }
+    ret = vfork_proc(childProc);
+    if(ret){
+        proc_destroy(childProc);
+        return ret;
+    }
+
+    child_tf = set_tf(tf);
+    if(child_tf == NULL){
+        ret = ENOMEM;
+        goto fail;
+    }
+
+    *retVal = childProc->pid;
+    ret = thread_fork("childProc", childProc, exec_usermode, child_tf, 1);
+    if(ret){
+        kfree(child_tf);
+        goto fail;
+    }
+
+    vfork_wait(childProc);
+    return 0;
+
+fail:
+    /*The child never ran; don't let proc_destroy free our address space*/
+    vfork_release(childProc);
+    childProc->p_addrspace = NULL;
+    removePidEntry(childProc);
+    proc_destroy(childProc);
+    return ret;
+}
 
 void
 exec_usermode(void *data1, unsigned long data2) {
@@ -69,18 +123,18 @@ int sys_getpid(size_t *retval){
 
 /*Driver for waitpid*/
 int 
-sys_waitpid(pid_t pid, int *retVal, int options) {
+sys_waitpid(pid_t pid, int *retVal, int options, size_t *retpid) {
 
     size_t exitcode = 0; 
-    if(options != 0) {
+    pid_t reaped = 0; 
+    if((options & ~WNOHANG) != 0) {
         return EINVAL;
     }
-    int canReap = 0; 
-    if(retVal) canReap = 1; 
+    /*Check the status pointer before reaping, so a bad one doesn't lose the status*/
     if(retVal != NULL){
 		int ret = copyout(&exitcode, (userptr_t) retVal, sizeof(int32_t));
 		if (ret){
-			canReap = 0; 
+			return ret; 
 		}
 	}
 
@@ -90,10 +144,14 @@ sys_waitpid(pid_t pid, int *retVal, int options) {
         return ECHILD;
     }
 
-    int err = proc_waitpid(pid, &exitcode, canReap); 
+    int err = proc_waitpid(pid, options, &exitcode, &reaped); 
     if(err){
         return err; 
     }
+    *retpid = reaped; 
+    if(reaped == 0){ // WNOHANG and the child is still running
+        return 0; 
+    }
 
     if(retVal != NULL){
 		int ret = copyout(&exitcode, (userptr_t) retVal, sizeof(int32_t));
@@ -110,285 +168,334 @@ void sys__exit(size_t exitcode){
     proc_exit(curproc, exitcode);
 }
 
-/*Get length of string, including the null terminator*/
-int getLen(char *arg_string, int *len){
-    int index = 0; 
-    // char c = arg_string[index]; 
-
-    char c; 
-    int err = copyin((const_userptr_t)&arg_string[index], (void *) &c, (size_t) sizeof(char));
-    if(err){
-        return err; 
+/*
+ * execv argument marshalling.
+ *
+ * Everything goes through one ARG_MAX-sized kernel buffer. The user's
+ * argv array is read ARGCHUNK pointers per copyin (never crossing a
+ * page, so a chunk can't fault past the terminating NULL), and each
+ * string is copyinstr'd straight to the end of the strings packed so
+ * far, using the length it reports. The argv array for the new image
+ * is then built in the same buffer right after the strings, and the
+ * whole lot goes onto the new user stack with one copyout.
+ */
+#define ARGCHUNK 64
+
+/*Room left for the next string: keep space for its argv slot, the NULL
+slot, and up to 3 bytes of padding in front of the argv array*/
+static size_t argRoom(size_t strbytes, int argc){
+    size_t reserve = (argc + 2) * sizeof(vaddr_t) + sizeof(vaddr_t) - 1;
+
+    if(strbytes + reserve >= ARG_MAX){
+        return 0;
     }
-    while(c && index < ARG_MAX){
-        index++; 
-        int err = copyin((const_userptr_t)&arg_string[index], (void *) &c, (size_t) sizeof(char));
-        if(err){
-            return err; 
-        }
-    }
-
-    if(c){
-        return E2BIG; 
-    }
-
-    *len = index + 1; 
-    return 0; 
+    return ARG_MAX - strbytes - reserve;
 }
 
+/*Copy the argument strings into kbuf; return the count and bytes used*/
+static int gatherArgs(char **args, char *kbuf, int *total_args, size_t *strbytes){
+    userptr_t chunk[ARGCHUNK];
+    vaddr_t uaddr = (vaddr_t) args;
+    size_t used = 0;
+    size_t room, got;
+    unsigned n, i;
+    int argc = 0;
+    int err;
 
-/*Get arguments from userspace to kernel space*/
-int getargs(char **args, char **kern_args, int total_args){
-    char *kaddr; 
-    int len; 
-    int err; 
-    // kern_args[0] = &total_args; 
-    for(int i = 0; i < total_args; i++){
-        char *arg_ptr;
-        err = copyin((const_userptr_t)&args[i], &arg_ptr, sizeof(char *));
-        if (err) {
-            return err;
+    while(1){
+        n = (PAGE_SIZE - uaddr % PAGE_SIZE) / sizeof(userptr_t);
+        if(n == 0){ // misaligned pointer straddling a page
+            n = 1;
         }
-
-        err = getLen(arg_ptr, &len); 
-        if(err){
-            return err; 
+        if(n > ARGCHUNK){
+            n = ARGCHUNK;
         }
-        kaddr = kmalloc(len); 
-        err = copyinstr((const_userptr_t) arg_ptr, kaddr, len, NULL); 
+        err = copyin((const_userptr_t) uaddr, chunk, n * sizeof(userptr_t));
         if(err){
-            return err; 
+            return err;
         }
-        kern_args[i] = kaddr; 
-    }
-    kern_args[total_args] = NULL;
 
-    return 0; 
+        for(i = 0; i < n; i++){
+            if(chunk[i] == NULL){
+                *total_args = argc;
+                *strbytes = used;
+                return 0;
+            }
+            room = argRoom(used, argc);
+            if(room == 0){
+                return E2BIG;
+            }
+            err = copyinstr((const_userptr_t) chunk[i], kbuf + used, room, &got);
+            if(err == ENAMETOOLONG){
+                return E2BIG;
+            }
+            if(err){
+                return err;
+            }
+            used += got; // got includes the null terminator
+            argc++;
+        }
+        uaddr += n * sizeof(userptr_t);
+    }
 }
 
-/*Method to get the total number of arguments, returns with error
-if any copyin fails*/
-int getCount(char **args, char *arg_addr, int *total_args){
-    int index = 0; 
-    int ret = copyin((const_userptr_t)&args[index], &arg_addr, (size_t) sizeof(char *));
-    if(ret){ // If error during copyin, return the error
-        return ret;
-    }
+/*Lay the strings and argv array in kbuf out below stackptr in one copyout*/
+static int copyout_args(char *kbuf, int total_args, size_t strbytes, vaddr_t *stackptr, userptr_t *args_out_addr){
+    size_t ptroff = ROUNDUP(strbytes, sizeof(vaddr_t));
+    size_t total = ptroff + (total_args + 1) * sizeof(vaddr_t);
+    vaddr_t *uargv = (vaddr_t *)(kbuf + ptroff);
+    vaddr_t base;
+    size_t pos = 0;
+    int err;
 
-    while(arg_addr && index < ARG_MAX){
-        index++; 
-        ret = copyin((const_userptr_t)&args[index], &arg_addr, (size_t) sizeof(char *));
-        if(ret){ // If error during copyin, return the error
-            return ret;
-        }
+    KASSERT(total <= ARG_MAX);
+    base = (*stackptr - total) & ~(vaddr_t)7; // 8-byte aligned stack
+
+    memset(kbuf + strbytes, 0, ptroff - strbytes); // don't leak kernel bytes
+    for(int i = 0; i < total_args; i++){
+        uargv[i] = base + pos;
+        pos += strlen(kbuf + pos) + 1;
     }
+    uargv[total_args] = 0;
 
-    if(arg_addr){
-        return E2BIG; 
+    err = copyout(kbuf, (userptr_t) base, total);
+    if(err){
+        return err;
     }
-    *total_args = index;
-    
-    return 0; 
+
+    *stackptr = base;
+    *args_out_addr = (userptr_t)(base + ptroff);
+    return 0;
 }
 
-/*Read program from userspace and put it in kernel*/
-static int getProgName(const char *src_name, char *dest_name){
-    int err; 
-    int len; 
-    err = getLen((char *) src_name, &len); 
-    if(err){
-        return err; 
+/*A loaded program, ready for enter_new_process*/
+struct execimage {
+    vaddr_t entrypoint;
+    vaddr_t stackptr;
+    userptr_t argv;
+    int argc;
+};
+
+/*Copy the program name and arguments for execv/spawn into the kernel*/
+static int copyinProgram(const char *program, char **args, char **progname, char **argbuf, int *total_args, size_t *strbytes){
+    int err;
+
+    *progname = kmalloc(PATH_MAX);
+    if(*progname == NULL){
+        return ENOMEM;
     }
-    
-    size_t *stop_len = kmalloc(sizeof(int)); 
-    err = copyinstr((const_userptr_t) src_name, dest_name, len, stop_len); 
+    err = copyinstr((const_userptr_t) program, *progname, PATH_MAX, NULL);
     if(err){
-        return err; 
+        kfree(*progname);
+        return err;
     }
 
-    return 0; 
-}       
-
-/*Free allocated memory*/
-static int free_args(char **kern_args, int total_args){
-    for(int i = 0; i < total_args; i++){
-        kfree(kern_args[i]); 
+    *argbuf = kmalloc(ARG_MAX);
+    if(*argbuf == NULL){
+        kfree(*progname);
+        return ENOMEM;
     }
-
-    kfree(kern_args); 
-    return 0; 
+    err = gatherArgs(args, *argbuf, total_args, strbytes);
+    if(err){
+        kfree(*progname);
+        kfree(*argbuf);
+        return err;
+    }
+    return 0;
 }
 
-/*Copy args from kernel to user stack*/
-static int copyout_args(char **argumentStr, int total_args, vaddr_t *stackptr, userptr_t *args_out_addr) {
-    vaddr_t arg_ptrs[total_args + 1]; // Array to store user-space pointers to arguments
-    size_t arg_len;
+/*
+ * Load progname into a new address space with the arguments in argbuf
+ * on its stack, and leave it installed and active for curproc. The
+ * previous address space is returned in *old_as. On failure, curproc
+ * is back on its old address space and the new one is gone.
+ * (Some parts of the code taken from runprogram.c.)
+ */
+static int loadProgram(char *progname, char *argbuf, int total_args, size_t strbytes, struct execimage *img, struct addrspace **old_as){
+    struct addrspace *new_as;
+    struct vnode *v;
     int err;
 
-    for (int i = total_args - 1; i >= 0; i--) {
-        if(!argumentStr[i]){
-            return EFAULT; 
-        }
-        arg_len = strlen(argumentStr[i]) + 1; // Include null terminator
-
-        // Adjust stack pointer for the argument string
-        *stackptr -= ROUNDUP(arg_len, 8); // Align to 8 bytes for proper alignment
-        err = copyout(argumentStr[i], (userptr_t)*stackptr, arg_len);
-        if (err) {
-            return err; // Return error if copyout fails
-        }
+    err = vfs_open(progname, O_RDONLY, 0, &v);
+    if(err){
+        return err;
+    }
 
-        // Store the user-space address of the argument string
-        arg_ptrs[i] = *stackptr;
+    new_as = as_create();
+    if (new_as == NULL) {
+        vfs_close(v);
+        return ENOMEM;
     }
 
-    // Last argument should be NULL for null termination
-    arg_ptrs[total_args] = 0;
+    /*Switch to the new addrspace*/
+    as_deactivate();
+    *old_as = proc_setas(new_as);
+    as_activate();
 
-    // Copy the array of pointers to the stack
-    *stackptr -= ROUNDUP((total_args + 1) * sizeof(vaddr_t), 8); // Align to 8 bytes
-    *args_out_addr = (userptr_t)*stackptr; // Store the user-space address of the argv array
-    err = copyout(arg_ptrs, *args_out_addr, (total_args + 1) * sizeof(vaddr_t));
-    if (err) {
-        return err; // Return error if copyout fails
+    /*Load a new executable*/
+    err = load_elf(v, &img->entrypoint);
+    /* Done with the file now. */
+    vfs_close(v);
+    if(!err){
+        err = as_define_stack(new_as, &img->stackptr);
+    }
+    if(!err){
+        err = copyout_args(argbuf, total_args, strbytes, &img->stackptr, &img->argv);
+    }
+    if(err){
+        /*Go back to the old addrspace and drop the new one*/
+        as_deactivate();
+        proc_setas(*old_as);
+        as_activate();
+        as_destroy(new_as);
+        return err;
     }
 
-    *stackptr -= *stackptr % 8; // Ensure 8-byte alignment
-
+    img->argc = total_args;
     return 0;
 }
 
-/*Some parts of the code taken from runprogram.c*/
 int sys_execv(const char *program, char **args){
-    char *arguments = kmalloc(sizeof(char *));
-    char **argumentStr; 
-    char *progToCreate; 
-
-    int total_args; 
+    struct execimage img;
+    struct addrspace *old_as;
+    char *progToCreate;
+    char *argbuf;
+    int total_args;
+    size_t strbytes;
     int err;
 
-    int nameLen; 
-    err = getLen((char *) program, &nameLen); 
-    if(err){
-        return err; 
-    }
-    progToCreate = kmalloc(nameLen); 
-
-    err = getProgName(program, progToCreate);
-    if(err){
-        kfree(progToCreate); 
-        return err; 
-    }
-    
-    err = getCount(args, arguments, &total_args); 
+    err = copyinProgram(program, args, &progToCreate, &argbuf, &total_args, &strbytes);
     if(err){
-        kfree(progToCreate);
-        kfree(arguments);
-        return err; 
+        return err;
     }
-
-    argumentStr = kmalloc(total_args * sizeof(char *)); // memory allocated = total args * sizeof(arg);
-    
-    err = getargs(args, argumentStr, total_args); 
+    err = loadProgram(progToCreate, argbuf, total_args, strbytes, &img, &old_as);
+    kfree(progToCreate);
+    kfree(argbuf);
     if(err){
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-        return err; 
+        return err;
     }
 
-    /*Setting up addrspace*/
-    struct addrspace *old_as; 
-    struct addrspace *new_as;
-    struct vnode *v;
-
-    err = vfs_open(progToCreate, O_RDONLY, 0, &v); 
-    if(err){
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-        return err; 
+    /*Clean up the old addr space, unless it was borrowed from a vfork parent*/
+    if(!vfork_release(curproc) && old_as != NULL){
+        as_destroy(old_as);
     }
 
-    old_as = proc_getas(); 
-    new_as = as_create(); 
+    /*Warp to user mode*/
+    /* enter_new_process does not return. */
+    enter_new_process(img.argc, img.argv, NULL, img.stackptr, img.entrypoint);
+	panic("enter_new_process returned\n");
+	return EINVAL;
+}
 
-    if (new_as == NULL) {
-		vfs_close(v);
-        // NEED TO FREE OTHER THINGS TOO
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-		return ENOMEM;
-	}
+/*First code run by a spawned proc's thread*/
+static void
+spawn_usermode(void *data1, unsigned long data2) {
+    struct execimage img = *(struct execimage *) data1;
+    kfree(data1);
+    (void) data2;
 
-    /*Switch to new addrspace*/
+    as_activate();
+    enter_new_process(img.argc, img.argv, NULL, img.stackptr, img.entrypoint);
+    panic("enter_new_process returned\n");
+}
 
-    /*Deactivate the old one*/
-    as_deactivate(); 
-    /*Activate the new one*/
-    proc_setas(new_as); 
-    as_activate(); 
+/*Apply a spawn descriptor map to the new proc's copy of our file table*/
+static int spawnFiles(struct proc *childProc, const struct spawn_fdmap *fdmap, int nfdmap){
+    struct spawn_fdmap *kmap;
+    int err = 0;
 
-    /*Load a new executable*/
-    vaddr_t entrypoint; 
-    err = load_elf(v, &entrypoint);
-	if (err) {
-		/* p_addrspace will go away when curproc is destroyed */
-        /*Deactivate the new one*/
-        as_deactivate(); 
-        /*Activate the old one*/
-        proc_setas(old_as); 
-        as_activate(); 
-
-		vfs_close(v);
-
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-		return err;
-	}
+    if(nfdmap == 0){
+        return 0;
+    }
+    kmap = kmalloc(nfdmap * sizeof(*kmap));
+    if(kmap == NULL){
+        return ENOMEM;
+    }
+    err = copyin((const_userptr_t) fdmap, kmap, nfdmap * sizeof(*kmap));
+    for(int i = 0; i < nfdmap && !err; i++){
+        if(kmap[i].sf_fd < 0 || kmap[i].sf_fd >= OPEN_MAX){
+            err = EBADF;
+        }
+        else if(kmap[i].sf_parentfd == -1){
+            clean_fd(childProc->ft, kmap[i].sf_fd); // Not open is fine
+        }
+        else{
+            err = dupAcross(curproc->ft, kmap[i].sf_parentfd, childProc->ft, kmap[i].sf_fd);
+        }
+    }
+    kfree(kmap);
+    return err;
+}
 
-    /* Done with the file now. */
-	vfs_close(v);
+/*
+ * Driver for spawn(): fork+execv in one step. The new proc gets our
+ * cwd and files (adjusted by fdmap), and the program is loaded straight
+ * into a fresh address space, so ours is never copied. Loading happens
+ * here on our thread, so a bad program fails the call rather than
+ * showing up later as the child's exit status.
+ */
+int sys_spawn(const char *program, char **args, const struct spawn_fdmap *fdmap, int nfdmap, size_t *retVal){
+    struct proc *childProc;
+    struct execimage *img;
+    struct addrspace *old_as;
+    char *progToCreate;
+    char *argbuf;
+    int total_args;
+    size_t strbytes;
+    int err;
 
-    vaddr_t stackptr;
-    err = as_define_stack(new_as, &stackptr);
+    if(nfdmap < 0 || nfdmap > OPEN_MAX){
+        return EINVAL;
+    }
+    img = kmalloc(sizeof(*img)); // Handed to the child thread
+    if(img == NULL){
+        return ENOMEM;
+    }
+    err = copyinProgram(program, args, &progToCreate, &argbuf, &total_args, &strbytes);
     if(err){
-        as_deactivate(); 
-        /*Activate the old one*/
-        proc_setas(old_as); 
-        as_activate(); 
-
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-        return err; 
+        kfree(img);
+        return err;
     }
 
-    userptr_t args_out_addr; 
+    childProc = proc_creator("childProc");
+    if(childProc == NULL){
+        err = ENOMEM;
+        goto out;
+    }
+    err = spawn_proc(childProc);
+    if(err){
+        proc_destroy(childProc);
+        goto out;
+    }
+    err = spawnFiles(childProc, fdmap, nfdmap);
+    if(err){
+        goto fail;
+    }
 
-    err = copyout_args(argumentStr, total_args, &stackptr, &args_out_addr);
+    /*Build the image on our thread, then give the address space to the child*/
+    err = loadProgram(progToCreate, argbuf, total_args, strbytes, img, &old_as);
     if(err){
-        as_deactivate(); 
-        /*Activate the old one*/
-        proc_setas(old_as); 
-        as_activate(); 
-
-        kfree(progToCreate);
-        kfree(arguments);
-        free_args(argumentStr, total_args); 
-        return err; 
+        goto fail;
     }
+    as_deactivate();
+    childProc->p_addrspace = proc_setas(old_as);
+    as_activate();
 
-    /*Clean up the old addr space*/
-    kfree(progToCreate);  
-    free_args(argumentStr, total_args); 
+    *retVal = childProc->pid;
+    err = thread_fork("childProc", childProc, spawn_usermode, img, 0);
+    if(err){
+        goto fail;
+    }
+    kfree(progToCreate);
+    kfree(argbuf);
+    return 0;
 
-    /*Warp to user mode*/
-    /* enter_new_process does not return. */
-    enter_new_process(total_args, args_out_addr, NULL, stackptr, entrypoint);
-	panic("enter_new_process returned\n");
-	return EINVAL;
+fail:
+    removePidEntry(childProc);
+    proc_destroy(childProc); // Also frees the new address space, if any
+out:
+    kfree(img);
+    kfree(progToCreate);
+    kfree(argbuf);
+    return err;
 }
-
@@ -0,0 +1,256 @@
+/*
+ * Reader-writer lock tests.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NREADERS   24
+#define NWRITERS   4
+#define NRWLOOPS   100
+#define NRWVALUES  8
+
+static struct rwlock *testrw;
+static struct semaphore *rwdonesem;
+static struct spinlock rwstatlock = SPINLOCK_INITIALIZER;
+
+static volatile unsigned long rwvalues[NRWVALUES];
+static volatile unsigned rwactivereaders;
+static volatile unsigned rwmaxreaders;
+static volatile bool rwfailed;
+
+static
+void
+rwinit(void)
+{
+	unsigned i;
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rwdonesem = sem_create("rwdonesem", 0);
+	if (rwdonesem == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+	for (i=0; i<NRWVALUES; i++) {
+		rwvalues[i] = 0;
+	}
+	rwactivereaders = 0;
+	rwmaxreaders = 0;
+	rwfailed = false;
+}
+
+static
+void
+rwcleanup(void)
+{
+	sem_destroy(rwdonesem);
+	rwlock_destroy(testrw);
+	rwdonesem = NULL;
+	testrw = NULL;
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwfailed = true;
+}
+
+static
+void
+readerthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+	unsigned long first;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+
+		spinlock_acquire(&rwstatlock);
+		rwactivereaders++;
+		if (rwactivereaders > rwmaxreaders) {
+			rwmaxreaders = rwactivereaders;
+		}
+		spinlock_release(&rwstatlock);
+
+		first = rwvalues[0];
+		for (j=1; j<NRWVALUES; j++) {
+			if (rwvalues[j] != first) {
+				rwfail(num, "reader saw a partial write");
+			}
+			/* give writers a chance to break in */
+			thread_yield();
+		}
+
+		spinlock_acquire(&rwstatlock);
+		rwactivereaders--;
+		spinlock_release(&rwstatlock);
+
+		rwlock_release_read(testrw);
+	}
+	V(rwdonesem);
+}
+
+static
+void
+writerthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_write(testrw);
+		if (!rwlock_do_i_hold_write(testrw)) {
+			rwfail(num, "rwlock_do_i_hold_write is false");
+		}
+		for (j=0; j<NRWVALUES; j++) {
+			if (rwactivereaders != 0) {
+				rwfail(num, "writer running with readers");
+			}
+			rwvalues[j] = num * NRWLOOPS + i;
+			thread_yield();
+		}
+		rwlock_release_write(testrw);
+	}
+	V(rwdonesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned long i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	rwinit();
+	kprintf("Starting rwlock test...\n");
+
+	for (i=0; i<NREADERS; i++) {
+		result = thread_fork("rwtest reader", NULL, readerthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NWRITERS; i++) {
+		result = thread_fork("rwtest writer", NULL, writerthread,
+				     NULL, NREADERS + i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NREADERS + NWRITERS; i++) {
+		P(rwdonesem);
+	}
+
+	kprintf("At most %u readers held the lock at once\n", rwmaxreaders);
+	if (rwmaxreaders < 2) {
+		kprintf("Readers never overlapped\n");
+		rwfailed = true;
+	}
+	kprintf("rwlock test %s\n", rwfailed ? "FAILED" : "done");
+
+	rwcleanup();
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Check writer preference: while a reader holds the lock and a writer
+ * is waiting, a newly arriving reader must wait behind the writer.
+ */
+
+static volatile unsigned rworder;
+static volatile unsigned rwwriterpos, rwreaderpos;
+
+static
+void
+prefwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_write(testrw);
+	rwwriterpos = ++rworder;
+	rwlock_release_write(testrw);
+	V(rwdonesem);
+}
+
+static
+void
+prefreader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	rwlock_acquire_read(testrw);
+	rwreaderpos = ++rworder;
+	rwlock_release_read(testrw);
+	V(rwdonesem);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	int result, i;
+
+	(void)nargs;
+	(void)args;
+
+	rwinit();
+	rworder = rwwriterpos = rwreaderpos = 0;
+	kprintf("Starting rwlock writer preference test...\n");
+
+	rwlock_acquire_read(testrw);
+
+	result = thread_fork("rwtest2 writer", NULL, prefwriter, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	while (testrw->rw_waitwriters == 0) {
+		thread_yield();
+	}
+
+	result = thread_fork("rwtest2 reader", NULL, prefreader, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	/* give the reader plenty of chances to sneak in */
+	for (i=0; i<100; i++) {
+		thread_yield();
+	}
+	if (rwreaderpos != 0) {
+		kprintf("New reader got in ahead of a waiting writer\n");
+		rwfailed = true;
+	}
+
+	rwlock_release_read(testrw);
+	P(rwdonesem);
+	P(rwdonesem);
+
+	if (rwwriterpos != 1 || rwreaderpos != 2) {
+		kprintf("Wrong order: writer %u, reader %u\n",
+			rwwriterpos, rwreaderpos);
+		rwfailed = true;
+	}
+	kprintf("rwlock writer preference test %s\n",
+		rwfailed ? "FAILED" : "done");
+
+	rwcleanup();
+	return 0;
+}
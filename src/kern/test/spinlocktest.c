@@ -0,0 +1,176 @@
+/*
+ * Spinlock stress test.
+ *
+ * A number of threads hammer a single spinlock, each counting how many
+ * times it got the lock and how long it waited. Run this with the
+ * sys161 cpus setting at 2 through 8 to see how throughput and
+ * worst-case wait scale with the number of processors.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SPLKTHREADS_DEFAULT 8
+#define SPLKTHREADS_MAX     32
+#define SPLKLOOPS           2000
+#define SPLKHOLD            20
+#define SPLKOUTSIDE         100
+
+static struct spinlock splktest_lock = SPINLOCK_INITIALIZER;
+static struct semaphore *splkdonesem;
+static volatile unsigned long splkcount;
+
+static unsigned long splkacquires[SPLKTHREADS_MAX];
+static uint64_t splkmaxwait[SPLKTHREADS_MAX];
+static uint64_t splktotalwait[SPLKTHREADS_MAX];
+static unsigned splkcpu[SPLKTHREADS_MAX];
+
+static
+uint64_t
+splk_nsecs(const struct timespec *ts)
+{
+	return ts->tv_sec * (uint64_t)1000000000 + ts->tv_nsec;
+}
+
+static
+void
+splkthread(void *junk, unsigned long num)
+{
+	struct timespec before, after;
+	volatile unsigned long j;
+	uint64_t wait;
+	int i, spl;
+
+	(void)junk;
+
+	for (i=0; i<SPLKLOOPS; i++) {
+		/*
+		 * Keep interrupts off across the measurement so a
+		 * context switch isn't counted as time spent waiting.
+		 */
+		spl = splhigh();
+		gettime(&before);
+		spinlock_acquire(&splktest_lock);
+		gettime(&after);
+
+		splkcount++;
+		for (j=0; j<SPLKHOLD; j++);
+
+		spinlock_release(&splktest_lock);
+		splx(spl);
+
+		wait = splk_nsecs(&after) - splk_nsecs(&before);
+		splkacquires[num]++;
+		splktotalwait[num] += wait;
+		if (wait > splkmaxwait[num]) {
+			splkmaxwait[num] = wait;
+		}
+
+		for (j=0; j<SPLKOUTSIDE; j++);
+	}
+	splkcpu[num] = curcpu->c_number;
+	V(splkdonesem);
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	struct timespec before, after, duration;
+	unsigned long i, nthreads, minacq, maxacq, total;
+	uint64_t nsecs, maxwait, totalwait;
+	unsigned ncpus;
+	uint32_t cpusseen;
+	int result;
+
+	nthreads = SPLKTHREADS_DEFAULT;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nthreads < 1 || nthreads > SPLKTHREADS_MAX) {
+		kprintf("Usage: splk [nthreads]   (1-%d)\n", SPLKTHREADS_MAX);
+		return EINVAL;
+	}
+
+	splkdonesem = sem_create("splkdonesem", 0);
+	if (splkdonesem == NULL) {
+		panic("spinlocktest: sem_create failed\n");
+	}
+	splkcount = 0;
+	for (i=0; i<nthreads; i++) {
+		splkacquires[i] = 0;
+		splkmaxwait[i] = 0;
+		splktotalwait[i] = 0;
+		splkcpu[i] = 0;
+	}
+
+	kprintf("Starting spinlock stress test with %lu threads...\n",
+		nthreads);
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("splktest", NULL, splkthread, NULL, i);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(splkdonesem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	total = 0;
+	minacq = maxacq = splkacquires[0];
+	maxwait = totalwait = 0;
+	cpusseen = 0;
+	for (i=0; i<nthreads; i++) {
+		total += splkacquires[i];
+		totalwait += splktotalwait[i];
+		if (splkacquires[i] < minacq) {
+			minacq = splkacquires[i];
+		}
+		if (splkacquires[i] > maxacq) {
+			maxacq = splkacquires[i];
+		}
+		if (splkmaxwait[i] > maxwait) {
+			maxwait = splkmaxwait[i];
+		}
+		cpusseen |= (uint32_t)1 << (splkcpu[i] % 32);
+	}
+	for (ncpus = 0; cpusseen != 0; cpusseen &= cpusseen - 1) {
+		ncpus++;
+	}
+
+	nsecs = splk_nsecs(&duration);
+	kprintf("%lu acquires in %llu.%09lu s on %u cpu(s): "
+		"%llu acquires/sec\n", total,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec, ncpus,
+		nsecs ? (unsigned long long)(total * 1000000000ULL / nsecs)
+		: 0ULL);
+	kprintf("    wait: avg %llu ns, max %llu ns; per-thread acquires "
+		"min %lu max %lu\n",
+		(unsigned long long)(total ? totalwait / total : 0),
+		(unsigned long long)maxwait, minacq, maxacq);
+
+	sem_destroy(splkdonesem);
+	splkdonesem = NULL;
+
+	if (splkcount != total || total != nthreads * SPLKLOOPS) {
+		kprintf("spinlocktest: lost updates (%lu, expected %lu)\n",
+			splkcount, nthreads * SPLKLOOPS);
+		kprintf("Test failed\n");
+		return 0;
+	}
+	kprintf("Spinlock stress test done.\n");
+	return 0;
+}
@@ -399,3 +399,110 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Lock throughput test.
+ *
+ * NSPEEDTHREADS threads each acquire and release one lock
+ * NSPEEDLOOPS times, spinning for a while inside the critical section
+ * and a while outside it. This is run once with a short hold time,
+ * where adaptive spinning should avoid nearly all sleeps, and once
+ * with a long hold time, where waiters should give up and block.
+ */
+
+#define NSPEEDTHREADS 8
+#define NSPEEDLOOPS   400
+#define SHORTHOLD     10
+#define LONGHOLD      5000
+#define OUTSIDEWORK   200
+
+static struct lock *speedlock;
+static volatile unsigned long speedcount;
+
+static
+void
+speedthread(void *junk, unsigned long hold)
+{
+	volatile unsigned long j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NSPEEDLOOPS; i++) {
+		lock_acquire(speedlock);
+		speedcount++;
+		for (j=0; j<hold; j++);
+		lock_release(speedlock);
+
+		for (j=0; j<OUTSIDEWORK; j++);
+	}
+	V(donesem);
+}
+
+static
+void
+speedrun(const char *what, unsigned long hold)
+{
+	struct timespec before, after, duration;
+	uint64_t nsecs, ops;
+	int i, result;
+
+	speedlock = lock_create("speedlock");
+	if (speedlock == NULL) {
+		panic("lockspeedtest: lock_create failed\n");
+	}
+	speedcount = 0;
+
+	gettime(&before);
+	for (i=0; i<NSPEEDTHREADS; i++) {
+		result = thread_fork("lockspeedtest", NULL, speedthread,
+				     NULL, hold);
+		if (result) {
+			panic("lockspeedtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NSPEEDTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	if (speedcount != NSPEEDTHREADS * NSPEEDLOOPS) {
+		kprintf("lockspeedtest: lost updates (%lu, expected %u)\n",
+			speedcount, NSPEEDTHREADS * NSPEEDLOOPS);
+		kprintf("Test failed\n");
+	}
+
+	ops = speedlock->lk_acquires;
+	nsecs = duration.tv_sec * (uint64_t)1000000000 + duration.tv_nsec;
+	kprintf("%s hold (%lu): %llu acquires in %llu.%09lu s, "
+		"%llu acquires/sec\n", what, hold,
+		(unsigned long long)ops,
+		(unsigned long long)duration.tv_sec,
+		(unsigned long)duration.tv_nsec,
+		nsecs ? (unsigned long long)(ops * 1000000000 / nsecs) : 0ULL);
+	kprintf("    %u contended, %u slept, %u acquired by spinning\n",
+		speedlock->lk_contended, speedlock->lk_sleeps,
+		speedlock->lk_contended - speedlock->lk_sleeps);
+
+	lock_destroy(speedlock);
+	speedlock = NULL;
+}
+
+int
+lockspeedtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting lock throughput test...\n");
+	speedrun("Short", SHORTHOLD);
+	speedrun("Long", LONGHOLD);
+	kprintf("Lock throughput test done.\n");
+
+	return 0;
+}
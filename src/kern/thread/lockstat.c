@@ -0,0 +1,248 @@
+/*
+ * Lock contention profiling. See lockstat.h.
+ *
+ * Statistics live in a fixed-size open-addressed hash table keyed by
+ * lock address and name. The table can't be protected by a spinlock,
+ * since that would recurse right back in here, so it is guarded by a
+ * bare test-and-set word with interrupts off.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_SLOTS    512	/* must be a power of 2 */
+#define LOCKSTAT_NAMELEN  20
+
+struct lockstat_entry {
+	const void *ls_lock;		/* address of the lock; NULL if free */
+	char ls_name[LOCKSTAT_NAMELEN];	/* name of the lock; "" if none */
+	unsigned ls_acquires;		/* number of acquisitions */
+	unsigned ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_waittime;		/* total ns spent waiting */
+	uint64_t ls_maxhold;		/* longest ns held */
+};
+
+static struct lockstat_entry lockstat_table[LOCKSTAT_SLOTS];
+static unsigned lockstat_dropped;	/* locks that didn't fit */
+static volatile spinlock_data_t lockstat_guard = SPINLOCK_DATA_INITIALIZER;
+static volatile bool lockstat_enabled = false;
+
+static
+int
+lockstat_lock(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockstat_guard) != 0 ||
+	       spinlock_data_testandset(&lockstat_guard) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+	return spl;
+}
+
+static
+void
+lockstat_unlock(int spl)
+{
+	membar_any_store();
+	spinlock_data_set(&lockstat_guard, 0);
+	splx(spl);
+}
+
+/*
+ * Compare NAME against the (possibly truncated) name stored in LS.
+ */
+static
+bool
+lockstat_samename(const struct lockstat_entry *ls, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == '\0') {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find the entry for LK/NAME, creating it if CREATE is set. Returns
+ * NULL if it doesn't exist or the table is full. Guard must be held.
+ */
+static
+struct lockstat_entry *
+lockstat_find(const void *lk, const char *name, bool create)
+{
+	struct lockstat_entry *ls;
+	unsigned i, slot;
+
+	if (name == NULL) {
+		name = "";
+	}
+
+	slot = ((uintptr_t)lk >> 2) * 2654435761U;
+	for (i=0; i<LOCKSTAT_SLOTS; i++) {
+		ls = &lockstat_table[(slot + i) & (LOCKSTAT_SLOTS - 1)];
+		if (ls->ls_lock == NULL) {
+			if (!create) {
+				return NULL;
+			}
+			ls->ls_lock = lk;
+			for (i=0; i<LOCKSTAT_NAMELEN - 1 && name[i]; i++) {
+				ls->ls_name[i] = name[i];
+			}
+			ls->ls_name[i] = '\0';
+			return ls;
+		}
+		/*
+		 * Compare names too, so a new lock that reuses the
+		 * memory of an old one gets its own entry.
+		 */
+		if (ls->ls_lock == lk && lockstat_samename(ls, name)) {
+			return ls;
+		}
+	}
+	if (create) {
+		lockstat_dropped++;
+	}
+	return NULL;
+}
+
+void
+lockstat_bootstrap(void)
+{
+	lockstat_reset();
+	lockstat_enabled = true;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	struct timespec ts;
+
+	if (!lockstat_enabled) {
+		return 0;
+	}
+	gettime(&ts);
+	return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+void
+lockstat_acquired(const void *lk, const char *name, bool contended,
+		  uint64_t start, uint64_t now)
+{
+	struct lockstat_entry *ls;
+	int spl;
+
+	if (start == 0) {
+		/* started before collection was turned on */
+		return;
+	}
+
+	spl = lockstat_lock();
+	ls = lockstat_find(lk, name, true);
+	if (ls != NULL) {
+		ls->ls_acquires++;
+		if (contended) {
+			ls->ls_contended++;
+			ls->ls_waittime += now - start;
+		}
+	}
+	lockstat_unlock(spl);
+}
+
+void
+lockstat_released(const void *lk, const char *name, uint64_t acquired)
+{
+	struct lockstat_entry *ls;
+	uint64_t now, held;
+	int spl;
+
+	if (acquired == 0) {
+		return;
+	}
+	now = lockstat_now();
+	held = now - acquired;
+
+	spl = lockstat_lock();
+	ls = lockstat_find(lk, name, false);
+	if (ls != NULL && held > ls->ls_maxhold) {
+		ls->ls_maxhold = held;
+	}
+	lockstat_unlock(spl);
+}
+
+void
+lockstat_reset(void)
+{
+	int spl;
+
+	spl = lockstat_lock();
+	bzero(lockstat_table, sizeof(lockstat_table));
+	lockstat_dropped = 0;
+	lockstat_unlock(spl);
+}
+
+/*
+ * Print the COUNT entries with the most total wait time. We work on a
+ * copy of the table since printing takes locks of its own.
+ */
+int
+lockstat_print(unsigned count)
+{
+	struct lockstat_entry *snap, *best;
+	unsigned i, n, dropped;
+	int spl;
+
+	snap = kmalloc(sizeof(lockstat_table));
+	if (snap == NULL) {
+		return ENOMEM;
+	}
+
+	spl = lockstat_lock();
+	memcpy(snap, lockstat_table, sizeof(lockstat_table));
+	dropped = lockstat_dropped;
+	lockstat_unlock(spl);
+
+	kprintf("%-20s %-10s %9s %9s %12s %12s\n", "Lock", "Address",
+		"Acquires", "Contended", "Wait (us)", "MaxHold (us)");
+	for (n=0; n<count; n++) {
+		best = NULL;
+		for (i=0; i<LOCKSTAT_SLOTS; i++) {
+			if (snap[i].ls_lock == NULL) {
+				continue;
+			}
+			if (best == NULL ||
+			    snap[i].ls_waittime > best->ls_waittime) {
+				best = &snap[i];
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		kprintf("%-20s %p %9u %9u %12llu %12llu\n",
+			best->ls_name[0] ? best->ls_name : "(spinlock)",
+			best->ls_lock, best->ls_acquires, best->ls_contended,
+			(unsigned long long)(best->ls_waittime / 1000),
+			(unsigned long long)(best->ls_maxhold / 1000));
+		best->ls_lock = NULL;
+	}
+	if (dropped > 0) {
+		kprintf("(%u locks not tracked; table full)\n", dropped);
+	}
+
+	kfree(snap);
+	return 0;
+}
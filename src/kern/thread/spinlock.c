@@ -38,6 +38,7 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -50,8 +51,12 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKSTAT
+	splk->splk_stamp = 0;
+#endif
 }
 
 /*
@@ -61,22 +66,31 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
 }
 
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then take a ticket with
+ * a machine-level atomic increment and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKSTAT
+	uint64_t start;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
+#if OPT_LOCKSTAT
+	start = lockstat_now();
+#endif
 
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
@@ -90,28 +104,25 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	/*
+	 * The atomic increment is the only write a waiter makes;
+	 * after that we just watch splk_serving, which only the
+	 * holder writes. Ticket numbers wrap around harmlessly,
+	 * since we only ever compare them for equality.
+	 */
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+#if OPT_LOCKSTAT
+		contended = true;
+#endif
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+#if OPT_LOCKSTAT
+	splk->splk_stamp = lockstat_now();
+	lockstat_acquired(splk, NULL, contended, start, splk->splk_stamp);
+#endif
 }
 
 /*
@@ -127,9 +138,14 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(splk, NULL, splk->splk_stamp);
+#endif
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Only the holder writes splk_serving, so this needn't be atomic. */
+	spinlock_data_set(&splk->splk_serving,
+			  spinlock_data_get(&splk->splk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
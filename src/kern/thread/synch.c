@@ -38,7 +38,9 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
+#include <lockstat.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -165,6 +167,13 @@ lock_create(const char *name)
         spinlock_init(&lock->spin_lock);
 	lock->taken = false; // Initially lock is not taken 
         lock->lk_holder = NULL; // No thread holds the lock
+        lock->lk_holdercpu = NULL;
+        lock->lk_acquires = 0;
+        lock->lk_contended = 0;
+        lock->lk_sleeps = 0;
+#if OPT_LOCKSTAT
+        lock->lk_stamp = 0;
+#endif
         return lock;
 }
 
@@ -182,20 +191,103 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Check whether it is worth spinning on a lock held by HOLDER, which
+ * took it on CPU: only if that's some other CPU and HOLDER is still
+ * the thread running there. If the holder is asleep, has moved, or
+ * is waiting for our CPU, spinning can only delay it.
+ *
+ * This is called without the lock's spinlock held while spinning, so
+ * HOLDER may have released the lock (and even exited) by the time we
+ * look. So it only compares HOLDER's address and never follows it;
+ * CPUs are never freed, so reading CPU's current thread is safe. The
+ * answer is only a hint and the caller rechecks under the spinlock.
+ */
+static
+bool
+lock_holder_running(const volatile struct cpu *cpu, struct thread *holder)
+{
+        return cpu != NULL && cpu != curcpu->c_self &&
+                cpu->c_curthread == holder;
+}
+
+/*
+ * Locks are FIFO: once anyone is asleep on the lock, lock_release
+ * hands ownership directly to the first sleeper rather than letting
+ * it race with newcomers, and newcomers go to the back of the queue.
+ * Spinning is therefore only worthwhile while nobody is queued.
+ */
 void
 lock_acquire(struct lock *lock)
 {
         // Write this
+        struct thread *holder;
+        struct cpu *holdercpu;
+        unsigned spins = 0;
+#if OPT_LOCKSTAT
+        uint64_t start = lockstat_now();
+        bool contended = false;
+#endif
+
         KASSERT(lock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
         
         spinlock_acquire(&lock->spin_lock); 
+        if(lock->taken){
+                lock->lk_contended++;
+#if OPT_LOCKSTAT
+                contended = true;
+#endif
+        }
         while(lock->taken){
+                holder = lock->lk_holder;
+                holdercpu = lock->lk_holdercpu;
+                if(spins < LOCK_SPIN_MAX &&
+                   lock_holder_running(holdercpu, holder) &&
+                   wchan_isempty(lock->lk_wchan, &lock->spin_lock)){
+                        /*
+                         * Spin without the spinlock so the holder can
+                         * get in to release, and with interrupts on.
+                         * Only taken is looked at here; if the lock
+                         * changes hands meanwhile we find out when
+                         * the spinning is over.
+                         */
+                        spinlock_release(&lock->spin_lock);
+                        while(lock->taken && spins < LOCK_SPIN_MAX &&
+                              lock_holder_running(holdercpu, holder)){
+                                spins++;
+                        }
+                        spinlock_acquire(&lock->spin_lock);
+                        continue;
+                }
+
+                lock->lk_sleeps++;
                 wchan_sleep(lock->lk_wchan, &lock->spin_lock); 
+
+                /* lock_release handed the lock straight to us */
+                KASSERT(lock->taken);
+                KASSERT(lock->lk_holder == curthread);
+                lock->lk_holdercpu = curcpu->c_self;
+                lock->lk_acquires++;
+                spinlock_release(&lock->spin_lock);
+#if OPT_LOCKSTAT
+                lock->lk_stamp = lockstat_now();
+                lockstat_acquired(lock, lock->lk_name, true, start,
+                                  lock->lk_stamp);
+#endif
+                return;
         }
         KASSERT(lock->taken == false); // Ensure that lock is not taken
         lock->taken = true; 
         lock->lk_holder = curthread; 
+        lock->lk_holdercpu = curcpu->c_self;
+        lock->lk_acquires++;
         spinlock_release(&lock->spin_lock);  
+#if OPT_LOCKSTAT
+        lock->lk_stamp = lockstat_now();
+        lockstat_acquired(lock, lock->lk_name, contended || spins > 0,
+                          start, lock->lk_stamp);
+#endif
         //(void)lock;  // suppress warning until code gets written
 }
 
@@ -203,11 +295,30 @@ void
 lock_release(struct lock *lock)
 {
         // Write this
+        struct thread *next;
+
         KASSERT(lock != NULL); 
+        KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKSTAT
+        lockstat_released(lock, lock->lk_name, lock->lk_stamp);
+#endif
         spinlock_acquire(&lock->spin_lock); // Acquire the spin lock to avoid race conditions 
-        lock->taken = false; 
-        lock->lk_holder = NULL; 
-        wchan_wakeone(lock->lk_wchan, &lock->spin_lock); 
+        next = wchan_wakeone(lock->lk_wchan, &lock->spin_lock); 
+        if(next != NULL){
+                /*
+                 * Hand off: the lock stays taken and now belongs to
+                 * the thread we woke. It can't run until we drop the
+                 * spinlock, so it sees the new owner when it does.
+                 */
+                lock->lk_holder = next;
+                lock->lk_holdercpu = NULL;
+        }
+        else{
+                lock->taken = false; 
+                lock->lk_holder = NULL; 
+                lock->lk_holdercpu = NULL;
+        }
         spinlock_release(&lock->spin_lock); 
         // (void)lock;  // suppress warning until code gets written
 }
@@ -267,6 +378,13 @@ cv_destroy(struct cv *cv)
         kfree(cv);
 }
 
+/*
+ * cv_signal and cv_broadcast don't wake anyone up directly. Since the
+ * caller holds the lock, a woken waiter would only go back to sleep on
+ * it. Instead the waiters are moved ("morphed") onto the lock's wait
+ * channel, and lock_release hands the lock to them one at a time.
+ * Thus when cv_wait's sleep returns, the lock is already held.
+ */
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
@@ -280,8 +398,7 @@ cv_wait(struct cv *cv, struct lock *lock)
         wchan_sleep(cv->cv_wchan, &cv->spin_lock); 
         spinlock_release(&cv->spin_lock); 
 
-        lock_acquire(lock); 
-
+        KASSERT(lock_do_i_hold(lock));
 }
 
 void
@@ -293,7 +410,10 @@ cv_signal(struct cv *cv, struct lock *lock)
         KASSERT(lock_do_i_hold(lock));
 
         spinlock_acquire(&cv->spin_lock); 
-        wchan_wakeone(cv->cv_wchan, &cv->spin_lock); // wake one thread
+        spinlock_acquire(&lock->spin_lock);
+        wchan_moveone(cv->cv_wchan, &cv->spin_lock,
+                      lock->lk_wchan, &lock->spin_lock); // requeue one thread
+        spinlock_release(&lock->spin_lock);
         spinlock_release(&cv->spin_lock); 
 }
 
@@ -305,6 +425,140 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         KASSERT(cv != NULL); 
         KASSERT(lock_do_i_hold(lock)); // Ensure that current thread holds the lock
         spinlock_acquire(&cv->spin_lock); 
-        wchan_wakeall(cv->cv_wchan, &cv->spin_lock); // wake all threads
+        spinlock_acquire(&lock->spin_lock);
+        wchan_moveall(cv->cv_wchan, &cv->spin_lock,
+                      lock->lk_wchan, &lock->spin_lock); // requeue all threads
+        spinlock_release(&lock->spin_lock);
         spinlock_release(&cv->spin_lock); 
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rwlock;
+
+        rwlock = kmalloc(sizeof(struct rwlock));
+        if (rwlock == NULL) {
+                return NULL;
+        }
+
+        rwlock->rwlock_name = kstrdup(name);
+        if (rwlock->rwlock_name == NULL) {
+                kfree(rwlock);
+                return NULL;
+        }
+
+        rwlock->rw_readwchan = wchan_create(rwlock->rwlock_name);
+        if (rwlock->rw_readwchan == NULL) {
+                kfree(rwlock->rwlock_name);
+                kfree(rwlock);
+                return NULL;
+        }
+
+        rwlock->rw_writewchan = wchan_create(rwlock->rwlock_name);
+        if (rwlock->rw_writewchan == NULL) {
+                wchan_destroy(rwlock->rw_readwchan);
+                kfree(rwlock->rwlock_name);
+                kfree(rwlock);
+                return NULL;
+        }
+
+        spinlock_init(&rwlock->rw_lock);
+        rwlock->rw_readers = 0;
+        rwlock->rw_waitwriters = 0;
+        rwlock->rw_writer = NULL;
+
+        return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(rwlock->rw_readers == 0);
+        KASSERT(rwlock->rw_waitwriters == 0);
+        KASSERT(rwlock->rw_writer == NULL);
+
+        spinlock_cleanup(&rwlock->rw_lock);
+        wchan_destroy(rwlock->rw_writewchan);
+        wchan_destroy(rwlock->rw_readwchan);
+        kfree(rwlock->rwlock_name);
+        kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        /* Writer preference: queue behind waiting writers too */
+        while (rwlock->rw_writer != NULL || rwlock->rw_waitwriters > 0) {
+                wchan_sleep(rwlock->rw_readwchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_readers++;
+        spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_readers > 0);
+        KASSERT(rwlock->rw_writer == NULL);
+        rwlock->rw_readers--;
+        if (rwlock->rw_readers == 0) {
+                /* Last reader out lets one writer in */
+                wchan_wakeone(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer != curthread);
+        rwlock->rw_waitwriters++;
+        while (rwlock->rw_writer != NULL || rwlock->rw_readers > 0) {
+                wchan_sleep(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_waitwriters--;
+        rwlock->rw_writer = curthread;
+        spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer == curthread);
+        KASSERT(rwlock->rw_readers == 0);
+        rwlock->rw_writer = NULL;
+        if (rwlock->rw_waitwriters > 0) {
+                wchan_wakeone(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        else {
+                /* No writers left; let all the waiting readers in at once */
+                wchan_wakeall(rwlock->rw_readwchan, &rwlock->rw_lock);
+        }
+        spinlock_release(&rwlock->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rwlock)
+{
+        return (rwlock->rw_writer == curthread);
+}
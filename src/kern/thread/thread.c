@@ -1039,9 +1039,10 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Wake up one thread sleeping on a wait channel. Returns the thread
+ * woken, if any.
  */
-void
+struct thread *
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
@@ -1053,7 +1054,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	/*
@@ -1065,6 +1066,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 */
 
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1100,6 +1102,48 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one thread sleeping on FROM onto TO, without waking it. This
+ * is used to requeue a thread from a condition variable directly onto
+ * the wait channel of the lock it will need next.
+ */
+void
+wchan_moveone(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	target = threadlist_remhead(&from->wc_threads);
+	if (target == NULL) {
+		return;
+	}
+	KASSERT(target->t_state == S_SLEEP);
+	target->t_wchan_name = to->wc_name;
+	threadlist_addtail(&to->wc_threads, target);
+}
+
+/*
+ * Move all threads sleeping on FROM onto TO, in order.
+ */
+void
+wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		KASSERT(target->t_state == S_SLEEP);
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -0,0 +1,410 @@
+/*
+ * Block I/O request queues.
+ *
+ * Queues are made on first use, one per device, and never go away;
+ * there are only a handful of disks. Each has a worker thread that
+ * takes a run of requests off the queue, does them as one device
+ * transfer, and finishes them.
+ *
+ * The queue is a list sorted by block, with requests for the same
+ * block kept in the order they arrived. bq_pos is the block just past
+ * the end of the last transfer; the next run starts at the first
+ * request at or past it, or at the front of the list if there is
+ * none (C-LOOK). A run is that request plus the ones after it in the
+ * list that continue it exactly, in the same direction, up to
+ * BIO_MAXMERGE requests or BIO_MAXBYTES bytes.
+ *
+ * bio_lock protects all the queues, the counters, and bio_finished.
+ * It is not held across device I/O or completion callbacks.
+ *
+ * Threads in bio_io wait on one of BIO_NDONECV condition variables,
+ * picked by hashing the address of their bio, and finishing a bio
+ * wakes only that one. Unless two waiters' bios happen to share a
+ * slot, that's just the thread that submitted it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <uio.h>
+#include <device.h>
+#include <bio.h>
+
+#define BIO_MAXMERGE 64			/* requests per transfer */
+#define BIO_MAXBYTES 65536		/* bytes per transfer */
+#define BIO_NDONECV 32			/* wait slots for bio_io */
+
+struct bioqueue {
+	struct device *bq_dev;
+	struct bio *bq_head;		/* pending requests, by block */
+	unsigned bq_count;		/* length of that list */
+	daddr_t bq_pos;			/* block after the last transfer */
+	struct cv *bq_cv;		/* signalled when work is queued */
+	struct iovec bq_iov[BIO_MAXMERGE]; /* worker's; no lock needed */
+	struct bioqueue *bq_next;
+};
+
+static struct lock *bio_lock;
+static struct cv *bio_donecv[BIO_NDONECV]; /* where bio_io waits */
+static struct bioqueue *bio_queues;
+
+static struct {
+	unsigned long requests;		/* bios submitted */
+	unsigned long transfers;	/* device transfers done */
+	unsigned long merged;		/* bios that joined another's transfer */
+	unsigned long blocks;		/* blocks transferred */
+	unsigned long wraps;		/* times the elevator went back down */
+	unsigned long errors;		/* bios that failed */
+	unsigned maxdepth;		/* longest any queue has been */
+} bio_stats;
+
+////////////////////////////////////////////////////////////
+// Doing the I/O
+
+/*
+ * The condition variable bio_io waits on for BIO.
+ */
+static
+struct cv *
+bio_waitcv(struct bio *bio)
+{
+	return bio_donecv[((uintptr_t)bio / sizeof(*bio)) % BIO_NDONECV];
+}
+
+/*
+ * Do the requests on the list RUN, which are all for consecutive
+ * blocks of DEV in the same direction, as one transfer through the
+ * iovecs IOV. Returns the result.
+ */
+static
+int
+bio_transfer(struct device *dev, struct bio *run, struct iovec *iov)
+{
+	struct bio *bio;
+	struct uio ku;
+	unsigned n;
+
+	ku.uio_resid = 0;
+	n = 0;
+	for (bio = run; bio != NULL; bio = bio->bio_next) {
+		iov[n].iov_kbase = bio->bio_data;
+		iov[n].iov_len = bio->bio_len;
+		ku.uio_resid += bio->bio_len;
+		n++;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)run->bio_block * dev->d_blocksize;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = run->bio_rw;
+	ku.uio_space = NULL;
+	ku.uio_ra = NULL;
+	return DEVOP_IO(dev, &ku);
+}
+
+/*
+ * Finish every request on the list RUN: set its result, and wake up
+ * whoever is waiting in bio_io or call its callback. A request
+ * belongs to its owner again as soon as it's finished, so don't look
+ * at it afterwards.
+ */
+static
+void
+bio_finish(struct bio *run, int result)
+{
+	struct bio *bio, *next, *callbacks, **tail;
+
+	callbacks = NULL;
+	tail = &callbacks;
+
+	lock_acquire(bio_lock);
+	for (bio = run; bio != NULL; bio = next) {
+		next = bio->bio_next;
+		bio->bio_next = NULL;
+		bio->bio_error = result;
+		if (result) {
+			bio_stats.errors++;
+		}
+		if (bio->bio_done == NULL) {
+			bio->bio_finished = true;
+			cv_broadcast(bio_waitcv(bio), bio_lock);
+		}
+		else {
+			*tail = bio;
+			tail = &bio->bio_next;
+		}
+	}
+	lock_release(bio_lock);
+
+	for (bio = callbacks; bio != NULL; bio = next) {
+		next = bio->bio_next;
+		bio->bio_next = NULL;
+		bio->bio_done(bio);
+	}
+}
+
+/*
+ * Do a run and finish its requests. If a merged transfer fails, do
+ * the requests one at a time instead, so that only the ones that
+ * really failed see an error.
+ */
+static
+void
+bio_dispatch(struct device *dev, struct bio *run, struct iovec *iov)
+{
+	struct bio *bio;
+	int result;
+
+	result = bio_transfer(dev, run, iov);
+	if (result == 0 || run->bio_next == NULL) {
+		bio_finish(run, result);
+		return;
+	}
+	while (run != NULL) {
+		bio = run;
+		run = run->bio_next;
+		bio->bio_next = NULL;
+		bio_finish(bio, bio_transfer(dev, bio, iov));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Queues
+
+/*
+ * Take the next run off BQ and return it as a list. Called with
+ * bio_lock held; the queue must not be empty.
+ */
+static
+struct bio *
+bio_takerun(struct bioqueue *bq)
+{
+	struct bio **pp, *first, *last, *next;
+	blksize_t bsize = bq->bq_dev->d_blocksize;
+	size_t bytes;
+	unsigned n;
+
+	KASSERT(bq->bq_head != NULL);
+
+	for (pp = &bq->bq_head; *pp != NULL; pp = &(*pp)->bio_next) {
+		if ((*pp)->bio_block >= bq->bq_pos) {
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		pp = &bq->bq_head;
+		bio_stats.wraps++;
+	}
+
+	first = last = *pp;
+	bytes = first->bio_len;
+	n = 1;
+	while (last->bio_next != NULL && n < BIO_MAXMERGE) {
+		next = last->bio_next;
+		if (next->bio_block != last->bio_block + last->bio_len / bsize ||
+		    next->bio_rw != first->bio_rw ||
+		    bytes + next->bio_len > BIO_MAXBYTES) {
+			break;
+		}
+		bytes += next->bio_len;
+		last = next;
+		n++;
+	}
+
+	*pp = last->bio_next;
+	last->bio_next = NULL;
+	bq->bq_count -= n;
+	bq->bq_pos = last->bio_block + last->bio_len / bsize;
+
+	bio_stats.transfers++;
+	bio_stats.merged += n - 1;
+	bio_stats.blocks += bytes / bsize;
+	return first;
+}
+
+/*
+ * Add BIO to BQ, after any requests for the same or lower blocks.
+ * Called with bio_lock held.
+ */
+static
+void
+bio_enqueue(struct bioqueue *bq, struct bio *bio)
+{
+	struct bio **pp;
+
+	for (pp = &bq->bq_head; *pp != NULL; pp = &(*pp)->bio_next) {
+		if ((*pp)->bio_block > bio->bio_block) {
+			break;
+		}
+	}
+	bio->bio_next = *pp;
+	*pp = bio;
+	bq->bq_count++;
+	if (bq->bq_count > bio_stats.maxdepth) {
+		bio_stats.maxdepth = bq->bq_count;
+	}
+	cv_signal(bq->bq_cv, bio_lock);
+}
+
+/*
+ * The worker thread for one queue.
+ */
+static
+void
+bio_worker(void *vbq, unsigned long unused)
+{
+	struct bioqueue *bq = vbq;
+	struct bio *run;
+
+	(void)unused;
+
+	lock_acquire(bio_lock);
+	while (1) {
+		while (bq->bq_head == NULL) {
+			cv_wait(bq->bq_cv, bio_lock);
+		}
+		run = bio_takerun(bq);
+		lock_release(bio_lock);
+
+		bio_dispatch(bq->bq_dev, run, bq->bq_iov);
+
+		lock_acquire(bio_lock);
+	}
+}
+
+/*
+ * Find DEV's queue, making it if necessary. Returns NULL if it can't
+ * be made. Called with bio_lock held.
+ */
+static
+struct bioqueue *
+bio_getqueue(struct device *dev)
+{
+	struct bioqueue *bq;
+
+	for (bq = bio_queues; bq != NULL; bq = bq->bq_next) {
+		if (bq->bq_dev == dev) {
+			return bq;
+		}
+	}
+
+	bq = kmalloc(sizeof(*bq));
+	if (bq == NULL) {
+		return NULL;
+	}
+	bq->bq_cv = cv_create("bioqueue");
+	if (bq->bq_cv == NULL) {
+		kfree(bq);
+		return NULL;
+	}
+	bq->bq_dev = dev;
+	bq->bq_head = NULL;
+	bq->bq_count = 0;
+	bq->bq_pos = 0;
+	if (thread_fork("bioworker", NULL, bio_worker, bq, 0)) {
+		cv_destroy(bq->bq_cv);
+		kfree(bq);
+		return NULL;
+	}
+	bq->bq_next = bio_queues;
+	bio_queues = bq;
+	return bq;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+bio_submit(struct bio *bio)
+{
+	struct bioqueue *bq;
+	struct iovec iov;
+
+	KASSERT(bio->bio_len > 0);
+	KASSERT(bio->bio_len % bio->bio_dev->d_blocksize == 0);
+
+	bio->bio_error = 0;
+	bio->bio_finished = false;
+	bio->bio_next = NULL;
+
+	lock_acquire(bio_lock);
+	bio_stats.requests++;
+	bq = bio_getqueue(bio->bio_dev);
+	if (bq != NULL) {
+		bio_enqueue(bq, bio);
+		lock_release(bio_lock);
+		return;
+	}
+	bio_stats.transfers++;
+	bio_stats.blocks += bio->bio_len / bio->bio_dev->d_blocksize;
+	lock_release(bio_lock);
+
+	/* No queue, so no worker; do it here, without merging. */
+	bio_finish(bio, bio_transfer(bio->bio_dev, bio, &iov));
+}
+
+int
+bio_io(struct bio *bio)
+{
+	bio->bio_done = NULL;
+	bio_submit(bio);
+
+	lock_acquire(bio_lock);
+	while (!bio->bio_finished) {
+		cv_wait(bio_waitcv(bio), bio_lock);
+	}
+	lock_release(bio_lock);
+	return bio->bio_error;
+}
+
+void
+bio_bootstrap(void)
+{
+	unsigned i;
+
+	bio_lock = lock_create("bio_lock");
+	if (bio_lock == NULL) {
+		panic("bio_bootstrap: out of memory\n");
+	}
+	for (i=0; i<BIO_NDONECV; i++) {
+		bio_donecv[i] = cv_create("bio_donecv");
+		if (bio_donecv[i] == NULL) {
+			panic("bio_bootstrap: out of memory\n");
+		}
+	}
+}
+
+void
+bio_printstats(void)
+{
+	struct bioqueue *bq;
+
+	lock_acquire(bio_lock);
+	kprintf("block I/O: %lu requests, %lu transfers, %lu merged, "
+		"%lu errors\n", bio_stats.requests, bio_stats.transfers,
+		bio_stats.merged, bio_stats.errors);
+	kprintf("    %lu blocks, %lu.%02lu blocks per transfer\n",
+		bio_stats.blocks,
+		bio_stats.transfers ? bio_stats.blocks / bio_stats.transfers : 0,
+		bio_stats.transfers ?
+		bio_stats.blocks % bio_stats.transfers * 100 /
+		bio_stats.transfers : 0);
+	kprintf("    %lu elevator wraps, longest queue %u\n",
+		bio_stats.wraps, bio_stats.maxdepth);
+	for (bq = bio_queues; bq != NULL; bq = bq->bq_next) {
+		kprintf("    device %u: %u queued, at block %u\n",
+			(unsigned)bq->bq_dev->d_devnumber, bq->bq_count,
+			bq->bq_pos);
+	}
+	lock_release(bio_lock);
+}
+
+void
+bio_resetstats(void)
+{
+	lock_acquire(bio_lock);
+	bzero(&bio_stats, sizeof(bio_stats));
+	lock_release(bio_lock);
+}
@@ -0,0 +1,886 @@
+/*
+ * Buffer cache.
+ *
+ * Buffers are found through a hash table keyed on (device, block).
+ * Buffers nobody holds or is waiting for are also on an LRU list,
+ * least recently used at the head; those are the ones that can be
+ * recycled for a different block.
+ *
+ * buf_lock protects the hash table, the LRU list, the counters, and
+ * each buffer's identity, refcount, busy and dirty flags. It is never
+ * held across disk I/O: a buffer being read or written is marked busy
+ * instead, which keeps everyone else off it. b_data and b_valid belong
+ * to whoever has the buffer busy.
+ *
+ * Disk I/O goes through the block I/O queues (bio.h), which sort
+ * requests from everyone by block and merge adjacent ones. Ordinary
+ * reads and evictions wait for their I/O; read-ahead and sync don't
+ * wait for each block, but hand the queue a whole batch at once and
+ * finish each buffer from its completion callback.
+ *
+ * Read-ahead requests (buffer_prefetch) go on a small queue that a
+ * kernel thread works through, so the disk reads the next blocks of a
+ * file while the reader is busy with the current one. The queue is a
+ * hint: requests are dropped when it's full.
+ *
+ * Another thread, the syncer, syncs all filesystems every
+ * BUF_SYNCSECS seconds, so dirty blocks don't sit in memory forever,
+ * and writes back dirty buffers early when more than BUF_DIRTYHIGH of
+ * them pile up, so that evictions rarely have to wait for a write.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <bio.h>
+#include <buf.h>
+
+#define BUF_HASHSIZE 127
+#define BUF_RAQUEUE  32
+#define BUF_SYNCSECS 5
+#define BUF_DIRTYHIGH (BUFFER_MAXBUFS / 2)
+#define BUF_MAXTRIES  10
+
+struct buf {
+	struct device *b_dev;		/* device the block is on */
+	daddr_t b_block;		/* block number on the device */
+	char *b_data;			/* BUFFER_SIZE bytes */
+	unsigned b_refcount;		/* holder plus waiters */
+	bool b_busy;			/* held, or under I/O */
+	bool b_valid;			/* b_data has the block's contents */
+	bool b_dirty;			/* b_data needs writing back */
+	struct buf *b_hashnext;		/* hash chain */
+	struct buf *b_lruprev;		/* LRU list, when b_refcount is 0 */
+	struct buf *b_lrunext;
+	struct bio b_bio;		/* for I/O on this buffer */
+	unsigned b_tries;		/* I/O errors on the current write */
+	struct bufsync *b_sync;		/* sync this write is part of */
+	struct buf *b_syncnext;		/* list of those being synced */
+};
+
+/*
+ * A buffer_sync in progress: how many of its writes haven't finished,
+ * and the first error.
+ */
+struct bufsync {
+	unsigned bs_pending;
+	int bs_result;
+};
+
+static struct lock *buf_lock;
+static struct cv *buf_cv;		/* signalled when a buffer is let go */
+static struct buf *buf_hash[BUF_HASHSIZE];
+static struct buf *buf_lruhead;		/* least recently used */
+static struct buf *buf_lrutail;		/* most recently used */
+static unsigned buf_count;		/* buffers allocated */
+static unsigned buf_ndirty;		/* buffers with b_dirty set */
+
+static struct {
+	struct device *dev;
+	daddr_t block;
+} buf_raq[BUF_RAQUEUE];			/* prefetch queue (a ring) */
+static unsigned buf_raqhead;		/* oldest request */
+static unsigned buf_raqcount;		/* requests queued */
+static struct device *buf_radev;	/* device being prefetched from */
+static unsigned buf_rainflight;		/* prefetch reads not finished */
+static struct cv *buf_racv;		/* signalled when work is queued */
+
+static struct {
+	unsigned long hits;		/* found cached and valid */
+	unsigned long misses;		/* not */
+	unsigned long reads;		/* blocks read from disk */
+	unsigned long writes;		/* blocks written to disk */
+	unsigned long evictions;	/* buffers recycled */
+	unsigned long evictwrites;	/* ...that had to be written first */
+	unsigned long prefetches;	/* blocks read ahead */
+	unsigned long radropped;	/* read-ahead requests not queued */
+	unsigned long timedsyncs;	/* syncer runs on the timer */
+	unsigned long dirtysyncs;	/* ...and for too many dirty buffers */
+} buf_stats;
+
+////////////////////////////////////////////////////////////
+// Lists
+
+static
+unsigned
+buf_hashfn(struct device *dev, daddr_t block)
+{
+	return (block ^ ((uintptr_t)dev >> 4)) % BUF_HASHSIZE;
+}
+
+static
+struct buf *
+buf_find(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[buf_hashfn(dev, block)]; b; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hashinsert(struct buf *b)
+{
+	unsigned h = buf_hashfn(b->b_dev, b->b_block);
+
+	b->b_hashnext = buf_hash[h];
+	buf_hash[h] = b;
+}
+
+static
+void
+buf_hashremove(struct buf *b)
+{
+	struct buf **pp;
+
+	pp = &buf_hash[buf_hashfn(b->b_dev, b->b_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+buf_lruremove(struct buf *b)
+{
+	if (b->b_lruprev) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		buf_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		buf_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+buf_lruappend(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = buf_lrutail;
+	if (buf_lrutail) {
+		buf_lrutail->b_lrunext = b;
+	}
+	else {
+		buf_lruhead = b;
+	}
+	buf_lrutail = b;
+}
+
+/*
+ * Take a reference to B, keeping it off the LRU list.
+ */
+static
+void
+buf_pin(struct buf *b)
+{
+	if (b->b_refcount == 0) {
+		buf_lruremove(b);
+	}
+	b->b_refcount++;
+}
+
+/*
+ * Drop a reference to B, and the busy flag if BUSY.
+ */
+static
+void
+buf_unpin(struct buf *b, bool busy)
+{
+	KASSERT(b->b_refcount > 0);
+	if (busy) {
+		KASSERT(b->b_busy);
+		b->b_busy = false;
+		cv_broadcast(buf_cv, buf_lock);
+	}
+	b->b_refcount--;
+	if (b->b_refcount == 0) {
+		buf_lruappend(b);
+	}
+}
+
+static
+void
+buf_setclean(struct buf *b)
+{
+	if (b->b_dirty) {
+		b->b_dirty = false;
+		KASSERT(buf_ndirty > 0);
+		buf_ndirty--;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// I/O
+
+/*
+ * Set up B's bio for reading or writing its block.
+ */
+static
+void
+buf_bioinit(struct buf *b, enum uio_rw rw, void (*done)(struct bio *))
+{
+	b->b_bio.bio_dev = b->b_dev;
+	b->b_bio.bio_block = b->b_block;
+	b->b_bio.bio_data = b->b_data;
+	b->b_bio.bio_len = BUFFER_SIZE;
+	b->b_bio.bio_rw = rw;
+	b->b_bio.bio_done = done;
+	b->b_bio.bio_arg = b;
+}
+
+/*
+ * Decide what to do about the result of I/O on B, which was try
+ * number TRIES: returns true to try again.
+ */
+static
+bool
+buf_retry(struct buf *b, int result, unsigned tries)
+{
+	if (result == EINVAL) {
+		/*
+		 * The block was out of range, or something else that's
+		 * our fault rather than the disk's.
+		 */
+		panic("buf: DEVOP_IO returned EINVAL\n");
+	}
+	if (result != EIO) {
+		return false;
+	}
+	if (tries == 0) {
+		kprintf("buf: block %u I/O error, retrying\n", b->b_block);
+	}
+	if (tries < BUF_MAXTRIES) {
+		return true;
+	}
+	kprintf("buf: block %u I/O error, giving up after %u retries\n",
+		b->b_block, tries);
+	return false;
+}
+
+/*
+ * Read or write B, which the caller has busy, retrying I/O errors.
+ * Called without buf_lock.
+ */
+static
+int
+buf_io(struct buf *b, enum uio_rw rw)
+{
+	unsigned tries = 0;
+	int result;
+
+	KASSERT(b->b_busy);
+
+	do {
+		buf_bioinit(b, rw, NULL);
+		result = bio_io(&b->b_bio);
+	} while (buf_retry(b, result, tries++));
+	return result;
+}
+
+/*
+ * Write back dirty buffer B, which the caller has pinned and busy.
+ * Called and returns with buf_lock held.
+ */
+static
+int
+buf_writeback(struct buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy && b->b_dirty);
+
+	lock_release(buf_lock);
+	result = buf_io(b, UIO_WRITE);
+	lock_acquire(buf_lock);
+
+	if (result == 0) {
+		buf_setclean(b);
+		buf_stats.writes++;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Getting buffers
+
+/*
+ * Allocate a fresh buffer, returned pinned and busy.
+ */
+static
+struct buf *
+buf_create(void)
+{
+	struct buf *b;
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(BUFFER_SIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_valid = b->b_dirty = false;
+	b->b_hashnext = b->b_lruprev = b->b_lrunext = NULL;
+	b->b_tries = 0;
+	b->b_sync = NULL;
+	b->b_syncnext = NULL;
+	b->b_refcount = 1;
+	b->b_busy = true;
+	buf_count++;
+	return b;
+}
+
+/*
+ * Find a buffer to hold a block that isn't cached: make a new one if
+ * we're under the limit, otherwise recycle the least recently used.
+ * On success *RET is pinned and busy but not hashed, or NULL if the
+ * one we picked turned out to be wanted after all (look the block up
+ * again and retry). Called with buf_lock held; may release and retake
+ * it.
+ */
+static
+int
+buf_newbuf(struct buf **ret)
+{
+	struct buf *b;
+
+	*ret = NULL;
+	if (buf_count < BUFFER_MAXBUFS || buf_lruhead == NULL) {
+		*ret = buf_create();
+		if (*ret != NULL) {
+			return 0;
+		}
+		if (buf_lruhead == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	b = buf_lruhead;
+	buf_pin(b);
+	b->b_busy = true;
+	buf_stats.evictions++;
+
+	if (b->b_dirty) {
+		buf_stats.evictwrites++;
+		if (buf_writeback(b) || b->b_refcount > 1) {
+			/*
+			 * Couldn't write it, or someone wants this
+			 * block after all. Leave it be.
+			 */
+			buf_unpin(b, true);
+			return 0;
+		}
+	}
+
+	if (b->b_dev != NULL) {
+		buf_hashremove(b);
+		b->b_dev = NULL;
+	}
+	b->b_valid = false;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Common code for buffer_read and buffer_get.
+ */
+static
+int
+buf_acquire(struct device *dev, daddr_t block, bool doread, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(dev->d_blocksize == BUFFER_SIZE);
+
+	lock_acquire(buf_lock);
+	while (1) {
+		b = buf_find(dev, block);
+		if (b != NULL) {
+			buf_pin(b);
+			while (b->b_busy) {
+				cv_wait(buf_cv, buf_lock);
+			}
+			b->b_busy = true;
+			if (b->b_valid) {
+				buf_stats.hits++;
+			}
+			else {
+				buf_stats.misses++;
+			}
+			break;
+		}
+
+		result = buf_newbuf(&b);
+		if (result) {
+			lock_release(buf_lock);
+			return result;
+		}
+		if (b == NULL) {
+			continue;
+		}
+		if (buf_find(dev, block) != NULL) {
+			/* Someone cached it while we were writing back */
+			buf_unpin(b, true);
+			continue;
+		}
+		b->b_dev = dev;
+		b->b_block = block;
+		buf_hashinsert(b);
+		buf_stats.misses++;
+		break;
+	}
+	lock_release(buf_lock);
+
+	if (doread && !b->b_valid) {
+		result = buf_io(b, UIO_READ);
+		lock_acquire(buf_lock);
+		if (result) {
+			buf_unpin(b, true);
+			lock_release(buf_lock);
+			return result;
+		}
+		buf_stats.reads++;
+		lock_release(buf_lock);
+		b->b_valid = true;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+int
+buffer_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	return buf_acquire(dev, block, true, ret);
+}
+
+int
+buffer_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	return buf_acquire(dev, block, false, ret);
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+daddr_t
+buffer_block(struct buf *b)
+{
+	return b->b_block;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+	if (!b->b_dirty) {
+		lock_acquire(buf_lock);
+		b->b_dirty = true;
+		buf_ndirty++;
+		lock_release(buf_lock);
+	}
+}
+
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buf_lock);
+	buf_unpin(b, true);
+	lock_release(buf_lock);
+}
+
+void
+buffer_forget(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+	b = buf_find(dev, block);
+	if (b != NULL && !b->b_busy) {
+		buf_setclean(b);
+		b->b_valid = false;
+	}
+	lock_release(buf_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Read-ahead
+
+void
+buffer_prefetch(struct device *dev, daddr_t block)
+{
+	unsigned i;
+
+	lock_acquire(buf_lock);
+	if (buf_find(dev, block) != NULL) {
+		/* Cached already, or someone is reading it */
+		lock_release(buf_lock);
+		return;
+	}
+	for (i=0; i<buf_raqcount; i++) {
+		unsigned slot = (buf_raqhead + i) % BUF_RAQUEUE;
+		if (buf_raq[slot].dev == dev && buf_raq[slot].block == block) {
+			lock_release(buf_lock);
+			return;
+		}
+	}
+	if (buf_raqcount == BUF_RAQUEUE) {
+		buf_stats.radropped++;
+		lock_release(buf_lock);
+		return;
+	}
+	i = (buf_raqhead + buf_raqcount) % BUF_RAQUEUE;
+	buf_raq[i].dev = dev;
+	buf_raq[i].block = block;
+	buf_raqcount++;
+	cv_signal(buf_racv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * Completion callback for a read-ahead. Errors aren't retried; the
+ * buffer is left invalid and whoever wants the block reads it again.
+ */
+static
+void
+buf_prefetchdone(struct bio *bio)
+{
+	struct buf *b = bio->bio_arg;
+
+	lock_acquire(buf_lock);
+	if (bio->bio_error == 0) {
+		b->b_valid = true;
+		buf_stats.reads++;
+		buf_stats.prefetches++;
+	}
+	KASSERT(buf_rainflight > 0);
+	buf_rainflight--;
+	buf_unpin(b, true);
+	lock_release(buf_lock);
+}
+
+/*
+ * Start reading BLOCK of DEV into the cache, unless it's there
+ * already. Doesn't wait for the read. Called with buf_lock held;
+ * releases and retakes it.
+ */
+static
+void
+buf_prefetchone(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	do {
+		if (buf_find(dev, block) != NULL) {
+			return;
+		}
+		if (buf_newbuf(&b)) {
+			return;
+		}
+	} while (b == NULL);
+
+	if (buf_find(dev, block) != NULL) {
+		buf_unpin(b, true);
+		return;
+	}
+	b->b_dev = dev;
+	b->b_block = block;
+	buf_hashinsert(b);
+	buf_rainflight++;
+	lock_release(buf_lock);
+
+	buf_bioinit(b, UIO_READ, buf_prefetchdone);
+	bio_submit(&b->b_bio);
+
+	lock_acquire(buf_lock);
+}
+
+/*
+ * The prefetch thread.
+ */
+static
+void
+buf_prefetcher(void *unused1, unsigned long unused2)
+{
+	struct device *dev;
+	daddr_t block;
+
+	(void)unused1;
+	(void)unused2;
+
+	lock_acquire(buf_lock);
+	while (1) {
+		while (buf_raqcount == 0) {
+			cv_wait(buf_racv, buf_lock);
+		}
+		dev = buf_raq[buf_raqhead].dev;
+		block = buf_raq[buf_raqhead].block;
+		buf_raqhead = (buf_raqhead + 1) % BUF_RAQUEUE;
+		buf_raqcount--;
+
+		buf_radev = dev;
+		buf_prefetchone(dev, block);
+		buf_radev = NULL;
+
+		/* buffer_drop may be waiting for us to be done with DEV */
+		cv_broadcast(buf_cv, buf_lock);
+	}
+}
+
+/*
+ * Throw away queued prefetches for DEV, and wait for those in
+ * progress to finish. (Those for other devices too; it's simpler, and
+ * they don't take long.) Called with buf_lock held.
+ */
+static
+void
+buf_cancelprefetch(struct device *dev)
+{
+	unsigned i, slot, keep;
+
+	keep = 0;
+	for (i=0; i<buf_raqcount; i++) {
+		slot = (buf_raqhead + i) % BUF_RAQUEUE;
+		if (buf_raq[slot].dev != dev) {
+			buf_raq[(buf_raqhead + keep) % BUF_RAQUEUE] =
+				buf_raq[slot];
+			keep++;
+		}
+	}
+	buf_raqcount = keep;
+
+	while (buf_radev == dev || buf_rainflight > 0) {
+		cv_wait(buf_cv, buf_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Syncer
+
+/*
+ * The syncer thread. It looks at the dirty count once a second.
+ */
+static
+void
+buf_syncer(void *unused1, unsigned long unused2)
+{
+	unsigned secs = 0;
+	bool toomany;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+		secs++;
+
+		lock_acquire(buf_lock);
+		toomany = buf_ndirty > BUF_DIRTYHIGH;
+		if (secs >= BUF_SYNCSECS) {
+			buf_stats.timedsyncs++;
+		}
+		else if (toomany) {
+			buf_stats.dirtysyncs++;
+		}
+		lock_release(buf_lock);
+
+		if (secs >= BUF_SYNCSECS) {
+			/* Inodes and freemaps too, not just the buffers */
+			vfs_sync();
+			secs = 0;
+		}
+		else if (toomany) {
+			buffer_sync(NULL);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Whole-cache operations
+
+/*
+ * Completion callback for a write issued by buffer_sync.
+ */
+static
+void
+buf_syncdone(struct bio *bio)
+{
+	struct buf *b = bio->bio_arg;
+	struct bufsync *bs = b->b_sync;
+
+	if (buf_retry(b, bio->bio_error, b->b_tries++)) {
+		bio_submit(bio);
+		return;
+	}
+
+	lock_acquire(buf_lock);
+	if (bio->bio_error == 0) {
+		buf_setclean(b);
+		buf_stats.writes++;
+	}
+	else if (bs->bs_result == 0) {
+		bs->bs_result = bio->bio_error;
+	}
+	b->b_sync = NULL;
+	KASSERT(bs->bs_pending > 0);
+	bs->bs_pending--;
+	buf_unpin(b, true);
+	lock_release(buf_lock);
+}
+
+/*
+ * Write back every dirty buffer of DEV (or all of them) that nobody
+ * has busy. They're all handed to the I/O queue at once, so it can
+ * sort and merge them, and then we wait for the lot.
+ */
+int
+buffer_sync(struct device *dev)
+{
+	struct bufsync bs;
+	struct buf *b, *list;
+	unsigned i;
+
+	bs.bs_pending = 0;
+	bs.bs_result = 0;
+	list = NULL;
+
+	lock_acquire(buf_lock);
+	for (i=0; i<BUF_HASHSIZE; i++) {
+		for (b = buf_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (!b->b_dirty || b->b_busy) {
+				continue;
+			}
+			if (dev != NULL && b->b_dev != dev) {
+				continue;
+			}
+			buf_pin(b);
+			b->b_busy = true;
+			b->b_sync = &bs;
+			b->b_tries = 0;
+			b->b_syncnext = list;
+			list = b;
+			bs.bs_pending++;
+		}
+	}
+	lock_release(buf_lock);
+
+	/* The callbacks take buf_lock, so submit without it. */
+	while (list != NULL) {
+		b = list;
+		list = b->b_syncnext;
+		b->b_syncnext = NULL;
+		buf_bioinit(b, UIO_WRITE, buf_syncdone);
+		bio_submit(&b->b_bio);
+	}
+
+	lock_acquire(buf_lock);
+	while (bs.bs_pending > 0) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+	return bs.bs_result;
+}
+
+void
+buffer_drop(struct device *dev)
+{
+	struct buf *b, *next;
+	unsigned i;
+
+	lock_acquire(buf_lock);
+	buf_cancelprefetch(dev);
+	for (i=0; i<BUF_HASHSIZE; i++) {
+		for (b = buf_hash[i]; b != NULL; b = next) {
+			next = b->b_hashnext;
+			if (b->b_dev != dev) {
+				continue;
+			}
+			KASSERT(b->b_refcount == 0);
+			KASSERT(!b->b_dirty);
+			buf_hashremove(b);
+			buf_lruremove(b);
+			kfree(b->b_data);
+			kfree(b);
+			buf_count--;
+		}
+	}
+	lock_release(buf_lock);
+}
+
+void
+buffer_bootstrap(void)
+{
+	buf_lock = lock_create("buf_lock");
+	buf_cv = cv_create("buf_cv");
+	buf_racv = cv_create("buf_racv");
+	if (buf_lock == NULL || buf_cv == NULL || buf_racv == NULL) {
+		panic("buffer_bootstrap: out of memory\n");
+	}
+	if (thread_fork("bufprefetch", NULL, buf_prefetcher, NULL, 0)) {
+		panic("buffer_bootstrap: cannot start prefetch thread\n");
+	}
+	if (thread_fork("bufsyncer", NULL, buf_syncer, NULL, 0)) {
+		panic("buffer_bootstrap: cannot start syncer thread\n");
+	}
+}
+
+void
+buffer_printstats(void)
+{
+	unsigned long lookups;
+
+	lock_acquire(buf_lock);
+	lookups = buf_stats.hits + buf_stats.misses;
+	kprintf("buffer cache: %u buffers (max %u), %u dirty\n",
+		buf_count, BUFFER_MAXBUFS, buf_ndirty);
+	kprintf("    %lu lookups, %lu hits, %lu misses (%lu%% hit)\n",
+		lookups, buf_stats.hits, buf_stats.misses,
+		lookups ? buf_stats.hits * 100 / lookups : 0);
+	kprintf("    %lu disk reads, %lu disk writes, %lu evictions "
+		"(%lu dirty)\n", buf_stats.reads, buf_stats.writes,
+		buf_stats.evictions, buf_stats.evictwrites);
+	kprintf("    %lu blocks read ahead, %lu read-ahead requests "
+		"dropped\n", buf_stats.prefetches, buf_stats.radropped);
+	kprintf("    %lu timed syncs, %lu syncs for too many dirty\n",
+		buf_stats.timedsyncs, buf_stats.dirtysyncs);
+	lock_release(buf_lock);
+}
+
+void
+buffer_resetstats(void)
+{
+	lock_acquire(buf_lock);
+	bzero(&buf_stats, sizeof(buf_stats));
+	lock_release(buf_lock);
+}
@@ -572,6 +572,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* the name cache holds vnodes; let go of them */
+	vfs_dcache_purge(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -607,6 +610,8 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
+	vfs_dcache_purge(NULL);
+
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
@@ -29,10 +29,28 @@
 
 /*
  * VFS operations relating to pathname translation
+ *
+ * Paths are looked up one component at a time, through a cache of
+ * names (the dcache) that maps (directory vnode, name) to the vnode
+ * the name refers to, or to "no such file" for names that were looked
+ * for and not found. Entries hold references to both vnodes, so the
+ * directory pointer can't be reused for something else while an
+ * entry names it. There are at most DCACHE_SIZE entries; the least
+ * recently used one is recycled when more are needed.
+ *
+ * Whoever adds, removes, or changes a name (vfspath.c) must call
+ * vfs_dcache_invalidate afterwards. The dcache is protected by
+ * vfs_biglock, which vfs_lookup and vfs_lookparent hold from before
+ * asking the filesystem until the answer is entered, so an
+ * invalidation can't slip in between and leave a stale entry behind.
+ *
+ * "." and "..", and names longer than DCACHE_NAMELEN, aren't cached;
+ * neither are lookups in device vnodes.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <stat.h>
 #include <limits.h>
 #include <lib.h>
 #include <synch.h>
@@ -40,6 +58,34 @@
 #include <fs.h>
 #include <vnode.h>
 
+#define DCACHE_SIZE     256
+#define DCACHE_HASHSIZE 127
+#define DCACHE_NAMELEN  31
+
+struct dcentry {
+	struct vnode *dc_dir;		/* directory the name is in */
+	struct vnode *dc_vn;		/* what it refers to; NULL if nothing */
+	char dc_name[DCACHE_NAMELEN+1];
+	struct dcentry *dc_hashnext;	/* hash chain, or free list */
+	struct dcentry *dc_lruprev;	/* LRU list */
+	struct dcentry *dc_lrunext;
+};
+
+static struct dcentry dcache_entries[DCACHE_SIZE];
+static unsigned dcache_nused;		/* entries ever handed out */
+static struct dcentry *dcache_free;	/* entries given back */
+static struct dcentry *dcache_hash[DCACHE_HASHSIZE];
+static struct dcentry *dcache_lruhead;	/* least recently used */
+static struct dcentry *dcache_lrutail;	/* most recently used */
+
+static struct {
+	unsigned long hits;		/* found a vnode */
+	unsigned long neghits;		/* found "no such file" */
+	unsigned long misses;		/* had to ask the filesystem */
+	unsigned long evictions;	/* entries recycled */
+	unsigned long invalidations;	/* entries removed for a change */
+} dcache_stats;
+
 static struct vnode *bootfs_vnode = NULL;
 
 /*
@@ -120,6 +166,340 @@ vfs_clearbootfs(void)
 }
 
 
+////////////////////////////////////////////////////////////
+// Name cache
+
+static
+unsigned
+dcache_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % DCACHE_HASHSIZE;
+}
+
+static
+bool
+dcache_cacheable(struct vnode *dir, const char *name)
+{
+	if (dir->vn_fs == NULL) {
+		/* device */
+		return false;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return false;
+	}
+	return strlen(name) <= DCACHE_NAMELEN;
+}
+
+static
+struct dcentry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+
+	dc = dcache_hash[dcache_hashfn(dir, name)];
+	while (dc != NULL) {
+		if (dc->dc_dir == dir && !strcmp(dc->dc_name, name)) {
+			return dc;
+		}
+		dc = dc->dc_hashnext;
+	}
+	return NULL;
+}
+
+static
+void
+dcache_lruremove(struct dcentry *dc)
+{
+	if (dc->dc_lruprev) {
+		dc->dc_lruprev->dc_lrunext = dc->dc_lrunext;
+	}
+	else {
+		dcache_lruhead = dc->dc_lrunext;
+	}
+	if (dc->dc_lrunext) {
+		dc->dc_lrunext->dc_lruprev = dc->dc_lruprev;
+	}
+	else {
+		dcache_lrutail = dc->dc_lruprev;
+	}
+	dc->dc_lruprev = dc->dc_lrunext = NULL;
+}
+
+static
+void
+dcache_lruappend(struct dcentry *dc)
+{
+	dc->dc_lrunext = NULL;
+	dc->dc_lruprev = dcache_lrutail;
+	if (dcache_lrutail) {
+		dcache_lrutail->dc_lrunext = dc;
+	}
+	else {
+		dcache_lruhead = dc;
+	}
+	dcache_lrutail = dc;
+}
+
+/*
+ * Take DC out of the cache and put it on the free list. Drops the
+ * references it held, which may reclaim the vnodes.
+ */
+static
+void
+dcache_remove(struct dcentry *dc)
+{
+	struct dcentry **pp;
+	struct vnode *dir, *vn;
+
+	pp = &dcache_hash[dcache_hashfn(dc->dc_dir, dc->dc_name)];
+	while (*pp != dc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->dc_hashnext;
+	}
+	*pp = dc->dc_hashnext;
+	dcache_lruremove(dc);
+
+	dir = dc->dc_dir;
+	vn = dc->dc_vn;
+	dc->dc_dir = dc->dc_vn = NULL;
+	dc->dc_hashnext = dcache_free;
+	dcache_free = dc;
+
+	/* Do this last; the cache must be consistent if it recurses */
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	VOP_DECREF(dir);
+}
+
+/*
+ * Remember that NAME in DIR is VN (NULL for no such file).
+ */
+static
+void
+dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcentry *dc;
+	unsigned h;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(dcache_cacheable(dir, name));
+
+	dc = dcache_find(dir, name);
+	if (dc != NULL) {
+		dcache_remove(dc);
+	}
+
+	if (dcache_free == NULL && dcache_nused == DCACHE_SIZE) {
+		dcache_stats.evictions++;
+		dcache_remove(dcache_lruhead);
+	}
+	if (dcache_free != NULL) {
+		dc = dcache_free;
+		dcache_free = dc->dc_hashnext;
+	}
+	else {
+		dc = &dcache_entries[dcache_nused++];
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	dc->dc_dir = dir;
+	dc->dc_vn = vn;
+	strcpy(dc->dc_name, name);
+
+	h = dcache_hashfn(dir, name);
+	dc->dc_hashnext = dcache_hash[h];
+	dcache_hash[h] = dc;
+	dcache_lruappend(dc);
+}
+
+/*
+ * Look up NAME, a single path component, in DIR.
+ */
+static
+int
+dcache_lookup(struct vnode *dir, char *name, struct vnode **ret)
+{
+	char key[DCACHE_NAMELEN+1];
+	struct dcentry *dc;
+	bool cacheable;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	cacheable = dcache_cacheable(dir, name);
+	if (cacheable) {
+		dc = dcache_find(dir, name);
+		if (dc != NULL) {
+			dcache_lruremove(dc);
+			dcache_lruappend(dc);
+			if (dc->dc_vn == NULL) {
+				dcache_stats.neghits++;
+				return ENOENT;
+			}
+			dcache_stats.hits++;
+			VOP_INCREF(dc->dc_vn);
+			*ret = dc->dc_vn;
+			return 0;
+		}
+		dcache_stats.misses++;
+
+		/* VOP_LOOKUP may scribble on the name */
+		strcpy(key, name);
+	}
+
+	result = VOP_LOOKUP(dir, name, ret);
+	if (cacheable) {
+		if (result == 0) {
+			dcache_enter(dir, key, *ret);
+		}
+		else if (result == ENOENT) {
+			dcache_enter(dir, key, NULL);
+		}
+	}
+	return result;
+}
+
+void
+vfs_dcache_invalidate(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+
+	vfs_biglock_acquire();
+	if (dcache_cacheable(dir, name)) {
+		dc = dcache_find(dir, name);
+		if (dc != NULL) {
+			dcache_stats.invalidations++;
+			dcache_remove(dc);
+		}
+	}
+	vfs_biglock_release();
+}
+
+void
+vfs_dcache_purge(struct fs *fs)
+{
+	struct dcentry *dc, *next;
+
+	vfs_biglock_acquire();
+	/*
+	 * Dropping a reference can't remove other entries, so it's
+	 * safe to keep going from the next one.
+	 */
+	for (dc = dcache_lruhead; dc != NULL; dc = next) {
+		next = dc->dc_lrunext;
+		if (fs == NULL || dc->dc_dir->vn_fs == fs) {
+			dcache_remove(dc);
+		}
+	}
+	vfs_biglock_release();
+}
+
+void
+vfs_dcache_printstats(void)
+{
+	struct dcentry *dc;
+	unsigned long lookups;
+	unsigned count = 0, negative = 0;
+
+	vfs_biglock_acquire();
+	for (dc = dcache_lruhead; dc != NULL; dc = dc->dc_lrunext) {
+		count++;
+		if (dc->dc_vn == NULL) {
+			negative++;
+		}
+	}
+	lookups = dcache_stats.hits + dcache_stats.neghits +
+		dcache_stats.misses;
+	kprintf("name cache: %u entries (max %u), %u negative\n",
+		count, DCACHE_SIZE, negative);
+	kprintf("    %lu lookups, %lu hits, %lu negative hits, %lu misses "
+		"(%lu%% hit)\n", lookups, dcache_stats.hits,
+		dcache_stats.neghits, dcache_stats.misses,
+		lookups ? (lookups - dcache_stats.misses) * 100 / lookups : 0);
+	kprintf("    %lu evictions, %lu invalidations\n",
+		dcache_stats.evictions, dcache_stats.invalidations);
+	vfs_biglock_release();
+}
+
+void
+vfs_dcache_resetstats(void)
+{
+	vfs_biglock_acquire();
+	bzero(&dcache_stats, sizeof(dcache_stats));
+	vfs_biglock_release();
+}
+
+/*
+ * Walk PATH from STARTVN one component at a time. If LASTP is NULL,
+ * hand back the vnode for the whole path; otherwise stop short of the
+ * last component, hand back the directory it's in, and point *LASTP
+ * at it. PATH gets its slashes overwritten.
+ */
+static
+int
+lookup_walk(struct vnode *startvn, char *path, struct vnode **ret,
+	    char **lastp)
+{
+	struct vnode *dir, *next;
+	char *name, *s;
+	mode_t vtype;
+	int result;
+
+	VOP_INCREF(startvn);
+	dir = startvn;
+	name = path;
+
+	while (1) {
+		while (*name == '/') {
+			name++;
+		}
+		s = strchr(name, '/');
+		if (s == NULL) {
+			break;
+		}
+		*s = 0;
+
+		result = dcache_lookup(dir, name, &next);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+		dir = next;
+		name = s+1;
+	}
+
+	if (lastp != NULL) {
+		*lastp = name;
+		*ret = dir;
+		return 0;
+	}
+	if (*name == 0) {
+		/* trailing slash; only a directory can have one */
+		result = VOP_GETTYPE(dir, &vtype);
+		if (result == 0 && vtype != S_IFDIR) {
+			result = ENOTDIR;
+		}
+		if (result) {
+			VOP_DECREF(dir);
+			return result;
+		}
+		*ret = dir;
+		return 0;
+	}
+	result = dcache_lookup(dir, name, ret);
+	VOP_DECREF(dir);
+	return result;
+}
+
 /*
  * Common code to pull the device name, if any, off the front of a
  * path and choose the vnode to begin the name lookup relative to.
@@ -232,7 +612,8 @@ int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *name;
 	int result;
 
 	vfs_biglock_acquire();
@@ -252,7 +633,12 @@ vfs_lookparent(char *path, struct vnode **retval,
 		result = EINVAL;
 	}
 	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		result = lookup_walk(startvn, path, &dir, &name);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, name, retval,
+						buf, buflen);
+			VOP_DECREF(dir);
+		}
 	}
 
 	VOP_DECREF(startvn);
@@ -281,7 +667,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = lookup_walk(startvn, path, retval, NULL);
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
@@ -39,6 +39,7 @@
 #include <sys/wait.h>
 #include <assert.h>
 #include <unistd.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -421,30 +422,17 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
-	}
-
-	/* parent */
+	/*
+	 * Start it with spawn, which loads the program straight into a
+	 * new process, so our address space is never copied.
+	 */
+	pid = spawnp(args[0], args, NULL, 0);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (bg) {
 		/* background this command */
 		remember_bg(pid);
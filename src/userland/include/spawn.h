@@ -0,0 +1,18 @@
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+/*
+ * Start a program in a new process in one step, without copying the
+ * caller the way fork does. Get struct spawn_fdmap from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/spawn.h>
+
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_fdmap *fdmap, int nfdmap);
+
+/* Like spawn, but searches $PATH like execvp. */
+pid_t spawnp(const char *prog, char *const *args,
+	     const struct spawn_fdmap *fdmap, int nfdmap);
+
+#endif /* _SPAWN_H_ */
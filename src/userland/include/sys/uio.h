@@ -0,0 +1,13 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+/*
+ * Scatter/gather I/O. Get struct iovec from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/iovec.h>
+
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
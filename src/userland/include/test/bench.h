@@ -0,0 +1,36 @@
+/*
+ * Support code for the benchmarks in testbin.
+ */
+
+#ifndef _TEST_BENCH_H_
+#define _TEST_BENCH_H_
+
+#include <sys/types.h>
+
+/*
+ * A start time, for measuring how long something takes.
+ */
+struct benchtimer {
+	time_t bt_secs;
+	unsigned long bt_nsecs;
+};
+
+void benchtimer_start(struct benchtimer *bt);
+unsigned long long benchtimer_nsecs(const struct benchtimer *bt);
+
+/*
+ * Print "PROG: WHAT: COUNT UNITS in S.NNNNNNNNN seconds, RATE UNITS/sec".
+ * UNITS may be NULL.
+ */
+void bench_report(const char *prog, const char *what,
+		  unsigned long long count, const char *units,
+		  unsigned long long nsecs);
+
+/*
+ * Fork a child that exits at once with CODE, and wait for a child,
+ * failing unless it exited with EXPECTED.
+ */
+pid_t bench_forkexit(int code);
+void bench_reap(pid_t pid, int expected);
+
+#endif /* _TEST_BENCH_H_ */
@@ -57,6 +57,8 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -112,6 +114,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t vfork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -148,6 +151,10 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/* readv - see sys/uio.h */
+/* writev - see sys/uio.h */
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
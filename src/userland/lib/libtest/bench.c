@@ -0,0 +1,82 @@
+/*
+ * bench.c
+ *
+ * 	Timing, reporting, and process helpers for the benchmarks.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+#include <test/bench.h>
+
+void
+benchtimer_start(struct benchtimer *bt)
+{
+	__time(&bt->bt_secs, &bt->bt_nsecs);
+}
+
+/*
+ * Nanoseconds since benchtimer_start.
+ */
+unsigned long long
+benchtimer_nsecs(const struct benchtimer *bt)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (secs - bt->bt_secs) * 1000000000ULL + nsecs - bt->bt_nsecs;
+}
+
+void
+bench_report(const char *prog, const char *what, unsigned long long count,
+	     const char *units, unsigned long long nsecs)
+{
+	const char *sp = units != NULL ? " " : "";
+
+	if (units == NULL) {
+		units = "";
+	}
+	printf("%s: %s: %llu%s%s in %llu.%09llu seconds", prog, what,
+	       count, sp, units, nsecs / 1000000000ULL,
+	       nsecs % 1000000000ULL);
+	if (nsecs > 0) {
+		printf(", %llu%s%s/sec", count * 1000000000ULL / nsecs,
+		       sp, units);
+	}
+	printf("\n");
+}
+
+pid_t
+bench_forkexit(int code)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		_exit(code);
+	}
+	return pid;
+}
+
+void
+bench_reap(pid_t pid, int expected)
+{
+	int status;
+	pid_t ret;
+
+	ret = waitpid(pid, &status, 0);
+	if (ret < 0) {
+		err(1, "waitpid %d", pid);
+	}
+	if (ret != pid) {
+		errx(1, "waitpid %d returned %d", pid, ret);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != expected) {
+		errx(1, "pid %d: bad status %d (expected exit %d)",
+		     pid, status, expected);
+	}
+}
@@ -70,7 +70,7 @@ extern const char *hostcompat_progname;
 #define DIVROUNDUP(a, b) (((a) + (b) - 1) / (b))
 
 static bool dofiles, dodirs;
-static bool doindirect;
+static bool doextblocks;
 static bool recurse;
 
 ////////////////////////////////////////////////////////////
@@ -230,81 +230,125 @@ dumpfreemap(uint32_t fsblocks)
 
 static
 void
-dumpindirect(uint32_t block)
+dumpextent(unsigned i, const struct sfs_extent *ext, bool leaf)
 {
-	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
-	char tmp[128];
-	unsigned i;
-
-	if (block == 0) {
-		return;
+	if (leaf) {
+		printf("    @%-3u  file block %u: %u blocks at %u (0x%x)\n", i,
+		       SWAP32(ext->ext_fileblock), SWAP32(ext->ext_len),
+		       SWAP32(ext->ext_diskblock), SWAP32(ext->ext_diskblock));
 	}
-	printf("Indirect block %u\n", block);
-
-	diskread(ib, block);
-	for (i=0; i<ARRAYCOUNT(ib); i++) {
-		if (i % 4 == 0) {
-			printf("@%-3u   ", i);
-		}
-		snprintf(tmp, sizeof(tmp), "%u (0x%x)",
-			 SWAP32(ib[i]), SWAP32(ib[i]));
-		printf("  %-16s", tmp);
-		if (i % 4 == 3) {
-			printf("\n");
-		}
+	else {
+		printf("    @%-3u  file block %u on: extent block %u (0x%x)\n", i,
+		       SWAP32(ext->ext_fileblock),
+		       SWAP32(ext->ext_diskblock), SWAP32(ext->ext_diskblock));
 	}
 }
 
 static
-uint32_t
-traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
-	    void (*doblock)(uint32_t, uint32_t))
+void
+dumpextblock(uint32_t block)
 {
-	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
-	unsigned i;
+	struct sfs_extblock eb;
+	uint32_t i, n;
 
-	if (block == 0) {
-		memset(ib, 0, sizeof(ib));
+	printf("Extent block %u\n", block);
+
+	diskread(&eb, block);
+	if (SWAP32(eb.eb_magic) != SFS_EXTMAGIC) {
+		printf("    Bad magic number 0x%x\n", SWAP32(eb.eb_magic));
+		return;
 	}
-	else {
-		diskread(ib, block);
+	n = SWAP32(eb.eb_nextents);
+	printf("    %u extents\n", n);
+	if (n > SFS_EXTPERBLOCK) {
+		n = SFS_EXTPERBLOCK;
 	}
-	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(ib[i]));
+	for (i=0; i<n; i++) {
+		dumpextent(i, &eb.eb_extents[i], true);
+	}
+}
+
+/*
+ * Call DOBLOCK for each file block covered by the N extents EXTS,
+ * and with a disk block of 0 for each hole before them, starting
+ * from *FILEBLOCK and stopping at NUMBLOCKS.
+ */
+static
+void
+traverse_extents(const struct sfs_extent *exts, uint32_t n,
+		 uint32_t *fileblock, uint32_t numblocks,
+		 void (*doblock)(uint32_t, uint32_t))
+{
+	uint32_t i, start, len, disk;
+
+	for (i=0; i<n; i++) {
+		start = SWAP32(exts[i].ext_fileblock);
+		len = SWAP32(exts[i].ext_len);
+		disk = SWAP32(exts[i].ext_diskblock);
+		while (*fileblock < start && *fileblock < numblocks) {
+			doblock((*fileblock)++, 0);
+		}
+		while (*fileblock < start + len && *fileblock < numblocks) {
+			doblock(*fileblock, disk + (*fileblock - start));
+			(*fileblock)++;
+		}
 	}
-	return fileblock;
 }
 
 static
 void
 traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 {
+	struct sfs_extblock eb;
 	uint32_t fileblock;
 	uint32_t numblocks;
+	uint32_t n;
 	unsigned i;
 
 	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), SFS_BLOCKSIZE);
+	n = SWAP16(sfi->sfi_nextents);
+	if (n > SFS_NIEXTENTS) {
+		n = SFS_NIEXTENTS;
+	}
 
 	fileblock = 0;
-	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
-		doblock(fileblock++, SWAP32(sfi->sfi_direct[i]));
+	if (SWAP16(sfi->sfi_depth) == 0) {
+		traverse_extents(sfi->sfi_extents, n,
+				 &fileblock, numblocks, doblock);
+	}
+	else {
+		for (i=0; i<n; i++) {
+			diskread(&eb, SWAP32(sfi->sfi_extents[i].ext_diskblock));
+			if (SWAP32(eb.eb_magic) != SFS_EXTMAGIC ||
+			    SWAP32(eb.eb_nextents) > SFS_EXTPERBLOCK) {
+				warnx("Warning: bad extent block %u",
+				      SWAP32(sfi->sfi_extents[i].ext_diskblock));
+				continue;
+			}
+			traverse_extents(eb.eb_extents,
+					 SWAP32(eb.eb_nextents),
+					 &fileblock, numblocks, doblock);
+		}
 	}
-	if (fileblock < numblocks) {
-		fileblock = traverse_ib(fileblock, numblocks,
-					SWAP32(sfi->sfi_indirect), doblock);
+	while (fileblock < numblocks) {
+		doblock(fileblock++, 0);
 	}
-	assert(fileblock == numblocks);
 }
 
+/* Name index of the directory being dumped, if it has one */
+static uint8_t dirtags[SFS_NDIRINDEX * SFS_BLOCKSIZE];
+static bool dirindexed;
+
 static
 void
 dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 {
 	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	uint32_t slot;
+	uint8_t tag;
 	int i;
 
-	(void)fileblock;
 	if (diskblock == 0) {
 		printf("    [block %u - empty]\n", diskblock);
 		return;
@@ -314,13 +358,21 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	printf("    [block %u]\n", diskblock);
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAP32(sds[i].sfd_ino);
+		slot = fileblock * nsds + i;
 		if (ino==SFS_NOINO) {
-			printf("        [free entry]\n");
+			printf("        [free entry]");
+			tag = 0;
 		}
 		else {
 			sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
-			printf("        %u %s\n", ino, sds[i].sfd_name);
+			printf("        %u %s", ino, sds[i].sfd_name);
+			tag = sfs_dirtag(sds[i].sfd_name);
 		}
+		if (dirindexed && dirtags[slot] != tag) {
+			printf("  [index has %u, should be %u]",
+			       dirtags[slot], tag);
+		}
+		printf("\n");
 	}
 }
 
@@ -329,13 +381,26 @@ void
 dumpdir(uint32_t ino, const struct sfs_dinode *sfi)
 {
 	int nentries;
+	unsigned i;
 
 	nentries = SWAP32(sfi->sfi_size) / sizeof(struct sfs_direntry);
 	if (SWAP32(sfi->sfi_size) % sizeof(struct sfs_direntry) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
 	printf("Directory contents for inode %u: %d entries\n", ino, nentries);
+
+	/* Load the name index so the entries can be checked against it */
+	dirindexed = sfi->sfi_dirindex[0] != 0;
+	bzero(dirtags, sizeof(dirtags));
+	for (i=0; i<SFS_NDIRINDEX; i++) {
+		if (sfi->sfi_dirindex[i] != 0) {
+			diskread(dirtags + i*SFS_BLOCKSIZE,
+				 SWAP32(sfi->sfi_dirindex[i]));
+		}
+	}
+
 	traverse(sfi, dumpdirblock);
+	dirindexed = false;
 }
 
 static
@@ -429,7 +494,7 @@ dumpinode(uint32_t ino, const char *name)
 {
 	struct sfs_dinode sfi;
 	const char *typename;
-	char tmp[128];
+	uint32_t n;
 	unsigned i;
 
 	diskread(&sfi, ino);
@@ -451,31 +516,22 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
 	printf("\n");
 
-        printf("    Direct blocks:\n");
-        for (i=0; i<SFS_NDIRECT; i++) {
-		if (i % 4 == 0) {
-			printf("@%-2u    ", i);
-		}
-		/*
-		 * Assume the disk size might be > 64K sectors (which
-		 * would be 32M) but is < 1024K sectors (512M) so we
-		 * need up to 5 hex digits for a block number. And
-		 * assume it's actually < 1 million sectors so we need
-		 * only up to 6 decimal digits. The complete block
-		 * number print then needs up to 16 digits.
-		 */
-		snprintf(tmp, sizeof(tmp), "%u (0x%x)",
-			 SWAP32(sfi.sfi_direct[i]), SWAP32(sfi.sfi_direct[i]));
-		printf("  %-16s", tmp);
-		if (i % 4 == 3) {
-			printf("\n");
-		}
+	printf("    Extents: %u, depth %u\n", SWAP16(sfi.sfi_nextents),
+	       SWAP16(sfi.sfi_depth));
+	n = SWAP16(sfi.sfi_nextents);
+	if (n > SFS_NIEXTENTS) {
+		n = SFS_NIEXTENTS;
+	}
+	for (i=0; i<n; i++) {
+		dumpextent(i, &sfi.sfi_extents[i], SWAP16(sfi.sfi_depth) == 0);
 	}
-	if (i % 4 != 0) {
+	if (sfi.sfi_dirindex[0] != 0) {
+		printf("    Name index blocks:");
+		for (i=0; i<SFS_NDIRINDEX; i++) {
+			printf(" %u", SWAP32(sfi.sfi_dirindex[i]));
+		}
 		printf("\n");
 	}
-	printf("    Indirect block: %u (0x%x)\n",
-	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
 	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
 		if (sfi.sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
@@ -483,8 +539,10 @@ dumpinode(uint32_t ino, const char *name)
 		}
 	}
 
-	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+	if (doextblocks && SWAP16(sfi.sfi_depth) > 0) {
+		for (i=0; i<n; i++) {
+			dumpextblock(SWAP32(sfi.sfi_extents[i].ext_diskblock));
+		}
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
@@ -509,7 +567,7 @@ usage(void)
 	warnx("   -s: dump superblock");
 	warnx("   -b: dump free block bitmap");
 	warnx("   -i ino: dump specified inode");
-	warnx("   -I: dump indirect blocks");
+	warnx("   -I: dump extent blocks");
 	warnx("   -f: dump file contents");
 	warnx("   -d: dump directory contents");
 	warnx("   -r: recurse into directory contents");
@@ -550,7 +608,7 @@ main(int argc, char **argv)
 					}
 					/* XXX ugly */
 					goto nextarg;
-				    case 'I': doindirect = true; break;
+				    case 'I': doextblocks = true; break;
 				    case 'f': dofiles = true; break;
 				    case 'd': dodirs = true; break;
 				    case 'r': recurse = true; break;
@@ -558,7 +616,7 @@ main(int argc, char **argv)
 					dosb = true;
 					dofreemap = true;
 					dumpino = SFS_ROOTDIR_INO;
-					doindirect = true;
+					doextblocks = true;
 					dofiles = true;
 					dodirs = true;
 					recurse = true;
@@ -72,6 +72,7 @@ check(void)
 {
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_extblock)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
 }
 
@@ -165,19 +166,31 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Write out the root directory inode, and an empty name index for it
+ * in the first block past the freemap.
  */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t fsblocks)
 {
 	struct sfs_dinode sfi;
+	char zeros[SFS_BLOCKSIZE];
+	uint32_t indexblock;
 
-	/* Initialize the dinode */
+	indexblock = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	if (indexblock >= fsblocks) {
+		errx(1, "Filesystem too small");
+	}
+	allocblock(indexblock);
+	bzero(zeros, sizeof(zeros));
+	diskwrite(zeros, indexblock);
+
+	/* Initialize the dinode; it's empty, so it has no extents */
 	bzero((void *)&sfi, sizeof(sfi));
 	sfi.sfi_size = SWAP32(0);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
+	sfi.sfi_dirindex[0] = SWAP32(indexblock);
 
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
@@ -230,9 +243,9 @@ main(int argc, char **argv)
 
 	/* Write out the on-disk structures */
 	initfreemap(size);
+	writerootdir(size);
 	writesuper(volname, size);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
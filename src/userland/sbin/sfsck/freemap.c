@@ -99,14 +99,18 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 		snprintf(rv, sizeof(rv), "inode %lu",
 			 (unsigned long) howdesc);
 		break;
-	    case B_IBLOCK:
-		snprintf(rv, sizeof(rv), "indirect block of inode %lu",
+	    case B_EXTBLOCK:
+		snprintf(rv, sizeof(rv), "extent block of inode %lu",
 			 (unsigned long) howdesc);
 		break;
 	    case B_DIRDATA:
 		snprintf(rv, sizeof(rv), "directory data from inode %lu",
 			 (unsigned long) howdesc);
 		break;
+	    case B_DIRINDEX:
+		snprintf(rv, sizeof(rv), "name index of directory %lu",
+			 (unsigned long) howdesc);
+		break;
 	    case B_DATA:
 		snprintf(rv, sizeof(rv), "file data from inode %lu",
 			 (unsigned long) howdesc);
@@ -39,7 +39,6 @@
 
 #include "disk.h"
 #include "utils.h"
-#include "ibmacros.h"
 #include "sfs.h"
 #include "sb.h"
 #include "freemap.h"
@@ -49,12 +48,15 @@
 
 static unsigned long count_dirs=0, count_files=0;
 
+/* Largest possible file block number */
+#define MAXFILEBLOCK 0xffffffffU
+
 /*
- * State for checking indirect blocks.
+ * State for checking extents.
  */
-struct ibstate {
+struct extstate {
 	uint32_t ino;		/* inode we're doing (constant) */
-	uint32_t curfileblock;	/* current block offset in the file */
+	uint32_t nextblock;	/* file block after the last extent kept */
 	uint32_t fileblocks;	/* file size in blocks (constant) */
 	uint32_t volblocks;	/* volume size in blocks (constant) */
 	unsigned pasteofcount;	/* number of blocks found past eof */
@@ -62,114 +64,173 @@ struct ibstate {
 };
 
 /*
- * Traverse an indirect block, recording blocks that are in use,
- * dropping any entries that are past EOF, and clearing any entries
- * that point outside the volume.
+ * Check the *NP extents in EXTS, recording blocks that are in use,
+ * freeing blocks that are past EOF, and dropping extents that point
+ * outside the volume, are empty, overlap or come before the previous
+ * one, or don't fall within the file blocks LO to HI (inclusive) that
+ * the array is meant to cover.
  *
- * XXX: this should be extended to be able to recover from crosslinked
- * blocks. Currently it just complains in freemap.c and sets
- * EXIT_UNRECOV.
+ * XXX: as with the old indirect block check, crosslinked blocks are
+ * only complained about (in freemap.c), which sets EXIT_UNRECOV.
  *
- * The traversal is recursive; the state is maintained in IBS (as
- * described above). IENTRY is a pointer to the entry in the parent
- * indirect block (or the inode) that names the block we're currently
- * scanning. IECHANGEDP should be set to 1 if *IENTRY is changed.
- * INDIRECTION is the indirection level of this block (1, 2, or 3).
+ * Returns nonzero if the array (or *NP) was changed.
  */
 static
-void
-check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
-		     int indirection)
+int
+check_extents(struct extstate *es, struct sfs_extent *exts, uint32_t *np,
+	      uint32_t lo, uint32_t hi)
 {
-	uint32_t entries[SFS_DBPERIDB];
-	uint32_t i, ct;
-	uint32_t coveredblocks;
-	int localchanged = 0;
-	int j;
-
-	if (*ientry > 0 && *ientry < ibs->volblocks) {
-		sfs_readindirect(*ientry, entries);
-		freemap_blockinuse(*ientry, B_IBLOCK, ibs->ino);
-	}
-	else {
-		if (*ientry >= ibs->volblocks) {
+	struct sfs_extent *ext;
+	uint32_t i, j, k, tail;
+	int changed = 0;
+
+	for (i=j=0; i<*np; i++) {
+		ext = &exts[i];
+		if (ext->ext_len == 0 || ext->ext_diskblock == 0 ||
+		    ext->ext_diskblock >= es->volblocks ||
+		    ext->ext_len > es->volblocks - ext->ext_diskblock) {
 			setbadness(EXIT_RECOV);
-			warnx("Inode %lu: indirect block pointer (level %d) "
-			      "for block %lu outside of volume: %lu "
-			      "(cleared)\n",
-			      (unsigned long)ibs->ino, indirection,
-			      (unsigned long)ibs->curfileblock,
-			      (unsigned long)*ientry);
-			*ientry = 0;
-			*iechangedp = 1;
-		}
-		coveredblocks = 1;
-		for (j=0; j<indirection; j++) {
-			coveredblocks *= SFS_DBPERIDB;
-		}
-		ibs->curfileblock += coveredblocks;
-		return;
-	}
-
-	if (indirection > 1) {
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			check_indirect_block(ibs, &entries[i], &localchanged,
-					     indirection-1);
+			warnx("Inode %lu: extent for block %lu has bad disk "
+			      "range %lu+%lu (dropped)",
+			      (unsigned long)es->ino,
+			      (unsigned long)ext->ext_fileblock,
+			      (unsigned long)ext->ext_diskblock,
+			      (unsigned long)ext->ext_len);
+			changed = 1;
+			continue;
 		}
-	}
-	else {
-		assert(indirection==1);
-
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			if (entries[i] >= ibs->volblocks) {
-				setbadness(EXIT_RECOV);
-				warnx("Inode %lu: direct block pointer for "
-				      "block %lu outside of volume: %lu "
-				      "(cleared)\n",
-				      (unsigned long)ibs->ino,
-				      (unsigned long)ibs->curfileblock,
-				      (unsigned long)entries[i]);
-				entries[i] = 0;
-				localchanged = 1;
+		if (ext->ext_fileblock < es->nextblock ||
+		    ext->ext_fileblock < lo || ext->ext_fileblock > hi ||
+		    ext->ext_len - 1 > MAXFILEBLOCK - ext->ext_fileblock) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent for block %lu out of order "
+			      "(dropped)",
+			      (unsigned long)es->ino,
+			      (unsigned long)ext->ext_fileblock);
+			changed = 1;
+			continue;
+		}
+		if (ext->ext_fileblock >= es->fileblocks) {
+			tail = ext->ext_len;
+		}
+		else if (ext->ext_len > es->fileblocks - ext->ext_fileblock) {
+			tail = ext->ext_len -
+				(es->fileblocks - ext->ext_fileblock);
+		}
+		else {
+			tail = 0;
+		}
+		if (tail > 0) {
+			setbadness(EXIT_RECOV);
+			es->pasteofcount += tail;
+			for (k=ext->ext_len - tail; k<ext->ext_len; k++) {
+				freemap_blockfree(ext->ext_diskblock + k);
 			}
-			else if (entries[i] != 0) {
-				if (ibs->curfileblock < ibs->fileblocks) {
-					freemap_blockinuse(entries[i],
-							  ibs->usagetype,
-							  ibs->ino);
-				}
-				else {
-					setbadness(EXIT_RECOV);
-					ibs->pasteofcount++;
-					freemap_blockfree(entries[i]);
-					entries[i] = 0;
-					localchanged = 1;
-				}
+			ext->ext_len -= tail;
+			changed = 1;
+			if (ext->ext_len == 0) {
+				continue;
 			}
-			ibs->curfileblock++;
 		}
+		for (k=0; k<ext->ext_len; k++) {
+			freemap_blockinuse(ext->ext_diskblock + k,
+					   es->usagetype, es->ino);
+		}
+		es->nextblock = ext->ext_fileblock + ext->ext_len;
+		if (j != i) {
+			exts[j] = *ext;
+		}
+		j++;
 	}
-
-	ct=0;
-	for (i=ct=0; i<SFS_DBPERIDB; i++) {
-		if (entries[i]!=0) ct++;
+	if (j != *np) {
+		bzero(&exts[j], (*np - j) * sizeof(exts[0]));
+		*np = j;
 	}
-	if (ct==0) {
-		if (*ientry != 0) {
+	return changed;
+}
+
+/*
+ * Check the extent blocks named by the SFI_NEXTENTS entries of an
+ * inode with an extent tree. An entry that's bad, or whose block
+ * has no extents left once checked, is dropped and its block freed.
+ *
+ * Returns nonzero if SFI has been modified.
+ */
+static
+int
+check_extent_blocks(struct extstate *es, struct sfs_dinode *sfi)
+{
+	struct sfs_extblock eb;
+	struct sfs_extent *ent;
+	uint32_t i, j, n, block, hi;
+	int changed = 0;
+
+	for (i=j=0; i<sfi->sfi_nextents; i++) {
+		ent = &sfi->sfi_extents[i];
+		block = ent->ext_diskblock;
+		if (block == 0 || block >= es->volblocks ||
+		    (j > 0 && ent->ext_fileblock < es->nextblock)) {
 			setbadness(EXIT_RECOV);
-			/* this is not necessarily correct */
-			/*ibs->pasteofcount++;*/
-			*iechangedp = 1;
-			freemap_blockfree(*ientry);
-			*ientry = 0;
+			warnx("Inode %lu: extent block pointer %lu for block "
+			      "%lu is bad (dropped)",
+			      (unsigned long)es->ino, (unsigned long)block,
+			      (unsigned long)ent->ext_fileblock);
+			changed = 1;
+			continue;
 		}
-	}
-	else {
-		assert(*ientry != 0);
-		if (localchanged) {
-			sfs_writeindirect(*ientry, entries);
+		sfs_readextblock(block, &eb);
+		if (eb.eb_magic != SFS_EXTMAGIC ||
+		    eb.eb_nextents > SFS_EXTPERBLOCK) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent block %lu is corrupt "
+			      "(dropped)",
+			      (unsigned long)es->ino, (unsigned long)block);
+			changed = 1;
+			continue;
 		}
+		freemap_blockinuse(block, B_EXTBLOCK, es->ino);
+
+		/* This block covers up to the next entry's first block */
+		hi = MAXFILEBLOCK;
+		if (i + 1 < sfi->sfi_nextents &&
+		    sfi->sfi_extents[i+1].ext_fileblock > 0) {
+			hi = sfi->sfi_extents[i+1].ext_fileblock - 1;
+		}
+		n = eb.eb_nextents;
+		if (check_extents(es, eb.eb_extents, &n,
+				  j > 0 ? ent->ext_fileblock : 0, hi)) {
+			eb.eb_nextents = n;
+			if (n > 0) {
+				sfs_writeextblock(block, &eb);
+			}
+		}
+		if (n == 0) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent block %lu is empty (freed)",
+			      (unsigned long)es->ino, (unsigned long)block);
+			freemap_blockfree(block);
+			changed = 1;
+			continue;
+		}
+		if (j == 0) {
+			/* the first entry starts where its first extent does */
+			ent->ext_fileblock = eb.eb_extents[0].ext_fileblock;
+		}
+		if (ent->ext_len != 0) {
+			ent->ext_len = 0;
+			changed = 1;
+		}
+		if (j != i) {
+			sfi->sfi_extents[j] = *ent;
+		}
+		j++;
+	}
+	if (j != sfi->sfi_nextents) {
+		bzero(&sfi->sfi_extents[j],
+		      (sfi->sfi_nextents - j) * sizeof(struct sfs_extent));
+		sfi->sfi_nextents = j;
 	}
+	return changed;
 }
 
 /*
@@ -184,63 +245,59 @@ static
 int
 check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 {
-	struct ibstate ibs;
-	uint32_t size, datablock;
+	struct extstate es;
+	uint32_t size, n;
 	int changed;
-	int i;
 
 	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
 
-	ibs.ino = ino;
-	/*ibs.curfileblock = 0;*/
-	ibs.fileblocks = size/SFS_BLOCKSIZE;
-	ibs.volblocks = sb_totalblocks();
-	ibs.pasteofcount = 0;
-	ibs.usagetype = isdir ? B_DIRDATA : B_DATA;
+	es.ino = ino;
+	es.nextblock = 0;
+	es.fileblocks = size/SFS_BLOCKSIZE;
+	es.volblocks = sb_totalblocks();
+	es.pasteofcount = 0;
+	es.usagetype = isdir ? B_DIRDATA : B_DATA;
 
 	changed = 0;
 
-	for (ibs.curfileblock=0; ibs.curfileblock<NUM_D; ibs.curfileblock++) {
-		datablock = GET_D(sfi, ibs.curfileblock);
-		if (datablock >= ibs.volblocks) {
-			setbadness(EXIT_RECOV);
-			warnx("Inode %lu: direct block pointer for "
-			      "block %lu outside of volume: %lu "
-			      "(cleared)\n",
-			      (unsigned long)ibs.ino,
-			      (unsigned long)ibs.curfileblock,
-			      (unsigned long)datablock);
-			SET_D(sfi, ibs.curfileblock) = 0;
-			changed = 1;
-		}
-		else if (datablock > 0) {
-			if (ibs.curfileblock < ibs.fileblocks) {
-				freemap_blockinuse(datablock, ibs.usagetype,
-						   ibs.ino);
-			}
-			else {
-				setbadness(EXIT_RECOV);
-				ibs.pasteofcount++;
-				changed = 1;
-				freemap_blockfree(datablock);
-				SET_D(sfi, ibs.curfileblock) = 0;
-			}
-		}
+	if (sfi->sfi_depth > SFS_EXTMAXDEPTH) {
+		setbadness(EXIT_RECOV);
+		warnx("Inode %lu: extent tree depth %u is invalid "
+		      "(extents cleared)",
+		      (unsigned long)ino, (unsigned)sfi->sfi_depth);
+		bzero(sfi->sfi_extents, sizeof(sfi->sfi_extents));
+		sfi->sfi_nextents = 0;
+		sfi->sfi_depth = 0;
+		return 1;
 	}
-
-	for (i=0; i<NUM_I; i++) {
-		check_indirect_block(&ibs, &SET_I(sfi, i), &changed, 1);
+	if (sfi->sfi_nextents > SFS_NIEXTENTS) {
+		setbadness(EXIT_RECOV);
+		warnx("Inode %lu: extent count %u too large (truncated)",
+		      (unsigned long)ino, (unsigned)sfi->sfi_nextents);
+		sfi->sfi_nextents = SFS_NIEXTENTS;
+		changed = 1;
 	}
-	for (i=0; i<NUM_II; i++) {
-		check_indirect_block(&ibs, &SET_II(sfi, i), &changed, 2);
+
+	if (sfi->sfi_depth == 0) {
+		n = sfi->sfi_nextents;
+		if (check_extents(&es, sfi->sfi_extents, &n, 0, MAXFILEBLOCK)) {
+			sfi->sfi_nextents = n;
+			changed = 1;
+		}
 	}
-	for (i=0; i<NUM_III; i++) {
-		check_indirect_block(&ibs, &SET_III(sfi, i), &changed, 3);
+	else {
+		if (check_extent_blocks(&es, sfi)) {
+			changed = 1;
+		}
+		if (sfi->sfi_nextents == 0) {
+			sfi->sfi_depth = 0;
+			changed = 1;
+		}
 	}
 
-	if (ibs.pasteofcount > 0) {
+	if (es.pasteofcount > 0) {
 		warnx("Inode %lu: %u blocks after EOF (freed)",
-		     (unsigned long) ibs.ino, ibs.pasteofcount);
+		     (unsigned long) es.ino, es.pasteofcount);
 		setbadness(EXIT_RECOV);
 	}
 
@@ -277,6 +334,14 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if (!isdir &&
+	    checkzeroed(sfi->sfi_dirindex, sizeof(sfi->sfi_dirindex))) {
+		warnx("Inode %lu: regular file has a name index (cleared)",
+		      (unsigned long) ino);
+		setbadness(EXIT_RECOV);
+		changed = 1;
+	}
+
 	if (check_inode_blocks(ino, sfi, isdir)) {
 		changed = 1;
 	}
@@ -350,6 +415,88 @@ pass1_direntry(const char *path, uint32_t index, struct sfs_direntry *sfd)
 	return dchanged;
 }
 
+/*
+ * Check the name index, if any, of directory INO (at PATH), whose
+ * inode is SFI and whose ND entries, already checked, are in D. An
+ * index with bad block pointers, or missing blocks for some of the
+ * slots, is removed; the kernel builds a new one. One that's merely
+ * out of date, such as after an older kernel changed the directory,
+ * is rewritten.
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+check_dirindex(uint32_t ino, const char *path, struct sfs_dinode *sfi,
+	       const struct sfs_direntry *d, uint32_t nd)
+{
+	uint8_t tags[SFS_BLOCKSIZE];
+	uint32_t nblocks, needed, i, j, slot;
+	int bad = 0, stale = 0;
+
+	if (sfi->sfi_dirindex[0] == 0) {
+		for (i=1; i<SFS_NDIRINDEX; i++) {
+			if (sfi->sfi_dirindex[i] != 0) {
+				bad = 1;
+			}
+		}
+		if (!bad) {
+			/* no index */
+			return 0;
+		}
+	}
+
+	nblocks = sb_totalblocks();
+	needed = SFS_ROUNDUP(nd, SFS_BLOCKSIZE) / SFS_BLOCKSIZE;
+	for (i=0; i<SFS_NDIRINDEX; i++) {
+		if (sfi->sfi_dirindex[i] >= nblocks ||
+		    (i < needed && sfi->sfi_dirindex[i] == 0)) {
+			bad = 1;
+		}
+	}
+
+	if (bad) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: bad name index (removed)", path);
+		for (i=0; i<SFS_NDIRINDEX; i++) {
+			if (sfi->sfi_dirindex[i] != 0 &&
+			    sfi->sfi_dirindex[i] < nblocks) {
+				freemap_blockfree(sfi->sfi_dirindex[i]);
+			}
+			sfi->sfi_dirindex[i] = 0;
+		}
+		return 1;
+	}
+
+	for (i=0; i<SFS_NDIRINDEX; i++) {
+		if (sfi->sfi_dirindex[i] == 0) {
+			continue;
+		}
+		freemap_blockinuse(sfi->sfi_dirindex[i], B_DIRINDEX, ino);
+
+		diskread(tags, sfi->sfi_dirindex[i]);
+		for (j=0; j<SFS_BLOCKSIZE; j++) {
+			slot = i*SFS_BLOCKSIZE + j;
+			if (slot >= nd || d[slot].sfd_ino == SFS_NOINO) {
+				if (tags[j] != 0) {
+					stale = 1;
+				}
+			}
+			else if (tags[j] != sfs_dirtag(d[slot].sfd_name)) {
+				stale = 1;
+			}
+		}
+	}
+
+	if (stale) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: name index out of date (fixed)", path);
+		sfs_writedirindex(sfi, d, nd);
+	}
+	return 0;
+}
+
 /*
  * Check a directory. INO is the inode number; PATHSOFAR is the path
  * to this directory. This traverses the volume directory tree
@@ -392,6 +539,10 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 		}
 	}
 
+	if (check_dirindex(ino, pathsofar, &sfi, direntries, ndirentries)) {
+		sfs_writeinode(ino, &sfi);
+	}
+
 	for (i=0; i<ndirentries; i++) {
 		if (direntries[i].sfd_ino == SFS_NOINO) {
 			/* nothing */
@@ -39,7 +39,6 @@
 
 #include "disk.h"
 #include "utils.h"
-#include "ibmacros.h"
 #include "sfs.h"
 #include "sb.h"
 #include "freemap.h"
@@ -38,7 +38,6 @@
 
 #include "disk.h"
 #include "utils.h"
-#include "ibmacros.h"
 #include "sfs.h"
 #include "main.h"
 
@@ -50,6 +49,7 @@ sfs_setup(void)
 {
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_extblock)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
 }
 
@@ -72,6 +72,15 @@ swapbits(uint8_t *bits)
 	(void)bits;
 }
 
+static
+void
+swapextent(struct sfs_extent *ext)
+{
+	ext->ext_fileblock = SWAP32(ext->ext_fileblock);
+	ext->ext_diskblock = SWAP32(ext->ext_diskblock);
+	ext->ext_len = SWAP32(ext->ext_len);
+}
+
 static
 void
 swapinode(struct sfs_dinode *sfi)
@@ -81,21 +90,15 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_nextents = SWAP16(sfi->sfi_nextents);
+	sfi->sfi_depth = SWAP16(sfi->sfi_depth);
 
-	for (i=0; i<NUM_D; i++) {
-		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
+	for (i=0; i<SFS_NIEXTENTS; i++) {
+		swapextent(&sfi->sfi_extents[i]);
 	}
 
-	for (i=0; i<NUM_I; i++) {
-		SET_I(sfi, i) = SWAP32(GET_I(sfi, i));
-	}
-
-	for (i=0; i<NUM_II; i++) {
-		SET_II(sfi, i) = SWAP32(GET_II(sfi, i));
-	}
-
-	for (i=0; i<NUM_III; i++) {
-		SET_III(sfi, i) = SWAP32(GET_III(sfi, i));
+	for (i=0; i<SFS_NDIRINDEX; i++) {
+		sfi->sfi_dirindex[i] = SWAP32(sfi->sfi_dirindex[i]);
 	}
 }
 
@@ -108,11 +111,14 @@ swapdir(struct sfs_direntry *sfd)
 
 static
 void
-swapindir(uint32_t *entries)
+swapextblock(struct sfs_extblock *eb)
 {
 	int i;
-	for (i=0; i<SFS_DBPERIDB; i++) {
-		entries[i] = SWAP32(entries[i]);
+
+	eb->eb_magic = SWAP32(eb->eb_magic);
+	eb->eb_nextents = SWAP32(eb->eb_nextents);
+	for (i=0; i<SFS_EXTPERBLOCK; i++) {
+		swapextent(&eb->eb_extents[i]);
 	}
 }
 
@@ -120,68 +126,57 @@ swapindir(uint32_t *entries)
 // bmap()
 
 /*
- * Indirect block bmap: in indirect block IBLOCK, read the entry at
- * block OFFSET from the first file block mapped by this indirect
- * block.
- *
- * ENTRYSIZE is how many blocks each entry describes; for a
- * singly-indirect block this is 1. For a multiply-indirect block,
- * it is more than 1; in this case recurse.
+ * Look FILEBLOCK up in the N extents EXTS. Returns 0 for a hole.
  */
 static
 uint32_t
-ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
+extbmap(const struct sfs_extent *exts, uint32_t n, uint32_t fileblock)
 {
-	uint32_t entries[SFS_DBPERIDB];
-
-	if (iblock == 0) {
-		return 0;
-	}
-
-	diskread(entries, iblock);
-	swapindir(entries);
+	uint32_t i;
 
-	if (entrysize > 1) {
-		uint32_t index = offset / entrysize;
-		offset %= entrysize;
-		return ibmap(entries[index], offset, entrysize/SFS_DBPERIDB);
-	}
-	else {
-		assert(offset < SFS_DBPERIDB);
-		return entries[offset];
+	for (i=0; i<n; i++) {
+		if (fileblock < exts[i].ext_fileblock) {
+			break;
+		}
+		if (fileblock - exts[i].ext_fileblock < exts[i].ext_len) {
+			return exts[i].ext_diskblock +
+				(fileblock - exts[i].ext_fileblock);
+		}
 	}
+	return 0;
 }
 
 /*
  * bmap() for SFS.
  *
- * Given an inode and a file block, returns a disk block.
+ * Given an inode and a file block, returns a disk block. The inode's
+ * extents are assumed to have been checked already (by pass1).
  */
 static
 uint32_t
 bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 {
-	uint32_t iblock, offset;
+	struct sfs_extblock eb;
+	uint32_t i, n;
 
-	if (fileblock < INOMAX_D) {
-		return GET_D(sfi, fileblock);
-	}
-	else if (fileblock < INOMAX_I) {
-		iblock = (fileblock - INOMAX_D) / RANGE_I;
-		offset = (fileblock - INOMAX_D) % RANGE_I;
-		return ibmap(GET_I(sfi, iblock), offset, RANGE_D);
+	n = sfi->sfi_nextents;
+	assert(n <= SFS_NIEXTENTS);
+	if (sfi->sfi_depth == 0) {
+		return extbmap(sfi->sfi_extents, n, fileblock);
 	}
-	else if (fileblock < INOMAX_II) {
-		iblock = (fileblock - INOMAX_I) / RANGE_II;
-		offset = (fileblock - INOMAX_I) % RANGE_II;
-		return ibmap(GET_II(sfi, iblock), offset, RANGE_I);
+
+	if (n == 0 || fileblock < sfi->sfi_extents[0].ext_fileblock) {
+		return 0;
 	}
-	else if (fileblock < INOMAX_III) {
-		iblock = (fileblock - INOMAX_II) / RANGE_III;
-		offset = (fileblock - INOMAX_II) % RANGE_III;
-		return ibmap(GET_III(sfi, iblock), offset, RANGE_II);
+	/* find the last extent block that starts at or before fileblock */
+	for (i=n; i>1; i--) {
+		if (sfi->sfi_extents[i-1].ext_fileblock <= fileblock) {
+			break;
+		}
 	}
-	return 0;
+	sfs_readextblock(sfi->sfi_extents[i-1].ext_diskblock, &eb);
+	assert(eb.eb_nextents <= SFS_EXTPERBLOCK);
+	return extbmap(eb.eb_extents, eb.eb_nextents, fileblock);
 }
 
 ////////////////////////////////////////////////////////////
@@ -246,22 +241,22 @@ sfs_writeinode(uint32_t ino, struct sfs_dinode *sfi)
 }
 
 /*
- *  indirect blocks - blocknum is a disk block number.
+ *  extent blocks - blocknum is a disk block number.
  */
 
 void
-sfs_readindirect(uint32_t blocknum, uint32_t *entries)
+sfs_readextblock(uint32_t blocknum, struct sfs_extblock *eb)
 {
-	diskread(entries, blocknum);
-	swapindir(entries);
+	diskread(eb, blocknum);
+	swapextblock(eb);
 }
 
 void
-sfs_writeindirect(uint32_t blocknum, uint32_t *entries)
+sfs_writeextblock(uint32_t blocknum, struct sfs_extblock *eb)
 {
-	swapindir(entries);
-	diskwrite(entries, blocknum);
-	swapindir(entries);
+	swapextblock(eb);
+	diskwrite(eb, blocknum);
+	swapextblock(eb);
 }
 
 ////////////////////////////////////////////////////////////
@@ -354,10 +349,38 @@ sfs_writedirblock(struct sfs_direntry *d, uint32_t diskblock)
 	}
 }
 
+/*
+ * Write the name index blocks of the directory SFI (if it has any)
+ * to match the ND entries in D. Slots past ND are marked free.
+ */
+void
+sfs_writedirindex(const struct sfs_dinode *sfi,
+		  const struct sfs_direntry *d, unsigned nd)
+{
+	uint8_t tags[SFS_BLOCKSIZE];
+	unsigned i, j, slot;
+
+	for (i=0; i<SFS_NDIRINDEX; i++) {
+		if (sfi->sfi_dirindex[i] == 0) {
+			continue;
+		}
+		for (j=0; j<SFS_BLOCKSIZE; j++) {
+			slot = i*SFS_BLOCKSIZE + j;
+			if (slot >= nd || d[slot].sfd_ino == SFS_NOINO) {
+				tags[j] = 0;
+			}
+			else {
+				tags[j] = sfs_dirtag(d[slot].sfd_name);
+			}
+		}
+		diskwrite(tags, sfi->sfi_dirindex[i]);
+	}
+}
+
 /*
  * Write out a directory, from the inode SFI, using D, which is a
  * buffer with ND slots. The caller is assumed to have set the inode
- * size accordingly.
+ * size accordingly. The name index, if any, is rewritten to match.
  */
 void
 sfs_writedir(const struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
@@ -369,6 +392,9 @@ sfs_writedir(const struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 	struct sfs_direntry buffer[atonce];
 	uint32_t diskblock;
 
+	/* Before the entries get byte-swapped for writing */
+	sfs_writedirindex(sfi, d, nd);
+
 	left = nd;
 	for (i=0; i<nblocks; i++) {
 		diskblock = bmap(sfi, i);
@@ -40,6 +40,7 @@
 
 struct sfs_superblock;
 struct sfs_dinode;
+struct sfs_extblock;
 struct sfs_direntry;
 
 /* Call this before anything else in this module */
@@ -61,15 +62,22 @@ void sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits);
 void sfs_readinode(uint32_t inum, struct sfs_dinode *sfi);
 void sfs_writeinode(uint32_t inum, struct sfs_dinode *sfi);
 
-/* indirect block (any indirection level) */
-void sfs_readindirect(uint32_t blocknum, uint32_t *entries);
-void sfs_writeindirect(uint32_t blocknum, uint32_t *entries);
+/* extent block */
+void sfs_readextblock(uint32_t blocknum, struct sfs_extblock *eb);
+void sfs_writeextblock(uint32_t blocknum, struct sfs_extblock *eb);
 
 /* directory - ND should be the number of directory entries D points to */
 void sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd);
 void sfs_writedir(const struct sfs_dinode *sfi,
 		  struct sfs_direntry *d, unsigned nd);
 
+/*
+ * directory name index - rewrite the index blocks SFI has so they
+ * match the ND entries in D
+ */
+void sfs_writedirindex(const struct sfs_dinode *sfi,
+		       const struct sfs_direntry *d, unsigned nd);
+
 /* Try to add an entry to a directory. */
 int sfsdir_tryadd(struct sfs_direntry *d, int nd,
 		  const char *name, uint32_t ino);
@@ -0,0 +1,144 @@
+/*
+ * dirbench - large directory benchmark.
+ *
+ * Usage: dirbench [nentries ...]
+ *
+ * For each NENTRIES (by default 100, 1000, and 10000), creates that
+ * many files in the current directory, then opens each one, then
+ * tries to open as many names that don't exist, then removes the
+ * files, and reports the rate of each. Every one of these has to
+ * search the directory, so with a plain linear directory the rates
+ * fall off as the directory grows; with a name index they shouldn't.
+ *
+ * An SFS directory can only hold 1536 entries (SFS_DIRMAXSLOTS), so a
+ * run that doesn't fit stops creating when the directory is full and
+ * carries on with the files it got.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+static const int defaultsizes[] = { 100, 1000, 10000 };
+
+static
+void
+report(int size, const char *what, int count, unsigned long long nsecs)
+{
+	char label[32];
+
+	snprintf(label, sizeof(label), "%5d: %s", size, what);
+	bench_report("dirbench", label, count, NULL, nsecs);
+}
+
+static
+void
+entname(char *buf, size_t len, int size, int i)
+{
+	snprintf(buf, len, "dirbench.%d.%d", size, i);
+}
+
+static
+void
+missingname(char *buf, size_t len, int size, int i)
+{
+	snprintf(buf, len, "dirbench.%d.missing.%d", size, i);
+}
+
+static
+void
+run(int size)
+{
+	char name[64];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i, n, fd;
+
+	/* create */
+	benchtimer_start(&bt);
+	for (n=0; n<size; n++) {
+		entname(name, sizeof(name), size, n);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			warn("%s", name);
+			break;
+		}
+		close(fd);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	if (n == 0) {
+		printf("dirbench: %5d: no room in the directory\n", size);
+		return;
+	}
+	report(size, "create", n, nsecs);
+
+	/* look up existing names */
+	benchtimer_start(&bt);
+	for (i=0; i<n; i++) {
+		entname(name, sizeof(name), size, i);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		close(fd);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	report(size, "lookup", n, nsecs);
+
+	/* look up names that aren't there; each one is a full miss */
+	benchtimer_start(&bt);
+	for (i=0; i<n; i++) {
+		missingname(name, sizeof(name), size, i);
+		fd = open(name, O_RDONLY);
+		if (fd >= 0) {
+			errx(1, "%s: exists", name);
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	report(size, "missing", n, nsecs);
+
+	/* unlink */
+	benchtimer_start(&bt);
+	for (i=0; i<n; i++) {
+		entname(name, sizeof(name), size, i);
+		if (remove(name) < 0) {
+			if (errno == ENOSYS) {
+				printf("dirbench: %5d: no remove; "
+				       "leaving the files\n", size);
+				return;
+			}
+			err(1, "%s: remove", name);
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	report(size, "unlink", n, nsecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+	int j, size;
+
+	if (argc > 1) {
+		for (j=1; j<argc; j++) {
+			size = atoi(argv[j]);
+			if (size < 1) {
+				errx(1, "Usage: dirbench [nentries ...]");
+			}
+			run(size);
+		}
+	}
+	else {
+		for (i=0; i<sizeof(defaultsizes)/sizeof(defaultsizes[0]); i++) {
+			run(defaultsizes[i]);
+		}
+	}
+
+	printf("dirbench: passed\n");
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * diskbench - raw disk transfer benchmark.
+ *
+ * Usage: diskbench [-w] [device [kbytes]]
+ *
+ * Reads the first KBYTES (default 256) of DEVICE (default lhd1raw:)
+ * in transfers of one sector, 4K, and 64K, and for each reports the
+ * throughput and what the driver's statistics ioctl says: how many
+ * requests and interrupts it took, the sectors per interrupt, and the
+ * average and worst request latency. Larger transfers should take
+ * fewer, longer requests and move data faster.
+ *
+ * With -w, writes the same region back with what was read from it
+ * first, so the contents are unchanged if it finishes; don't use it
+ * on a disk that's mounted.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_DEVICE "lhd1raw:"
+#define DEFAULT_KBYTES 256
+#define MAXXFER        65536
+
+static const int xfersizes[] = { 512, 4096, MAXXFER };
+
+static char *image;
+static char buf[MAXXFER];
+
+static
+void
+report(const char *what, int xfer, int total, unsigned long long nsecs,
+       const struct diskstats *ds)
+{
+	char label[32];
+
+	snprintf(label, sizeof(label), "%-5s %5d-byte", what, xfer);
+	bench_report("diskbench", label, total / 1024, "KB", nsecs);
+
+	if (ds->ds_requests == 0 || ds->ds_interrupts == 0) {
+		return;
+	}
+	printf("diskbench:   %u requests, %u interrupts, "
+	       "%u.%02u sectors/interrupt, %u errors\n",
+	       ds->ds_requests, ds->ds_interrupts,
+	       ds->ds_sectors / ds->ds_interrupts,
+	       ds->ds_sectors % ds->ds_interrupts * 100 / ds->ds_interrupts,
+	       ds->ds_errors);
+	printf("diskbench:   latency %llu usec average, %llu usec max\n",
+	       (unsigned long long)ds->ds_totalnsecs / ds->ds_requests / 1000,
+	       (unsigned long long)ds->ds_maxnsecs / 1000);
+}
+
+static
+void
+run(int fd, const char *dev, int dowrite, int xfer, int total)
+{
+	struct diskstats ds;
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int pos, r;
+
+	if (ioctl(fd, IOCTL_DISKSTATS_RESET, NULL) < 0) {
+		err(1, "%s: ioctl", dev);
+	}
+
+	benchtimer_start(&bt);
+	for (pos=0; pos<total; pos += xfer) {
+		if (dowrite) {
+			r = pwrite(fd, image + pos, xfer, pos);
+		}
+		else {
+			r = pread(fd, buf, xfer, pos);
+		}
+		if (r < 0) {
+			err(1, "%s: %s at %d", dev, dowrite ? "write" : "read",
+			    pos);
+		}
+		if (r != xfer) {
+			errx(1, "%s: short %s at %d", dev,
+			     dowrite ? "write" : "read", pos);
+		}
+		if (!dowrite && memcmp(buf, image + pos, xfer) != 0) {
+			errx(1, "%s: data at %d changed between reads",
+			     dev, pos);
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+
+	if (ioctl(fd, IOCTL_DISKSTATS, &ds) < 0) {
+		err(1, "%s: ioctl", dev);
+	}
+	report(dowrite ? "write" : "read", xfer, total, nsecs, &ds);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *dev = DEFAULT_DEVICE;
+	int kbytes = DEFAULT_KBYTES;
+	int dowrite = 0;
+	int fd, i, total, pos, r;
+	unsigned j;
+
+	i = 1;
+	if (argc > i && !strcmp(argv[i], "-w")) {
+		dowrite = 1;
+		i++;
+	}
+	if (argc > i) {
+		dev = argv[i++];
+	}
+	if (argc > i) {
+		kbytes = atoi(argv[i++]);
+	}
+	if (argc > i || kbytes < 64 || kbytes % 64 != 0) {
+		errx(1, "Usage: diskbench [-w] [device [kbytes]] "
+		     "(kbytes a multiple of 64)");
+	}
+	total = kbytes * 1024;
+
+	image = malloc(total);
+	if (image == NULL) {
+		errx(1, "Out of memory");
+	}
+
+	fd = open(dev, dowrite ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", dev);
+	}
+
+	/* Get the reference copy that every pass checks against. */
+	for (pos=0; pos<total; pos += MAXXFER) {
+		r = pread(fd, image + pos, MAXXFER, pos);
+		if (r < 0) {
+			err(1, "%s: read at %d", dev, pos);
+		}
+		if (r != MAXXFER) {
+			errx(1, "%s: short read at %d", dev, pos);
+		}
+	}
+
+	for (j=0; j<sizeof(xfersizes)/sizeof(xfersizes[0]); j++) {
+		run(fd, dev, 0, xfersizes[j], total);
+		if (dowrite) {
+			run(fd, dev, 1, xfersizes[j], total);
+		}
+	}
+
+	close(fd);
+	free(image);
+	printf("diskbench: passed\n");
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * forkrate - fork rate with many processes already in existence.
+ *
+ * Usage: forkrate [nforks [population...]]
+ *
+ * For each population size (by default 10, 100 and 1000), first forks
+ * that many children that exit right away and are left unreaped, so
+ * they keep holding their pids. Then times NFORKS rounds of
+ * fork/_exit/waitpid on top of them, and finally reaps the population.
+ *
+ * If pid allocation or reaping cost grows with the number of
+ * processes, the reported forks/sec drops as the population grows.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_FORKS  500
+#define MAXPOPULATION  2000
+
+static pid_t population[MAXPOPULATION];
+
+static
+void
+run(int npop, int nforks)
+{
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	char what[32];
+	int i;
+
+	for (i=0; i<npop; i++) {
+		population[i] = bench_forkexit(1);
+	}
+
+	benchtimer_start(&bt);
+	for (i=0; i<nforks; i++) {
+		bench_reap(bench_forkexit(2), 2);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+
+	for (i=0; i<npop; i++) {
+		bench_reap(population[i], 1);
+	}
+
+	snprintf(what, sizeof(what), "%5d live", npop);
+	bench_report("forkrate", what, nforks, "forks", nsecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int defaultpops[] = { 10, 100, 1000 };
+	int nforks = DEFAULT_FORKS;
+	int i, npop;
+
+	if (argc > 1) {
+		nforks = atoi(argv[1]);
+	}
+	if (nforks < 1) {
+		errx(1, "Usage: forkrate [nforks [population...]]");
+	}
+
+	if (argc > 2) {
+		for (i=2; i<argc; i++) {
+			npop = atoi(argv[i]);
+			if (npop < 0 || npop > MAXPOPULATION) {
+				errx(1, "population must be 0-%d",
+				     MAXPOPULATION);
+			}
+			run(npop, nforks);
+		}
+	}
+	else {
+		for (i=0; i<3; i++) {
+			run(defaultpops[i], nforks);
+		}
+	}
+
+	printf("forkrate: passed\n");
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * forkwait - parallel fork/exit/waitpid benchmark.
+ *
+ * Usage: forkwait [nparents [nchildren [nrounds]]]
+ *
+ * Starts NPARENTS worker processes. Each worker repeatedly forks
+ * NCHILDREN children that exit immediately with a known status, then
+ * waits for all of them. Every exit and every waitpid goes through
+ * the kernel's process table and its locks, so this measures how well
+ * those scale when many processes exit and reap at once.
+ *
+ * Each child is first polled with WNOHANG, which must return either 0
+ * (still running) or the child's pid, before the blocking wait.
+ *
+ * Prints the total elapsed time and the fork+exit+waitpid rate.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_PARENTS   4
+#define DEFAULT_CHILDREN  8
+#define DEFAULT_ROUNDS    10
+#define MAXCHILDREN       64
+
+static
+void
+worker(int me, int nchildren, int nrounds)
+{
+	pid_t pids[MAXCHILDREN];
+	pid_t ret;
+	int round, i, status;
+
+	for (round=0; round<nrounds; round++) {
+		for (i=0; i<nchildren; i++) {
+			pids[i] = fork();
+			if (pids[i] < 0) {
+				err(1, "worker %d: fork", me);
+			}
+			if (pids[i] == 0) {
+				_exit(i);
+			}
+		}
+		for (i=0; i<nchildren; i++) {
+			ret = waitpid(pids[i], &status, WNOHANG);
+			if (ret < 0) {
+				err(1, "worker %d: waitpid WNOHANG", me);
+			}
+			if (ret == 0) {
+				ret = waitpid(pids[i], &status, 0);
+				if (ret < 0) {
+					err(1, "worker %d: waitpid", me);
+				}
+			}
+			if (ret != pids[i]) {
+				errx(1, "worker %d: waitpid returned %d, "
+				     "expected %d", me, ret, pids[i]);
+			}
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != i) {
+				errx(1, "worker %d: child %d: bad status %d",
+				     me, i, status);
+			}
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nparents = DEFAULT_PARENTS;
+	int nchildren = DEFAULT_CHILDREN;
+	int nrounds = DEFAULT_ROUNDS;
+	pid_t pids[MAXCHILDREN];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i;
+
+	if (argc > 1) {
+		nparents = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nchildren = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		nrounds = atoi(argv[3]);
+	}
+	if (nparents < 1 || nparents > MAXCHILDREN ||
+	    nchildren < 1 || nchildren > MAXCHILDREN || nrounds < 1) {
+		errx(1, "Usage: forkwait [nparents [nchildren [nrounds]]] "
+		     "(at most %d parents/children)", MAXCHILDREN);
+	}
+
+	printf("forkwait: %d parents x %d children x %d rounds\n",
+	       nparents, nchildren, nrounds);
+
+	benchtimer_start(&bt);
+
+	for (i=0; i<nparents; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			worker(i, nchildren, nrounds);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nparents; i++) {
+		bench_reap(pids[i], 0);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+
+	bench_report("forkwait", "fork/exit/waitpid",
+		     (unsigned long long)nparents * nchildren * nrounds,
+		     "children", nsecs);
+	printf("forkwait: passed\n");
+	return 0;
+}
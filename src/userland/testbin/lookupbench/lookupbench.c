@@ -0,0 +1,184 @@
+/*
+ * lookupbench - path lookup benchmark.
+ *
+ * Usage: lookupbench [nops [deeppath]]
+ *
+ * Times NOPS open+close pairs for each of:
+ *   - one file, over and over (the name cache should have it);
+ *   - a name that doesn't exist (the cache should remember that);
+ *   - DEEPPATH, by default /testbin/lookupbench, a path of several
+ *     components;
+ *   - a rotation through more files than the name cache holds, so
+ *     every lookup has to go to the filesystem.
+ * and reports lookups per second and the average latency of each.
+ *
+ * Before that, checks that creating a file that was just looked up
+ * and not found makes it visible, that a file can't be opened with a
+ * trailing slash, and, if the kernel supports remove, that removing
+ * a file that was just opened makes it disappear.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_OPS    2000
+#define DEFAULT_DEEP   "/testbin/lookupbench"
+#define HOTFILE        "lookupbench.hot"
+#define MISSINGFILE    "lookupbench.missing"
+#define NEWFILE        "lookupbench.new"
+#define NCOLD          400	/* more than the kernel's name cache */
+
+static
+void
+report(const char *what, int count, unsigned long long nsecs)
+{
+	bench_report("lookupbench", what, count, "lookups", nsecs);
+	printf("lookupbench: %s: %llu usec each\n", what,
+	       nsecs / count / 1000ULL);
+}
+
+static
+void
+coldname(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "lookupbench.%d", i);
+}
+
+static
+void
+makefile(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	close(fd);
+}
+
+static
+void
+checkinvalidate(void)
+{
+	int fd;
+
+	/* Look it up and fail, then create it; it must now be found */
+	remove(NEWFILE);
+	fd = open(NEWFILE, O_RDONLY);
+	if (fd >= 0) {
+		errx(1, "%s: exists before being created", NEWFILE);
+	}
+	makefile(NEWFILE);
+	fd = open(NEWFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: not found after being created", NEWFILE);
+	}
+	close(fd);
+
+	/* Only a directory can be named with a trailing slash */
+	fd = open(NEWFILE "/", O_RDONLY);
+	if (fd >= 0) {
+		errx(1, "%s/: opened a file with a trailing slash", NEWFILE);
+	}
+	if (errno != ENOTDIR) {
+		err(1, "%s/: expected ENOTDIR", NEWFILE);
+	}
+
+	/* Now it's cached; remove it and it must be gone */
+	if (remove(NEWFILE) < 0) {
+		if (errno == ENOSYS) {
+			printf("lookupbench: no remove; skipping that check\n");
+			return;
+		}
+		err(1, "%s: remove", NEWFILE);
+	}
+	fd = open(NEWFILE, O_RDONLY);
+	if (fd >= 0) {
+		errx(1, "%s: still found after being removed", NEWFILE);
+	}
+}
+
+/*
+ * Open and close PATH NOPS times. If MISSING, it should fail to open.
+ */
+static
+void
+timeopen(const char *what, const char *path, int nops, int missing)
+{
+	struct benchtimer bt;
+	int i, fd;
+
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		fd = open(path, O_RDONLY);
+		if (missing) {
+			if (fd >= 0) {
+				errx(1, "%s: exists", path);
+			}
+			continue;
+		}
+		if (fd < 0) {
+			err(1, "%s", path);
+		}
+		close(fd);
+	}
+	report(what, nops, benchtimer_nsecs(&bt));
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *deeppath = DEFAULT_DEEP;
+	int nops = DEFAULT_OPS;
+	char name[32];
+	struct benchtimer bt;
+	int i, fd;
+
+	if (argc > 1) {
+		nops = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		deeppath = argv[2];
+	}
+	if (nops < 1) {
+		errx(1, "Usage: lookupbench [nops [deeppath]]");
+	}
+
+	checkinvalidate();
+
+	makefile(HOTFILE);
+	for (i=0; i<NCOLD; i++) {
+		coldname(name, sizeof(name), i);
+		makefile(name);
+	}
+
+	timeopen("hot", HOTFILE, nops, 0);
+	timeopen("missing", MISSINGFILE, nops, 1);
+	timeopen("deep", deeppath, nops, 0);
+
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		coldname(name, sizeof(name), i % NCOLD);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		close(fd);
+	}
+	report("cold", nops, benchtimer_nsecs(&bt));
+
+	remove(HOTFILE);
+	for (i=0; i<NCOLD; i++) {
+		coldname(name, sizeof(name), i);
+		remove(name);
+	}
+
+	printf("lookupbench: passed\n");
+	return 0;
+}
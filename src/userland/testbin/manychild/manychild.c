@@ -0,0 +1,105 @@
+/*
+ * manychild - one parent with very many children.
+ *
+ * Usage: manychild [nlive [nrounds [norphans]]]
+ *
+ * 1. Forks NLIVE children that exit at once and leaves them unreaped.
+ * 2. With those still around, times NROUNDS fork/exit/waitpid cycles,
+ *    so the cost of finding and reaping one child among many shows up.
+ * 3. Reaps the NLIVE children newest-first and checks each status,
+ *    then checks that waiting for one again fails with ECHILD.
+ * 4. Forks NORPHANS children that each fork a grandchild and exit
+ *    without waiting for it. The grandchildren are orphaned and must
+ *    be cleaned up by the kernel without anyone waiting for them.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_LIVE     1000
+#define DEFAULT_ROUNDS   1000
+#define DEFAULT_ORPHANS  200
+#define MAXLIVE          4000
+
+static pid_t live[MAXLIVE];
+
+int
+main(int argc, char *argv[])
+{
+	int nlive = DEFAULT_LIVE;
+	int nrounds = DEFAULT_ROUNDS;
+	int norphans = DEFAULT_ORPHANS;
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	pid_t pid;
+	int i, status;
+
+	if (argc > 1) {
+		nlive = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nrounds = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		norphans = atoi(argv[3]);
+	}
+	if (nlive < 1 || nlive > MAXLIVE || nrounds < 0 || norphans < 0) {
+		errx(1, "Usage: manychild [nlive [nrounds [norphans]]] "
+		     "(nlive 1-%d)", MAXLIVE);
+	}
+
+	/* 1. lots of unreaped children */
+	benchtimer_start(&bt);
+	for (i=0; i<nlive; i++) {
+		live[i] = bench_forkexit(i % 256);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("manychild", "forks", nlive, NULL, nsecs);
+
+	/* 2. fork and reap with all of those still there */
+	benchtimer_start(&bt);
+	for (i=0; i<nrounds; i++) {
+		bench_reap(bench_forkexit(7), 7);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("manychild", "fork+reap cycles", nrounds, NULL, nsecs);
+
+	/* 3. reap them newest first */
+	benchtimer_start(&bt);
+	for (i=nlive-1; i>=0; i--) {
+		bench_reap(live[i], i % 256);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("manychild", "reaps", nlive, NULL, nsecs);
+
+	if (waitpid(live[0], &status, 0) >= 0) {
+		errx(1, "waitpid on a reaped child succeeded");
+	}
+	if (errno != ECHILD) {
+		err(1, "waitpid on a reaped child: expected ECHILD, got");
+	}
+
+	/* 4. orphans */
+	benchtimer_start(&bt);
+	for (i=0; i<norphans; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			bench_forkexit(0);
+			_exit(3);
+		}
+		bench_reap(pid, 3);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("manychild", "orphaned grandchildren", norphans, NULL,
+		     nsecs);
+
+	printf("manychild: passed\n");
+	return 0;
+}
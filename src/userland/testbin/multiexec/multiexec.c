@@ -29,14 +29,19 @@
 
 /*
  * multiexec - stuff N procs into exec at once
- * usage: multiexec [-j N] [prog [arg...]]
+ * usage: multiexec [-j N] [-s] [prog [arg...]]
+ *
+ * With -s, start the N procs with spawn() instead of fork+exec, and
+ * report how long launching them took.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <spawn.h>
 #include <err.h>
+#include <test/bench.h>
 
 ////////////////////////////////////////////////////////////
 // semaphores
@@ -128,11 +133,42 @@ static int subargc = 0;
 
 static
 void
-spawn(int njobs)
+waitjobs(pid_t *pids, int njobs)
+{
+	int failed, status;
+	int i;
+
+	failed = 0;
+	for (i=0; i<njobs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			failed++;
+		}
+		else if (WIFSIGNALED(status)) {
+			warnx("pid %d (child %d): Signal %d",
+			      (int)pids[i], i, WTERMSIG(status));
+			failed++;
+		}
+		else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			warnx("pid %d (child %d): Exit %d",
+			      (int)pids[i], i, WEXITSTATUS(status));
+			failed++;
+		}
+	}
+	if (failed > 0) {
+		warnx("%d children failed", failed);
+	}
+	else {
+		printf("Succeeded\n");
+	}
+}
+
+static
+void
+forkjobs(int njobs)
 {
 	struct usem s1, s2;
 	pid_t pids[njobs];
-	int failed, status;
 	int i;
 
 	semcreate("1", &s1);
@@ -167,29 +203,7 @@ spawn(int njobs)
 	printf("Starting the execs...\n");
 	semV(&s2, njobs);
 
-	failed = 0;
-	for (i=0; i<njobs; i++) {
-		if (waitpid(pids[i], &status, 0) < 0) {
-			warn("waitpid");
-			failed++;
-		}
-		else if (WIFSIGNALED(status)) {
-			warnx("pid %d (child %d): Signal %d",
-			      (int)pids[i], i, WTERMSIG(status));
-			failed++;
-		}
-		else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-			warnx("pid %d (child %d): Exit %d",
-			      (int)pids[i], i, WEXITSTATUS(status));
-			failed++;
-		}
-	}
-	if (failed > 0) {
-		warnx("%d children failed", failed);
-	}
-	else {
-		printf("Succeeded\n");
-	}
+	waitjobs(pids, njobs);
 
 	semclose(&s1);
 	semclose(&s2);
@@ -197,12 +211,38 @@ spawn(int njobs)
 	semdestroy(&s2);
 }
 
+static
+void
+spawnjobs(int njobs)
+{
+	pid_t pids[njobs];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i;
+
+	printf("Spawning %d child processes...\n", njobs);
+
+	benchtimer_start(&bt);
+	for (i=0; i<njobs; i++) {
+		pids[i] = spawn(subargv[0], subargv, NULL, 0);
+		if (pids[i] == -1) {
+			/* abandon the other procs; no way to kill them */
+			err(1, "spawn");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("multiexec", "spawn", njobs, "spawns", nsecs);
+
+	waitjobs(pids, njobs);
+}
+
 int
 main(int argc, char *argv[])
 {
 	static char default_prog[] = "/bin/pwd";
 
 	int njobs = 12;
+	int usespawn = 0;
 	int i;
 
 	for (i=1; i<argc; i++) {
@@ -213,6 +253,9 @@ main(int argc, char *argv[])
 			}
 			njobs = atoi(argv[i]);
 		}
+		else if (!strcmp(argv[i], "-s")) {
+			usespawn = 1;
+		}
 #if 0 /* XXX we apparently don't have strncmp? */
 		else if (!strncmp(argv[i], "-j", 2)) {
 			njobs = atoi(argv[i] + 2);
@@ -231,7 +274,12 @@ main(int argc, char *argv[])
 	}
 	subargv[subargc] = NULL;
 
-	spawn(njobs);
+	if (usespawn) {
+		spawnjobs(njobs);
+	}
+	else {
+		forkjobs(njobs);
+	}
 
 	return 0;
 }
@@ -0,0 +1,101 @@
+/*
+ * openclose - descriptor allocation benchmark.
+ *
+ * Usage: openclose [nloops [nheld]]
+ *
+ * Opens NHELD descriptors on a scratch file and keeps them open, so
+ * the descriptor table is reasonably full, then opens and closes the
+ * file NLOOPS times and reports open+close pairs per second. Also
+ * checks that open always returns the lowest free descriptor.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FILENAME       "openclose.tmp"
+#define DEFAULT_LOOPS  2000
+#define DEFAULT_HELD   100
+
+static int held[OPEN_MAX];
+
+int
+main(int argc, char *argv[])
+{
+	int nloops = DEFAULT_LOOPS;
+	int nheld = DEFAULT_HELD;
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i, fd, expected;
+
+	if (argc > 1) {
+		nloops = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nheld = atoi(argv[2]);
+	}
+	if (nloops < 1 || nheld < 0 || nheld > OPEN_MAX - 4) {
+		errx(1, "Usage: openclose [nloops [nheld]] (nheld at most %d)",
+		     OPEN_MAX - 4);
+	}
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	close(fd);
+
+	/* Hold NHELD descriptors; they should come out as 3, 4, 5... */
+	for (i=0; i<nheld; i++) {
+		held[i] = open(FILENAME, O_RDONLY);
+		if (held[i] < 0) {
+			err(1, "open %d", i);
+		}
+		if (held[i] != i + 3) {
+			errx(1, "open %d returned fd %d, expected %d",
+			     i, held[i], i + 3);
+		}
+	}
+
+	/* Free one in the middle; it must be reused first */
+	if (nheld > 1) {
+		expected = held[nheld / 2];
+		close(expected);
+		fd = open(FILENAME, O_RDONLY);
+		if (fd != expected) {
+			errx(1, "reopen returned fd %d, expected %d",
+			     fd, expected);
+		}
+		held[nheld / 2] = fd;
+	}
+
+	expected = nheld + 3;
+	benchtimer_start(&bt);
+	for (i=0; i<nloops; i++) {
+		fd = open(FILENAME, O_RDONLY);
+		if (fd < 0) {
+			err(1, "open");
+		}
+		if (fd != expected) {
+			errx(1, "open returned fd %d, expected %d",
+			     fd, expected);
+		}
+		if (close(fd) < 0) {
+			err(1, "close");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("openclose", "open+close", nloops, NULL, nsecs);
+
+	for (i=0; i<nheld; i++) {
+		close(held[i]);
+	}
+	remove(FILENAME);
+
+	printf("openclose: passed\n");
+	return 0;
+}
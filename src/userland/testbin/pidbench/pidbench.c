@@ -0,0 +1,103 @@
+/*
+ * pidbench - process table lookup throughput benchmark.
+ *
+ * Usage: pidbench [nprocs [nops]]
+ *
+ * Starts NPROCS processes that all hammer the read-only paths of the
+ * kernel's process table at once: getpid(), and waitpid() on a pid
+ * that is not their child (which must fail with ECHILD without ever
+ * blocking). Neither call changes the table, so they should not
+ * serialize against each other.
+ *
+ * This is run once with getpid alone and once with the two mixed,
+ * printing the aggregate number of calls per second.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_PROCS  8
+#define DEFAULT_OPS    2000
+#define MAXPROCS       64
+
+static
+void
+worker(int mixed, pid_t notmine, int nops)
+{
+	pid_t me;
+	int i;
+
+	me = getpid();
+	for (i=0; i<nops; i++) {
+		if (getpid() != me) {
+			errx(1, "getpid changed");
+		}
+		if (mixed) {
+			if (waitpid(notmine, NULL, 0) != -1 ||
+			    errno != ECHILD) {
+				errx(1, "waitpid on non-child did not "
+				     "fail with ECHILD");
+			}
+		}
+	}
+}
+
+static
+void
+run(const char *what, int mixed, int nprocs, int nops)
+{
+	pid_t pids[MAXPROCS], parent;
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i;
+
+	parent = getpid();
+
+	benchtimer_start(&bt);
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			worker(mixed, parent, nops);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nprocs; i++) {
+		bench_reap(pids[i], 0);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+
+	bench_report("pidbench", what,
+		     (unsigned long long)nprocs * nops * (mixed ? 2 : 1),
+		     "calls", nsecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nprocs = DEFAULT_PROCS;
+	int nops = DEFAULT_OPS;
+
+	if (argc > 1) {
+		nprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nops = atoi(argv[2]);
+	}
+	if (nprocs < 1 || nprocs > MAXPROCS || nops < 1) {
+		errx(1, "Usage: pidbench [nprocs [nops]] "
+		     "(at most %d procs)", MAXPROCS);
+	}
+
+	printf("pidbench: %d processes x %d operations\n", nprocs, nops);
+	run("getpid", 0, nprocs, nops);
+	run("getpid+waitpid", 1, nprocs, nops);
+	printf("pidbench: passed\n");
+	return 0;
+}
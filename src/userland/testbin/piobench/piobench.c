@@ -0,0 +1,218 @@
+/*
+ * piobench - positional and scatter/gather I/O.
+ *
+ * Usage: piobench [nops]
+ *
+ * Checks that pread/pwrite don't move the file offset and that
+ * readv/writev move data in iovec order, then times:
+ *   - NOPS lseek+read pairs against NOPS preads at the same offsets;
+ *   - NOPS records written as two writes (header, payload) against
+ *     NOPS records written with one writev.
+ */
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define FILENAME      "piobench.tmp"
+#define FILESIZE      (64 * 1024)
+#define BLOCKSIZE     512
+#define HEADERSIZE    16
+#define PAYLOADSIZE   240
+#define DEFAULT_OPS   1000
+
+static char filedata[FILESIZE];
+static char buf[BLOCKSIZE];
+
+static
+off_t
+blockpos(int i)
+{
+	/* Hop around the file rather than reading it in order */
+	return ((off_t)(i * 7) % (FILESIZE / BLOCKSIZE)) * BLOCKSIZE;
+}
+
+static
+void
+checkblock(off_t pos)
+{
+	if (memcmp(buf, filedata + pos, BLOCKSIZE) != 0) {
+		errx(1, "wrong data read at offset %ld", (long)pos);
+	}
+}
+
+static
+void
+checkoffset(int fd, off_t expected, const char *after)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != expected) {
+		errx(1, "offset is %ld after %s, expected %ld",
+		     (long)pos, after, (long)expected);
+	}
+}
+
+static
+void
+makefile(void)
+{
+	int fd, i;
+	ssize_t r;
+
+	for (i=0; i<FILESIZE; i++) {
+		filedata[i] = 'a' + (i * 13 + i / 256) % 26;
+	}
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	r = write(fd, filedata, FILESIZE);
+	if (r != FILESIZE) {
+		err(1, "%s: write", FILENAME);
+	}
+	close(fd);
+}
+
+static
+void
+checkpositional(int fd)
+{
+	struct iovec iov[2];
+	char head[HEADERSIZE];
+
+	if (lseek(fd, 100, SEEK_SET) != 100) {
+		err(1, "lseek");
+	}
+	if (pread(fd, buf, BLOCKSIZE, 4096) != BLOCKSIZE) {
+		err(1, "pread");
+	}
+	checkblock(4096);
+	checkoffset(fd, 100, "pread");
+
+	if (pwrite(fd, filedata + 8192, BLOCKSIZE, 8192) != BLOCKSIZE) {
+		err(1, "pwrite");
+	}
+	checkoffset(fd, 100, "pwrite");
+
+	if (pread(fd, buf, BLOCKSIZE, -1) >= 0) {
+		errx(1, "pread at a negative offset succeeded");
+	}
+
+	iov[0].iov_base = head;
+	iov[0].iov_len = HEADERSIZE;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = BLOCKSIZE;
+	if (lseek(fd, 1024, SEEK_SET) != 1024) {
+		err(1, "lseek");
+	}
+	if (readv(fd, iov, 2) != HEADERSIZE + BLOCKSIZE) {
+		err(1, "readv");
+	}
+	if (memcmp(head, filedata + 1024, HEADERSIZE) != 0) {
+		errx(1, "readv: wrong data in first iovec");
+	}
+	checkblock(1024 + HEADERSIZE);
+	checkoffset(fd, 1024 + HEADERSIZE + BLOCKSIZE, "readv");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct iovec iov[2];
+	char header[HEADERSIZE], payload[PAYLOADSIZE];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int nops = DEFAULT_OPS;
+	int fd, i;
+	off_t pos;
+
+	if (argc > 1) {
+		nops = atoi(argv[1]);
+	}
+	if (nops < 1) {
+		errx(1, "Usage: piobench [nops]");
+	}
+
+	makefile();
+	fd = open(FILENAME, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	checkpositional(fd);
+
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		pos = blockpos(i);
+		if (lseek(fd, pos, SEEK_SET) != pos) {
+			err(1, "lseek");
+		}
+		if (read(fd, buf, BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "read");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	checkblock(pos);
+	bench_report("piobench", "lseek+read", nops, NULL, nsecs);
+
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		pos = blockpos(i);
+		if (pread(fd, buf, BLOCKSIZE, pos) != BLOCKSIZE) {
+			err(1, "pread");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	checkblock(pos);
+	bench_report("piobench", "pread", nops, NULL, nsecs);
+	close(fd);
+
+	memset(header, 'H', HEADERSIZE);
+	memset(payload, 'P', PAYLOADSIZE);
+
+	fd = open(FILENAME, O_WRONLY|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		if (write(fd, header, HEADERSIZE) != HEADERSIZE) {
+			err(1, "write");
+		}
+		if (write(fd, payload, PAYLOADSIZE) != PAYLOADSIZE) {
+			err(1, "write");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("piobench", "write+write", nops, NULL, nsecs);
+	close(fd);
+
+	fd = open(FILENAME, O_WRONLY|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	iov[0].iov_base = header;
+	iov[0].iov_len = HEADERSIZE;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = PAYLOADSIZE;
+	benchtimer_start(&bt);
+	for (i=0; i<nops; i++) {
+		if (writev(fd, iov, 2) != HEADERSIZE + PAYLOADSIZE) {
+			err(1, "writev");
+		}
+	}
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("piobench", "writev", nops, NULL, nsecs);
+	checkoffset(fd, (off_t)nops * (HEADERSIZE + PAYLOADSIZE), "writev");
+	close(fd);
+
+	remove(FILENAME);
+	printf("piobench: passed\n");
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * readahead - sequential and random read throughput.
+ *
+ * Usage: readahead [nrandom]
+ *
+ * Writes NFILES files of FILESIZE bytes each, more than the kernel's
+ * buffer cache holds, and syncs them. Then reads every file straight
+ * through, which should be served mostly from blocks the kernel has
+ * read ahead, and then reads NRANDOM single blocks at random places
+ * in random files, which can't be. Reports KB/sec for each, and checks
+ * the data read.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define NFILES          4
+#define FILESIZE        (64 * 1024)
+#define BLOCKSIZE       512
+#define CHUNKSIZE       4096
+#define DEFAULT_RANDOM  500
+
+static char buf[CHUNKSIZE];
+
+static
+void
+filename(char *name, size_t len, int i)
+{
+	snprintf(name, len, "readahead.%d", i);
+}
+
+static
+char
+pattern(int file, off_t pos)
+{
+	return 'a' + (file * 7 + pos / BLOCKSIZE + pos) % 26;
+}
+
+static
+void
+checkdata(int file, off_t pos, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (buf[i] != pattern(file, pos + i)) {
+			errx(1, "file %d: wrong data at offset %ld",
+			     file, (long)(pos + i));
+		}
+	}
+}
+
+static
+void
+makefiles(void)
+{
+	char name[32];
+	off_t pos;
+	size_t i;
+	int f, fd;
+
+	for (f=0; f<NFILES; f++) {
+		filename(name, sizeof(name), f);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		for (pos=0; pos<FILESIZE; pos+=CHUNKSIZE) {
+			for (i=0; i<CHUNKSIZE; i++) {
+				buf[i] = pattern(f, pos + i);
+			}
+			if (write(fd, buf, CHUNKSIZE) != CHUNKSIZE) {
+				err(1, "%s: write", name);
+			}
+		}
+		close(fd);
+	}
+	sync();
+}
+
+static
+unsigned long long
+readsequential(void)
+{
+	unsigned long long total = 0;
+	char name[32];
+	off_t pos;
+	ssize_t r;
+	int f, fd;
+
+	for (f=0; f<NFILES; f++) {
+		filename(name, sizeof(name), f);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		for (pos=0; pos<FILESIZE; pos+=r) {
+			r = read(fd, buf, CHUNKSIZE);
+			if (r < 0) {
+				err(1, "%s: read", name);
+			}
+			if (r == 0) {
+				errx(1, "%s: unexpected EOF at %ld", name,
+				     (long)pos);
+			}
+			checkdata(f, pos, r);
+		}
+		total += pos;
+		close(fd);
+	}
+	return total;
+}
+
+static
+unsigned long long
+readrandom(int nreads)
+{
+	char name[32];
+	int fds[NFILES];
+	off_t pos;
+	int f, i;
+
+	for (f=0; f<NFILES; f++) {
+		filename(name, sizeof(name), f);
+		fds[f] = open(name, O_RDONLY);
+		if (fds[f] < 0) {
+			err(1, "%s", name);
+		}
+	}
+	for (i=0; i<nreads; i++) {
+		f = random() % NFILES;
+		pos = (random() % (FILESIZE / BLOCKSIZE)) * BLOCKSIZE;
+		if (lseek(fds[f], pos, SEEK_SET) != pos) {
+			err(1, "lseek");
+		}
+		if (read(fds[f], buf, BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "read");
+		}
+		checkdata(f, pos, BLOCKSIZE);
+	}
+	for (f=0; f<NFILES; f++) {
+		close(fds[f]);
+	}
+	return (unsigned long long)nreads * BLOCKSIZE;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[32];
+	unsigned long long bytes, nsecs;
+	struct benchtimer bt;
+	int nrandom = DEFAULT_RANDOM;
+	int f;
+
+	if (argc > 1) {
+		nrandom = atoi(argv[1]);
+	}
+	if (nrandom < 1) {
+		errx(1, "Usage: readahead [nrandom]");
+	}
+
+	makefiles();
+
+	benchtimer_start(&bt);
+	bytes = readsequential();
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("readahead", "sequential", bytes / 1024, "KB", nsecs);
+
+	srandom(1);
+	benchtimer_start(&bt);
+	bytes = readrandom(nrandom);
+	nsecs = benchtimer_nsecs(&bt);
+	bench_report("readahead", "random", bytes / 1024, "KB", nsecs);
+
+	for (f=0; f<NFILES; f++) {
+		filename(name, sizeof(name), f);
+		remove(name);
+	}
+	printf("readahead: passed\n");
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * readconc - concurrent sequential readers.
+ *
+ * Usage: readconc [nreaders [kbytes]]
+ *
+ * Like the kernel's fs2 read stress test, but from user level and
+ * timed: writes NREADERS files of KBYTES each (default 8 files of
+ * 64K), then forks one reader per file, each of which reads its file
+ * from start to end a few times, and reports the combined throughput.
+ * The files together are bigger than the buffer cache, so most reads
+ * go to the disk, and with several readers at once the disk sees
+ * requests for several places interleaved; sorting and merging them
+ * in the kernel's I/O queue should keep the total from collapsing.
+ *
+ * Runs the same thing with a single reader first, for comparison.
+ * The kernel's biostat command shows how many requests were merged.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_READERS 8
+#define DEFAULT_KBYTES  64
+#define MAXREADERS      32
+#define ROUNDS          4
+#define CHUNK           4096
+
+static char buf[CHUNK];
+
+static
+void
+filename(char *name, size_t len, int i)
+{
+	snprintf(name, len, "readconc.%d", i);
+}
+
+static
+void
+makefile(int i, int kbytes)
+{
+	char name[32];
+	int fd, j, r;
+
+	filename(name, sizeof(name), i);
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	for (j=0; j<kbytes*1024/CHUNK; j++) {
+		memset(buf, 'a' + (i + j) % 26, sizeof(buf));
+		r = write(fd, buf, sizeof(buf));
+		if (r < 0) {
+			err(1, "%s: write", name);
+		}
+		if (r != CHUNK) {
+			errx(1, "%s: short write", name);
+		}
+	}
+	close(fd);
+}
+
+/*
+ * Read file I ROUNDS times over, checking what comes back.
+ */
+static
+void
+reader(int i, int kbytes)
+{
+	char name[32];
+	int fd, j, k, r;
+
+	filename(name, sizeof(name), i);
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	for (k=0; k<ROUNDS; k++) {
+		for (j=0; j<kbytes*1024/CHUNK; j++) {
+			r = pread(fd, buf, sizeof(buf), (off_t)j * CHUNK);
+			if (r < 0) {
+				err(1, "%s: read", name);
+			}
+			if (r != CHUNK) {
+				errx(1, "%s: short read", name);
+			}
+			if (buf[0] != 'a' + (i + j) % 26 ||
+			    buf[CHUNK-1] != buf[0]) {
+				errx(1, "%s: wrong data at %d", name, j*CHUNK);
+			}
+		}
+	}
+	close(fd);
+}
+
+static
+void
+run(int nreaders, int kbytes)
+{
+	pid_t pids[MAXREADERS];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	char what[32];
+	int i;
+
+	benchtimer_start(&bt);
+	for (i=0; i<nreaders; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			reader(i, kbytes);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nreaders; i++) {
+		bench_reap(pids[i], 0);
+	}
+	nsecs = benchtimer_nsecs(&bt);
+
+	snprintf(what, sizeof(what), "%2d readers", nreaders);
+	bench_report("readconc", what,
+		     (unsigned long long)nreaders * ROUNDS * kbytes, "KB",
+		     nsecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nreaders = DEFAULT_READERS;
+	int kbytes = DEFAULT_KBYTES;
+	char name[32];
+	int i;
+
+	if (argc > 1) {
+		nreaders = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		kbytes = atoi(argv[2]);
+	}
+	if (nreaders < 1 || nreaders > MAXREADERS || kbytes < 4 ||
+	    kbytes % 4 != 0) {
+		errx(1, "Usage: readconc [nreaders [kbytes]] "
+		     "(nreaders up to %d, kbytes a multiple of 4)", MAXREADERS);
+	}
+
+	for (i=0; i<nreaders; i++) {
+		makefile(i, kbytes);
+	}
+
+	run(1, kbytes);
+	run(nreaders, kbytes);
+
+	for (i=0; i<nreaders; i++) {
+		filename(name, sizeof(name), i);
+		remove(name);
+	}
+
+	printf("readconc: passed\n");
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * spawnrate - cost of launching a program.
+ *
+ * Usage: spawnrate [nspawns [program]]
+ *
+ * Times NSPAWNS rounds of fork+execv+waitpid of PROGRAM (by default
+ * /bin/true), then the same with vfork in place of fork and with
+ * spawn, and reports launches per second for each. Also reports the
+ * average and worst latency of the spawn call by itself.
+ *
+ * Before that, checks that a vfork child really runs on the parent's
+ * memory and that the parent doesn't continue until the child has
+ * exec'd or exited, and that spawn fails up front for a missing
+ * program and applies its descriptor map.
+ */
+
+#include <unistd.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_SPAWNS  200
+#define DEFAULT_PROG    "/bin/true"
+#define CATIN           "spawnrate.in"
+#define CATOUT          "spawnrate.out"
+#define CATTEXT         "spawned\n"
+
+static volatile int shared;
+
+static
+void
+checkvfork(void)
+{
+	pid_t pid;
+
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		/* We're on the parent's memory, and it's waiting for us */
+		shared = 1;
+		_exit(0);
+	}
+	if (shared != 1) {
+		errx(1, "vfork child's store to memory not seen by parent");
+	}
+	bench_reap(pid, 0);
+}
+
+static
+void
+writefile(const char *name, const char *text)
+{
+	int fd;
+	ssize_t len = strlen(text);
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	if (write(fd, text, len) != len) {
+		err(1, "%s: write", name);
+	}
+	close(fd);
+}
+
+static
+void
+checkspawn(void)
+{
+	struct spawn_fdmap map[2];
+	char *args[3];
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	args[0] = (char *)"/nonexistent/prog";
+	args[1] = NULL;
+	if (spawn(args[0], args, NULL, 0) >= 0) {
+		errx(1, "spawn of a missing program succeeded");
+	}
+	if (errno != ENOENT) {
+		err(1, "spawn of a missing program: expected ENOENT, got");
+	}
+
+	/* "cat CATIN > CATOUT", with the redirection done by the fd map */
+	writefile(CATIN, CATTEXT);
+	writefile(CATOUT, "");
+	fd = open(CATOUT, O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s", CATOUT);
+	}
+	map[0].sf_fd = STDOUT_FILENO;
+	map[0].sf_parentfd = fd;
+	map[1].sf_fd = fd;
+	map[1].sf_parentfd = -1;
+	args[0] = (char *)"/bin/cat";
+	args[1] = (char *)CATIN;
+	args[2] = NULL;
+	bench_reap(spawn(args[0], args, map, 2), 0);
+	close(fd);
+
+	fd = open(CATOUT, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", CATOUT);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		err(1, "%s: read", CATOUT);
+	}
+	buf[len] = 0;
+	if (strcmp(buf, CATTEXT) != 0) {
+		errx(1, "spawn: descriptor map not applied to stdout");
+	}
+	close(fd);
+	remove(CATIN);
+	remove(CATOUT);
+}
+
+static
+pid_t
+launch(int how, char **args)
+{
+	pid_t pid;
+
+	if (how == 2) {
+		pid = spawn(args[0], args, NULL, 0);
+		if (pid < 0) {
+			err(1, "spawn %s", args[0]);
+		}
+		return pid;
+	}
+
+	pid = how ? vfork() : fork();
+	if (pid < 0) {
+		err(1, how ? "vfork" : "fork");
+	}
+	if (pid == 0) {
+		execv(args[0], args);
+		_exit(1);
+	}
+	return pid;
+}
+
+static
+void
+spawnlatency(int count, char **args)
+{
+	struct benchtimer bt;
+	unsigned long long nsecs, total, max;
+	pid_t pid;
+	int i;
+
+	total = max = 0;
+	for (i=0; i<count; i++) {
+		benchtimer_start(&bt);
+		pid = launch(2, args);
+		nsecs = benchtimer_nsecs(&bt);
+		bench_reap(pid, 0);
+
+		total += nsecs;
+		if (nsecs > max) {
+			max = nsecs;
+		}
+	}
+	printf("spawnrate: spawn latency: avg %llu usec, max %llu usec\n",
+	       total / count / 1000ULL, max / 1000ULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *const names[3] = {
+		"fork+exec", "vfork+exec", "spawn"
+	};
+	int nspawns = DEFAULT_SPAWNS;
+	char *args[2];
+	struct benchtimer bt;
+	unsigned long long nsecs;
+	int i, how;
+
+	args[0] = (char *)DEFAULT_PROG;
+	args[1] = NULL;
+	if (argc > 1) {
+		nspawns = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		args[0] = argv[2];
+	}
+	if (nspawns < 1) {
+		errx(1, "Usage: spawnrate [nspawns [program]]");
+	}
+
+	checkvfork();
+	checkspawn();
+
+	for (how=0; how<3; how++) {
+		benchtimer_start(&bt);
+		for (i=0; i<nspawns; i++) {
+			bench_reap(launch(how, args), 0);
+		}
+		nsecs = benchtimer_nsecs(&bt);
+		bench_report("spawnrate", names[how], nspawns, NULL, nsecs);
+	}
+	spawnlatency(nspawns, args);
+
+	printf("spawnrate: passed\n");
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * vnodebench - cost of finding a file that's already open.
+ *
+ * Usage: vnodebench [nfiles [batch]]
+ *
+ * Creates NFILES files, then opens them BATCH at a time and keeps
+ * them open, so the number of vnodes the filesystem has loaded keeps
+ * growing. After each batch, times opening and closing a few of the
+ * files opened first, which are still open and so are found in the
+ * filesystem's table of loaded vnodes rather than read from disk.
+ * Those files were created first and sit at the front of the
+ * directory, so the directory search costs the same every round;
+ * if the latency grows with the number of files open, it's the
+ * vnode table lookup that's getting slower.
+ *
+ * Also reports the average latency of the first open of each batch
+ * of files, which does have to load the inode and scan further into
+ * the directory each time.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <err.h>
+#include <test/bench.h>
+
+#define DEFAULT_FILES  960
+#define DEFAULT_BATCH  64
+#define NPROBES        8
+#define PROBELOOPS     50
+
+static int held[OPEN_MAX];
+
+static
+void
+filename(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "vnodebench.%d", i);
+}
+
+static
+void
+makefiles(int nfiles)
+{
+	char name[32];
+	int i, fd;
+
+	for (i=0; i<nfiles; i++) {
+		filename(name, sizeof(name), i);
+		fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		close(fd);
+	}
+}
+
+/*
+ * Average time to open+close one of the first NPROBES files, all of
+ * which are being held open.
+ */
+static
+unsigned long long
+probe(void)
+{
+	char name[32];
+	struct benchtimer bt;
+	int i, j, fd;
+
+	benchtimer_start(&bt);
+	for (j=0; j<PROBELOOPS; j++) {
+		for (i=0; i<NPROBES; i++) {
+			filename(name, sizeof(name), i);
+			fd = open(name, O_RDONLY);
+			if (fd < 0) {
+				err(1, "%s", name);
+			}
+			close(fd);
+		}
+	}
+	return benchtimer_nsecs(&bt) / (PROBELOOPS * NPROBES);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nfiles = DEFAULT_FILES;
+	int batch = DEFAULT_BATCH;
+	char name[32];
+	struct benchtimer bt;
+	unsigned long long first;
+	int i, n;
+
+	if (argc > 1) {
+		nfiles = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		batch = atoi(argv[2]);
+	}
+	if (nfiles < NPROBES || nfiles > OPEN_MAX - 4 || batch < 1) {
+		errx(1, "Usage: vnodebench [nfiles [batch]] "
+		     "(nfiles from %d to %d)", NPROBES, OPEN_MAX - 4);
+	}
+
+	makefiles(nfiles);
+
+	for (n=0; n<nfiles; n += batch) {
+		benchtimer_start(&bt);
+		for (i=n; i<n+batch && i<nfiles; i++) {
+			filename(name, sizeof(name), i);
+			held[i] = open(name, O_RDONLY);
+			if (held[i] < 0) {
+				err(1, "%s", name);
+			}
+		}
+		first = benchtimer_nsecs(&bt) / (i - n);
+
+		if (i < NPROBES) {
+			continue;
+		}
+		printf("vnodebench: %4d open: first open %llu usec, "
+		       "reopen %llu usec\n", i, first / 1000ULL,
+		       probe() / 1000ULL);
+	}
+
+	for (i=0; i<nfiles; i++) {
+		close(held[i]);
+	}
+	for (i=0; i<nfiles; i++) {
+		filename(name, sizeof(name), i);
+		remove(name);
+	}
+
+	printf("vnodebench: passed\n");
+	return 0;
+}